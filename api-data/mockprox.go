@@ -2,34 +2,308 @@ package main
 
 import (
 	"bufio"
+	"encoding/json"
+	"flag"
 	"fmt"
+	"io"
 	"log"
+	"net"
 	"net/http"
 	"os"
 	"strconv"
+	"strings"
+	"time"
+)
+
+// Framing of the replies, see -mode
+const (
+	modeRaw     = "raw"
+	modeClose   = "close"
+	modeLength  = "length"
+	modeChunked = "chunked"
 )
 
 var httpListenPort = 80
 var replyText []byte
 
-func handler(responseToRequest http.ResponseWriter, incomingRequest *http.Request) {
+// Reply text and token counts taken from the reply file, served in the format of each API
+var replyContent string
+var replyPromptTokens = 0
+var replyCompletionTokens = 0
+var replyParsed = false
 
-	host := incomingRequest.Host
-	url := incomingRequest.URL
-	log.Printf("Received request for host %s and url %s", host, url)
-	log.Printf("%s", url.Path)
+var replyFile = flag.String("reply", "reply.txt", "ChatGPT reply the replies are made from")
+var replyMode = flag.String("mode", modeRaw, "raw: reply file as is without a HTTP header, then close. close: headers and close. length: Content-Length. chunked: chunked encoding")
+var firstByteDelay = flag.Int("ttfb", 0, "ms before the first byte of the reply")
+var pieceDelay = flag.Int("delay", 0, "ms between pieces of the reply")
+var pieceSize = flag.Int("piece", 0, "bytes in each piece of a complete reply, 0 for one piece. Streamed replies have one event in each piece")
+var tokenSize = flag.Int("token", 4, "characters of reply text in each streamed event")
+var byteRate = flag.Int("rate", 0, "bytes per second the reply is sent at, 0 for no limit")
+var alwaysEcho = flag.Bool("echo", false, "Hugging Face repeats the prompt before the reply even when asked not to")
+
+// Parts of the request bodies the replies depend on
+type chatRequest struct {
+	Model      string `json:"model"`
+	Stream     *bool  `json:"stream"`
+	Inputs     string `json:"inputs"`
+	Parameters struct {
+		ReturnFullText *bool `json:"return_full_text"`
+	} `json:"parameters"`
+}
+
+type chatGPTReply struct {
+	Choices []struct {
+		Message struct {
+			Content string `json:"content"`
+		} `json:"message"`
+	} `json:"choices"`
+	Usage struct {
+		PromptTokens     int `json:"prompt_tokens"`
+		CompletionTokens int `json:"completion_tokens"`
+	} `json:"usage"`
+}
+
+// Timings of one request for the log
+type requestTiming struct {
+	received  time.Time
+	firstByte time.Time
+	bytes     int
+	pieces    int
+}
+
+// Writes to the connection no faster than -rate allows
+type pacedWriter struct {
+	conn    net.Conn
+	started time.Time
+	written int
+	timing  *requestTiming
+}
+
+func (writer *pacedWriter) Write(data []byte) (int, error) {
+	if writer.timing.bytes == 0 {
+		writer.timing.firstByte = time.Now()
+	}
+
+	total := 0
+
+	for len(data) > 0 {
+		length := len(data)
+
+		// Small writes so the rate holds within a piece as well
+		if *byteRate > 0 && length > 512 {
+			length = 512
+		}
+
+		if *byteRate > 0 {
+			if writer.written == 0 {
+				writer.started = time.Now()
+			}
+
+			due := writer.started.Add(time.Duration(writer.written) * time.Second / time.Duration(*byteRate))
+			time.Sleep(time.Until(due))
+		}
+
+		n, err := writer.conn.Write(data[:length])
+		total += n
+		writer.written += n
+		writer.timing.bytes += n
+
+		if err != nil {
+			return total, err
+		}
+
+		data = data[length:]
+	}
+
+	return total, nil
+}
+
+func marshal(value interface{}) string {
+	text, _ := json.Marshal(value)
+	return string(text)
+}
+
+// Reply text cut into the pieces of a streamed reply
+func tokens() []string {
+	var pieces []string
+	runes := []rune(replyContent)
+
+	for start := 0; start < len(runes); start += *tokenSize {
+		end := start + *tokenSize
+
+		if end > len(runes) {
+			end = len(runes)
+		}
+
+		pieces = append(pieces, string(runes[start:end]))
+	}
+
+	return pieces
+}
+
+// Server-sent events with the reply text, then the token counts
+func chatGPTPieces(request chatRequest) []string {
+	var pieces []string
+
+	for _, token := range tokens() {
+		event := map[string]interface{}{
+			"object":  "chat.completion.chunk",
+			"model":   request.Model,
+			"choices": []interface{}{map[string]interface{}{"index": 0, "delta": map[string]string{"content": token}}},
+		}
+		pieces = append(pieces, "data: "+marshal(event)+"\n\n")
+	}
+
+	usage := map[string]interface{}{
+		"object":  "chat.completion.chunk",
+		"model":   request.Model,
+		"choices": []interface{}{},
+		"usage":   map[string]int{"prompt_tokens": replyPromptTokens, "completion_tokens": replyCompletionTokens, "total_tokens": replyPromptTokens + replyCompletionTokens},
+	}
+	pieces = append(pieces, "data: "+marshal(usage)+"\n\n", "data: [DONE]\n\n")
+
+	return pieces
+}
+
+func ollamaPieces(request chatRequest, stream bool) []string {
+	done := map[string]interface{}{
+		"model":             request.Model,
+		"message":           map[string]string{"role": "assistant", "content": ""},
+		"done":              true,
+		"prompt_eval_count": replyPromptTokens,
+		"eval_count":        replyCompletionTokens,
+	}
+
+	if !stream {
+		done["message"] = map[string]string{"role": "assistant", "content": replyContent}
+		return []string{marshal(done)}
+	}
+
+	var pieces []string
+
+	for _, token := range tokens() {
+		event := map[string]interface{}{
+			"model":   request.Model,
+			"message": map[string]string{"role": "assistant", "content": token},
+			"done":    false,
+		}
+		pieces = append(pieces, marshal(event)+"\n")
+	}
+
+	return append(pieces, marshal(done)+"\n")
+}
+
+// Hugging Face gives back the prompt followed by the reply unless return_full_text is false
+func huggingFacePieces(request chatRequest) []string {
+	generatedText := replyContent
+
+	if *alwaysEcho || request.Parameters.ReturnFullText == nil || *request.Parameters.ReturnFullText {
+		generatedText = request.Inputs + replyContent
+	}
+
+	return []string{marshal([]interface{}{map[string]string{"generated_text": generatedText}})}
+}
+
+// Split a complete reply into pieces of -piece bytes
+func splitPieces(body string) []string {
+	if *pieceSize <= 0 {
+		return []string{body}
+	}
+
+	var pieces []string
+
+	for len(body) > *pieceSize {
+		pieces = append(pieces, body[:*pieceSize])
+		body = body[*pieceSize:]
+	}
+
+	return append(pieces, body)
+}
+
+// Pieces of the reply body and its content type for the API the request is for
+func replyFor(request *http.Request, body []byte) ([]string, string, string) {
+	var parsed chatRequest
+	json.Unmarshal(body, &parsed)
+
+	if request.Method != "POST" {
+		return []string{"Unknown request"}, "text/plain", "unknown"
+	}
 
-	var reply []byte = []byte("Unknown request")
+	switch {
+	case request.URL.Path == "/v1/chat/completions":
+		stream := parsed.Stream != nil && *parsed.Stream
 
-	switch incomingRequest.Method {
-	case "POST":
-		switch url.Path {
-		case "/v1/chat/completions":
-			reply = replyText
+		if stream && replyParsed {
+			return chatGPTPieces(parsed), "text/event-stream", "chatgpt stream"
 		}
 
+		return splitPieces(string(replyText)), "application/json", "chatgpt"
+
+	case request.URL.Path == "/api/chat" && replyParsed:
+		// Ollama streams unless asked not to
+		if parsed.Stream == nil || *parsed.Stream {
+			return ollamaPieces(parsed, true), "application/x-ndjson", "ollama stream"
+		}
+
+		return splitPieces(ollamaPieces(parsed, false)[0]), "application/json", "ollama"
+
+	case strings.HasPrefix(request.URL.Path, "/models/") && replyParsed:
+		return splitPieces(huggingFacePieces(parsed)[0]), "application/json", "huggingface"
 	}
 
+	return []string{"Unknown request"}, "text/plain", "unknown"
+}
+
+// Write the reply with the framing of -mode, waiting -delay between pieces
+func writeReply(writer io.Writer, pieces []string, contentType string, keepAlive bool) {
+	if *replyMode != modeRaw {
+		header := "HTTP/1.1 200 OK\r\nContent-Type: " + contentType + "\r\n"
+
+		switch *replyMode {
+		case modeLength:
+			length := 0
+			for _, piece := range pieces {
+				length += len(piece)
+			}
+			header += "Content-Length: " + strconv.Itoa(length) + "\r\n"
+		case modeChunked:
+			header += "Transfer-Encoding: chunked\r\n"
+		}
+
+		if keepAlive {
+			header += "Connection: keep-alive\r\n\r\n"
+		} else {
+			header += "Connection: close\r\n\r\n"
+		}
+
+		io.WriteString(writer, header)
+	}
+
+	for i, piece := range pieces {
+		if i > 0 && *pieceDelay > 0 {
+			time.Sleep(time.Duration(*pieceDelay) * time.Millisecond)
+		}
+
+		if *replyMode == modeChunked {
+			io.WriteString(writer, fmt.Sprintf("%x\r\n%s\r\n", len(piece), piece))
+		} else {
+			io.WriteString(writer, piece)
+		}
+	}
+
+	if *replyMode == modeChunked {
+		io.WriteString(writer, "0\r\n\r\n")
+	}
+}
+
+func handler(responseToRequest http.ResponseWriter, incomingRequest *http.Request) {
+
+	timing := requestTiming{received: time.Now()}
+
+	host := incomingRequest.Host
+	url := incomingRequest.URL
+	log.Printf("Received request for host %s and url %s", host, url)
+
 	// Prepare the requesting socket for writing. Access raw socket by hijacking
 	// Reference: https://stackoverflow.com/questions/29531993/accessing-the-underlying-socket-of-a-net-http-response
 
@@ -38,7 +312,9 @@ func handler(responseToRequest http.ResponseWriter, incomingRequest *http.Reques
 		http.Error(responseToRequest, "webserver doesn't support hijacking", http.StatusInternalServerError)
 		return
 	}
-	returnConn, _, err := hj.Hijack()
+
+	body, _ := io.ReadAll(incomingRequest.Body)
+	returnConn, bufrw, err := hj.Hijack()
 
 	if err != nil {
 		http.Error(responseToRequest, err.Error(), http.StatusInternalServerError)
@@ -47,9 +323,49 @@ func handler(responseToRequest http.ResponseWriter, incomingRequest *http.Reques
 
 	defer returnConn.Close()
 
-	fmt.Println(string(reply))
+	// Requests that follow on a kept-alive connection are answered here as the connection is no longer the server's
+	for {
+		timing.bytes = 0
+
+		pieces, contentType, api := replyFor(incomingRequest, body)
+		timing.pieces = len(pieces)
+
+		// Without a length the end of the reply is only known when the connection closes
+		keepAlive := !incomingRequest.Close && (*replyMode == modeLength || *replyMode == modeChunked)
+
+		if *firstByteDelay > 0 {
+			time.Sleep(time.Duration(*firstByteDelay) * time.Millisecond)
+		}
+
+		writeReply(&pacedWriter{conn: returnConn, timing: &timing}, pieces, contentType, keepAlive)
+
+		done := time.Now()
+		rate := 0.0
+
+		// Rate of the reply once it has started
+		if seconds := done.Sub(timing.firstByte).Seconds(); seconds > 0 {
+			rate = float64(timing.bytes) / seconds
+		}
+
+		log.Printf("%s %s (%s): %d request bytes, %d reply bytes in %d pieces, first byte %d ms, done %d ms, %.0f bytes/s",
+			incomingRequest.Method, url.Path, api, len(body), timing.bytes, timing.pieces,
+			timing.firstByte.Sub(timing.received).Milliseconds(), done.Sub(timing.received).Milliseconds(), rate)
+
+		if !keepAlive {
+			break
+		}
+
+		incomingRequest, err = http.ReadRequest(bufrw.Reader)
+
+		if err != nil {
+			break
+		}
 
-	returnConn.Write(reply)
+		timing.received = time.Now()
+		url = incomingRequest.URL
+		body, _ = io.ReadAll(incomingRequest.Body)
+		log.Printf("Received request on the same connection for url %s", url)
+	}
 
 	log.Println("End of handler")
 
@@ -57,9 +373,15 @@ func handler(responseToRequest http.ResponseWriter, incomingRequest *http.Reques
 
 func main() {
 
-	argsWithoutProg := os.Args[1:]
+	flag.Usage = func() {
+		fmt.Fprintf(os.Stderr, "Usage: mockprox [options] [port]\n")
+		flag.PrintDefaults()
+	}
+	flag.Parse()
+
+	argsWithoutProg := flag.Args()
 
-	if len(argsWithoutProg) >= 3 {
+	if len(argsWithoutProg) >= 1 {
 		parsedHTTPPort, err := strconv.ParseInt(argsWithoutProg[0], 10, 32)
 
 		if err != nil {
@@ -70,8 +392,32 @@ func main() {
 		httpListenPort = int(parsedHTTPPort)
 	}
 
+	switch *replyMode {
+	case modeRaw, modeClose, modeLength, modeChunked:
+	default:
+		log.Printf("Unknown mode %s", *replyMode)
+		return
+	}
+
+	var err error
+	replyText, err = readFile(*replyFile)
+
+	if err != nil {
+		log.Printf("Cannot read %s: %v", *replyFile, err)
+		return
+	}
+
+	// Other APIs and streaming can only be served if the reply file is a ChatGPT reply
+	var parsed chatGPTReply
 
-	replyText, _ = readFile("reply.txt")
+	if json.Unmarshal(replyText, &parsed) == nil && len(parsed.Choices) > 0 {
+		replyContent = parsed.Choices[0].Message.Content
+		replyPromptTokens = parsed.Usage.PromptTokens
+		replyCompletionTokens = parsed.Usage.CompletionTokens
+		replyParsed = true
+	} else {
+		log.Printf("%s is not a ChatGPT reply, it is only sent as is for /v1/chat/completions", *replyFile)
+	}
 
 	log.Printf("Starting Mock Server listening to %d", httpListenPort)
 
@@ -99,7 +445,7 @@ func readFile(filename string) ([]byte, error) {
 	bytes := make([]byte, size)
 
 	bufr := bufio.NewReader(file)
-	_, err = bufr.Read(bytes)
+	_, err = io.ReadFull(bufr, bytes)
 
 	return bytes, err
 }
@@ -0,0 +1,304 @@
+#include "chatlog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CHATLOG_PATH_SIZE 256
+
+FILE * chatlogFile = NULL;
+FILE * chatlogIndex = NULL;
+
+// Where the next record goes, just after the last record listed in the index
+uint32_t chatlogEnd;
+long chatlogEntries;
+
+void chatlog_index_path(const char * logPath, char * indexPath, int indexPathSize){
+    strncpy(indexPath, logPath, indexPathSize - 1);
+    indexPath[indexPathSize - 1] = '\0';
+
+    // Replace the extension but not a dot in a directory name
+    char * dot = strrchr(indexPath, '.');
+    char * separator = strrchr(indexPath, '\\');
+
+    if(dot != NULL && (separator == NULL || dot > separator)){
+        *dot = '\0';
+    }
+
+    if(strlen(indexPath) + strlen(CHATLOG_INDEX_EXTENSION) < (size_t) indexPathSize){
+        strcat(indexPath, CHATLOG_INDEX_EXTENSION);
+    }
+}
+
+bool chatlog_write_header(FILE * file, const char * magic){
+    CHATLOG_FILE_HEADER header;
+    memcpy(header.magic, magic, CHATLOG_MAGIC_LENGTH);
+    header.version = CHATLOG_VERSION;
+    header.reserved = 0;
+
+    fseek(file, 0, SEEK_SET);
+    return fwrite(&header, sizeof(CHATLOG_FILE_HEADER), 1, file) == 1;
+}
+
+bool chatlog_read_header(FILE * file, const char * magic){
+    CHATLOG_FILE_HEADER header;
+
+    fseek(file, 0, SEEK_SET);
+    if(fread(&header, sizeof(CHATLOG_FILE_HEADER), 1, file) != 1){
+        return false;
+    }
+
+    return memcmp(header.magic, magic, CHATLOG_MAGIC_LENGTH) == 0 && header.version == CHATLOG_VERSION;
+}
+
+long chatlog_index_entries(FILE * index){
+    fseek(index, 0, SEEK_END);
+    long size = ftell(index) - sizeof(CHATLOG_FILE_HEADER);
+
+    // An entry cut short when the app was stopped is ignored
+    return size > 0 ? size / sizeof(CHATLOG_INDEX_ENTRY) : 0;
+}
+
+bool chatlog_read_index(FILE * index, long entryNumber, CHATLOG_INDEX_ENTRY * entry){
+    fseek(index, sizeof(CHATLOG_FILE_HEADER) + entryNumber * sizeof(CHATLOG_INDEX_ENTRY), SEEK_SET);
+    return fread(entry, sizeof(CHATLOG_INDEX_ENTRY), 1, index) == 1;
+}
+
+bool chatlog_read_record(FILE * log, uint32_t offset, CHATLOG_RECORD * record, char * content, int contentSize){
+    fseek(log, offset, SEEK_SET);
+
+    if(fread(record, sizeof(CHATLOG_RECORD), 1, log) != 1){
+        return false;
+    }
+
+    int length = record->length < contentSize ? record->length : contentSize;
+
+    return length == 0 || fread(content, 1, length, log) == (size_t) length;
+}
+
+long chatlog_rebuild_index(FILE * log, FILE * index){
+    fseek(log, 0, SEEK_END);
+    uint32_t logSize = ftell(log);
+    uint32_t offset = sizeof(CHATLOG_FILE_HEADER);
+    long entries = 0;
+
+    CHATLOG_RECORD record;
+    CHATLOG_INDEX_ENTRY entry;
+
+    fseek(index, sizeof(CHATLOG_FILE_HEADER), SEEK_SET);
+
+    while(offset + sizeof(CHATLOG_RECORD) <= logSize){
+        fseek(log, offset, SEEK_SET);
+
+        if(fread(&record, sizeof(CHATLOG_RECORD), 1, log) != 1){
+            break;
+        }
+
+        // Stop at a record cut short or damaged
+        if(offset + sizeof(CHATLOG_RECORD) + record.length > logSize || (record.role != CHATLOG_ROLE_USER && record.role != CHATLOG_ROLE_ASSISTANT)){
+            break;
+        }
+
+        entry.offset = offset;
+        entry.timestamp = record.timestamp;
+        entry.tokens = record.tokens;
+        entry.length = record.length;
+        entry.role = record.role;
+        entry.flags = record.flags;
+        entry.reserved = 0;
+
+        if(fwrite(&entry, sizeof(CHATLOG_INDEX_ENTRY), 1, index) != 1){
+            break;
+        }
+
+        entries++;
+        offset += sizeof(CHATLOG_RECORD) + record.length;
+    }
+
+    fflush(index);
+    return entries;
+}
+
+// Open an existing file for update or create it with a new header
+FILE * chatlog_open_file(char * path, const char * magic){
+    FILE * file = fopen(path, "r+b");
+
+    if(file != NULL){
+        if(chatlog_read_header(file, magic)){
+            return file;
+        }
+
+        fclose(file);
+        return NULL;
+    }
+
+    file = fopen(path, "w+b");
+
+    if(file != NULL && !chatlog_write_header(file, magic)){
+        fclose(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+bool chatlog_open(char * logPath){
+    char indexPath[CHATLOG_PATH_SIZE];
+    chatlog_index_path(logPath, indexPath, CHATLOG_PATH_SIZE);
+
+    chatlogFile = chatlog_open_file(logPath, CHATLOG_MAGIC);
+
+    if(chatlogFile == NULL){
+        return false;
+    }
+
+    chatlogIndex = chatlog_open_file(indexPath, CHATLOG_INDEX_MAGIC);
+
+    if(chatlogIndex == NULL){
+        chatlog_close();
+        return false;
+    }
+
+    chatlogEntries = chatlog_index_entries(chatlogIndex);
+    chatlogEnd = sizeof(CHATLOG_FILE_HEADER);
+
+    // Index is new or was lost, list what is already in the log so it is not overwritten
+    if(chatlogEntries == 0){
+        chatlogEntries = chatlog_rebuild_index(chatlogFile, chatlogIndex);
+    }
+
+    CHATLOG_INDEX_ENTRY last;
+
+    // A record written without its index entry was cut short and will be overwritten
+    if(chatlogEntries > 0 && chatlog_read_index(chatlogIndex, chatlogEntries - 1, &last)){
+        chatlogEnd = last.offset + sizeof(CHATLOG_RECORD) + last.length;
+    }
+
+    return true;
+}
+
+void chatlog_close(){
+    if(chatlogFile != NULL){
+        fclose(chatlogFile);
+        chatlogFile = NULL;
+    }
+
+    if(chatlogIndex != NULL){
+        fclose(chatlogIndex);
+        chatlogIndex = NULL;
+    }
+}
+
+// Write a record with its content to the log and fill in its index entry
+bool chatlog_write_record(uint8_t role, uint32_t timestamp, int tokens, char * content, int length, CHATLOG_INDEX_ENTRY * entry){
+    CHATLOG_RECORD record;
+    record.timestamp = timestamp;
+    record.tokens = tokens;
+    record.length = length;
+    record.role = role;
+    record.flags = 0;
+    record.reserved = 0;
+
+    entry->offset = chatlogEnd;
+    entry->timestamp = timestamp;
+    entry->tokens = tokens;
+    entry->length = length;
+    entry->role = role;
+    entry->flags = 0;
+    entry->reserved = 0;
+
+    fseek(chatlogFile, chatlogEnd, SEEK_SET);
+
+    if(fwrite(&record, sizeof(CHATLOG_RECORD), 1, chatlogFile) != 1 || fwrite(content, 1, length, chatlogFile) != (size_t) length){
+        return false;
+    }
+
+    chatlogEnd += sizeof(CHATLOG_RECORD) + length;
+    return true;
+}
+
+bool chatlog_add_turn(char * message, int messageLength, int promptTokens, char * reply, int replyLength, int completionTokens){
+
+    if(chatlogFile == NULL){
+        return false;
+    }
+
+    uint32_t timestamp = (uint32_t) time(NULL);
+    CHATLOG_INDEX_ENTRY entries[2];
+
+    if(!chatlog_write_record(CHATLOG_ROLE_USER, timestamp, promptTokens, message, messageLength, &entries[0])
+        || !chatlog_write_record(CHATLOG_ROLE_ASSISTANT, timestamp, completionTokens, reply, replyLength, &entries[1])){
+        return false;
+    }
+
+    // Log is on disk before the index points to it
+    fflush(chatlogFile);
+
+    fseek(chatlogIndex, sizeof(CHATLOG_FILE_HEADER) + chatlogEntries * sizeof(CHATLOG_INDEX_ENTRY), SEEK_SET);
+
+    if(fwrite(entries, sizeof(CHATLOG_INDEX_ENTRY), 2, chatlogIndex) != 2){
+        return false;
+    }
+
+    fflush(chatlogIndex);
+    chatlogEntries += 2;
+    return true;
+}
+
+int chatlog_load_recent(int maxTurns, CHATLOG_TURN_HANDLER handleTurn){
+
+    if(chatlogFile == NULL || maxTurns <= 0){
+        return 0;
+    }
+
+    // Walk back through the index to find where the recent turns start
+    long firstEntry = chatlogEntries;
+    int turns = 0;
+
+    CHATLOG_INDEX_ENTRY entry;
+    CHATLOG_INDEX_ENTRY previous;
+
+    for(long i = chatlogEntries - 1; i > 0 && turns < maxTurns; i--){
+        if(!chatlog_read_index(chatlogIndex, i, &entry) || entry.role != CHATLOG_ROLE_ASSISTANT){
+            continue;
+        }
+
+        if(!chatlog_read_index(chatlogIndex, i - 1, &previous) || previous.role != CHATLOG_ROLE_USER){
+            continue;
+        }
+
+        firstEntry = --i;
+        turns++;
+    }
+
+    int loaded = 0;
+
+    for(long i = firstEntry; i + 1 < chatlogEntries; i++){
+        if(!chatlog_read_index(chatlogIndex, i, &previous) || previous.role != CHATLOG_ROLE_USER){
+            continue;
+        }
+
+        if(!chatlog_read_index(chatlogIndex, i + 1, &entry) || entry.role != CHATLOG_ROLE_ASSISTANT){
+            continue;
+        }
+
+        char * content = (char *) malloc(previous.length + entry.length + 1);
+
+        if(content == NULL){
+            break;
+        }
+
+        CHATLOG_RECORD record;
+
+        if(chatlog_read_record(chatlogFile, previous.offset, &record, content, previous.length)
+            && chatlog_read_record(chatlogFile, entry.offset, &record, content + previous.length, entry.length)){
+            handleTurn(content, previous.length, content + previous.length, entry.length);
+            loaded++;
+        }
+
+        free(content);
+        i++;
+    }
+
+    return loaded;
+}
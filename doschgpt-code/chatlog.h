@@ -0,0 +1,104 @@
+// Structured conversation log for -lgX. A turn is written as a user record followed by an
+// assistant record. Each record is also listed in a small index file so recent turns can
+// be reloaded and the log searched without reading through all of it.
+//
+// Log file:   [CHATLOG_FILE_HEADER][CHATLOG_RECORD][content]...
+// Index file: [CHATLOG_FILE_HEADER][CHATLOG_INDEX_ENTRY]...
+//
+// The index is kept next to the log with the extension replaced by CHATLOG_INDEX_EXTENSION.
+// Content is the JSON-escaped text exactly as sent to and received from the server.
+// All values are little endian. Structures are sized to need no padding.
+
+#include <stdio.h>
+#include "types.h"
+
+#define CHATLOG_MAGIC "DCGL"
+#define CHATLOG_INDEX_MAGIC "DCGI"
+#define CHATLOG_MAGIC_LENGTH 4
+#define CHATLOG_VERSION 1
+
+#define CHATLOG_INDEX_EXTENSION ".idx"
+
+#define CHATLOG_ROLE_USER 1
+#define CHATLOG_ROLE_ASSISTANT 2
+
+typedef struct
+{
+    char magic[CHATLOG_MAGIC_LENGTH];
+    uint16_t version;
+    uint16_t reserved;
+
+} CHATLOG_FILE_HEADER;
+
+// Precedes the content of every message in the log
+typedef struct
+{
+    // Seconds since 1970 when the message was logged
+    uint32_t timestamp;
+
+    // Tokens reported by the server, prompt tokens for user and completion tokens for assistant
+    uint16_t tokens;
+
+    // Bytes of content following this record
+    uint16_t length;
+
+    // One of the CHATLOG_ROLE_X
+    uint8_t role;
+
+    uint8_t flags;
+    uint16_t reserved;
+
+} CHATLOG_RECORD;
+
+// One for every record in the log, in the same order
+typedef struct
+{
+    // Position of the CHATLOG_RECORD in the log file
+    uint32_t offset;
+
+    uint32_t timestamp;
+    uint16_t tokens;
+    uint16_t length;
+    uint8_t role;
+    uint8_t flags;
+    uint16_t reserved;
+
+} CHATLOG_INDEX_ENTRY;
+
+// Open or create the log and its index for appending turns
+bool chatlog_open(char * logPath);
+
+// Write out anything pending and close the log
+void chatlog_close();
+
+// Append a completed turn, message and reply are JSON-escaped
+bool chatlog_add_turn(char * message, int messageLength, int promptTokens, char * reply, int replyLength, int completionTokens);
+
+// Called for each turn read back from the log, message and reply are JSON-escaped
+typedef void (*CHATLOG_TURN_HANDLER)(char * message, int messageLength, char * reply, int replyLength);
+
+// Pass up to maxTurns of the most recent turns to handleTurn, oldest first.
+// Returns the number of turns passed
+int chatlog_load_recent(int maxTurns, CHATLOG_TURN_HANDLER handleTurn);
+
+// Functions below are shared with logtool
+
+// Path of the index file belonging to a log
+void chatlog_index_path(const char * logPath, char * indexPath, int indexPathSize);
+
+bool chatlog_write_header(FILE * file, const char * magic);
+
+// Check the header at the start of the file
+bool chatlog_read_header(FILE * file, const char * magic);
+
+// Number of complete entries in the index
+long chatlog_index_entries(FILE * index);
+
+bool chatlog_read_index(FILE * index, long entryNumber, CHATLOG_INDEX_ENTRY * entry);
+
+// Write an index entry after the header for every complete record in the log.
+// Returns the number of entries written
+long chatlog_rebuild_index(FILE * log, FILE * index);
+
+// Read a record and up to contentSize bytes of its content
+bool chatlog_read_record(FILE * log, uint32_t offset, CHATLOG_RECORD * record, char * content, int contentSize);
@@ -0,0 +1,255 @@
+#include "convo.h"
+#include "ems.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Rough number of characters per token for English text
+#define CONVO_CHARS_PER_TOKEN 4
+
+// Tokens added by the API for the role and framing of each message
+#define CONVO_TOKENS_PER_MESSAGE 4
+
+#define CONVO_USER_MESSAGE_START "{\"role\": \"user\", \"content\": \""
+#define CONVO_ASSISTANT_MESSAGE_START "{\"role\": \"assistant\", \"content\": \""
+#define CONVO_MESSAGE_END "\"}, "
+#define CONVO_INST_START "[INST]"
+#define CONVO_INST_END "[/INST]"
+
+// Text in expanded memory is copied out in pieces of this size to be written
+#define CONVO_EMS_CHUNK_SIZE 512
+
+typedef struct
+{
+    // Message starts at offset in the arena and the reply follows it
+    long offset;
+    int messageLength;
+    int replyLength;
+
+    // Approximate token cost of the message and reply
+    int tokens;
+
+} CONVO_TURN;
+
+// Turns from oldest to newest, their text packed back to back in the arena.
+// The arena is in conventional memory or in expanded memory with -ems.
+char * convoArena = NULL;
+EMS_BLOCK convoEmsArena;
+bool convoInEms = false;
+long convoArenaSize = 0;
+long convoArenaUsed = 0;
+
+char convoChunk[CONVO_EMS_CHUNK_SIZE];
+
+CONVO_TURN convoTurns[CONVO_MAX_TURNS];
+int convoNumTurns = 0;
+int convoTotalTokens = 0;
+
+// Oldest turns left out of the request being sent to keep within the token budget.
+// They are only dropped once the reply arrives so a cancelled request loses nothing.
+int convoTurnsLeftOut = 0;
+
+int convoTokenBudget;
+
+bool convo_init(int tokenBudget, bool useExpandedMemory){
+    convoInEms = useExpandedMemory && ems_alloc(&convoEmsArena, CONVO_EMS_ARENA_SIZE);
+
+    if(convoInEms){
+        convoArenaSize = convoEmsArena.size;
+    } else {
+        convoArena = (char *) calloc(CONVO_ARENA_SIZE, sizeof(char));
+
+        if(convoArena == NULL){
+            return false;
+        }
+
+        convoArenaSize = CONVO_ARENA_SIZE;
+    }
+
+    convoArenaUsed = 0;
+    convoNumTurns = 0;
+    convoTotalTokens = 0;
+    convoTurnsLeftOut = 0;
+    convoTokenBudget = tokenBudget;
+    return true;
+}
+
+void convo_stop(){
+    if(convoArena != NULL){
+        free(convoArena);
+        convoArena = NULL;
+    }
+
+    if(convoInEms){
+        ems_free(&convoEmsArena);
+        convoInEms = false;
+    }
+}
+
+bool convo_in_expanded_memory(){
+    return convoInEms;
+}
+
+int convo_estimate_tokens(int length){
+    return (length + CONVO_CHARS_PER_TOKEN - 1) / CONVO_CHARS_PER_TOKEN + CONVO_TOKENS_PER_MESSAGE;
+}
+
+int convo_escaped_length(char * text, int length, int maxLength){
+    int limit = length < maxLength ? length : maxLength;
+    int safeLength = 0;
+    int i = 0;
+
+    while(i < limit){
+        if(text[i] == '\\'){
+            i += i + 1 < length && text[i + 1] == 'u' ? 6 : 2;
+        } else {
+            i++;
+        }
+
+        if(i <= limit){
+            safeLength = i;
+        }
+    }
+
+    return safeLength;
+}
+
+// Remove the oldest turn and move the rest of the arena forward
+void convo_drop_oldest(){
+    if(convoNumTurns == 0){
+        return;
+    }
+
+    int bytesDropped = convoTurns[0].messageLength + convoTurns[0].replyLength;
+
+    if(convoInEms){
+        ems_move(&convoEmsArena, 0, bytesDropped, convoArenaUsed - bytesDropped);
+    } else {
+        memmove(convoArena, convoArena + bytesDropped, convoArenaUsed - bytesDropped);
+    }
+
+    convoArenaUsed -= bytesDropped;
+    convoTotalTokens -= convoTurns[0].tokens;
+
+    memmove(convoTurns, convoTurns + 1, (convoNumTurns - 1) * sizeof(CONVO_TURN));
+    convoNumTurns--;
+
+    if(convoTurnsLeftOut > 0){
+        convoTurnsLeftOut--;
+    }
+
+    for(int i = 0; i < convoNumTurns; i++){
+        convoTurns[i].offset -= bytesDropped;
+    }
+}
+
+void convo_fit_budget(int newMessageLength){
+    int tokens = convoTotalTokens + convo_estimate_tokens(newMessageLength);
+
+    convoTurnsLeftOut = 0;
+
+    while(convoTurnsLeftOut < convoNumTurns && tokens > convoTokenBudget){
+        tokens -= convoTurns[convoTurnsLeftOut++].tokens;
+    }
+}
+
+// Space in an arena of arenaSize for text of length, an int as the text is in conventional memory
+int convo_space_for(long arenaSize, int length){
+    return arenaSize < length ? (int) arenaSize : length;
+}
+
+void convo_add_turn(char * message, int messageLength, char * reply, int replyLength){
+
+    if(convoArena == NULL && !convoInEms){
+        return;
+    }
+
+    // A turn larger than the whole arena keeps the start of the reply
+    messageLength = convo_escaped_length(message, messageLength, convo_space_for(convoArenaSize, messageLength));
+    replyLength = convo_escaped_length(reply, replyLength, convo_space_for(convoArenaSize - messageLength, replyLength));
+
+    int turnLength = messageLength + replyLength;
+
+    // Turns that did not fit the budget of the request are not needed any more
+    while(convoTurnsLeftOut > 0){
+        convo_drop_oldest();
+    }
+
+    while(convoNumTurns == CONVO_MAX_TURNS || convoArenaUsed + turnLength > convoArenaSize){
+        convo_drop_oldest();
+    }
+
+    CONVO_TURN * turn = &convoTurns[convoNumTurns++];
+    turn->offset = convoArenaUsed;
+    turn->messageLength = messageLength;
+    turn->replyLength = replyLength;
+    turn->tokens = convo_estimate_tokens(messageLength) + convo_estimate_tokens(replyLength);
+
+    if(convoInEms){
+        ems_write(&convoEmsArena, convoArenaUsed, message, messageLength);
+        ems_write(&convoEmsArena, convoArenaUsed + messageLength, reply, replyLength);
+    } else {
+        memcpy(convoArena + convoArenaUsed, message, messageLength);
+        memcpy(convoArena + convoArenaUsed + messageLength, reply, replyLength);
+    }
+
+    convoArenaUsed += turnLength;
+    convoTotalTokens += turn->tokens;
+}
+
+void convo_write_str(ConvoWriteCallback write, const char * str){
+    write(str, strlen(str));
+}
+
+// Write text from the arena, copied out a piece at a time from expanded memory
+void convo_write_text(ConvoWriteCallback write, long offset, int length){
+    if(!convoInEms){
+        write(convoArena + offset, length);
+        return;
+    }
+
+    while(length > 0){
+        int bytesToCopy = length < CONVO_EMS_CHUNK_SIZE ? length : CONVO_EMS_CHUNK_SIZE;
+
+        if(!ems_read(&convoEmsArena, offset, convoChunk, bytesToCopy)){
+            return;
+        }
+
+        write(convoChunk, bytesToCopy);
+        offset += bytesToCopy;
+        length -= bytesToCopy;
+    }
+}
+
+void convo_write_chat_messages(ConvoWriteCallback write){
+    for(int i = convoTurnsLeftOut; i < convoNumTurns; i++){
+        CONVO_TURN * turn = &convoTurns[i];
+
+        convo_write_str(write, CONVO_USER_MESSAGE_START);
+        convo_write_text(write, turn->offset, turn->messageLength);
+        convo_write_str(write, CONVO_MESSAGE_END);
+
+        convo_write_str(write, CONVO_ASSISTANT_MESSAGE_START);
+        convo_write_text(write, turn->offset + turn->messageLength, turn->replyLength);
+        convo_write_str(write, CONVO_MESSAGE_END);
+    }
+}
+
+void convo_write_inst_chain(ConvoWriteCallback write){
+    for(int i = convoTurnsLeftOut; i < convoNumTurns; i++){
+        CONVO_TURN * turn = &convoTurns[i];
+
+        convo_write_str(write, CONVO_INST_START);
+        convo_write_text(write, turn->offset, turn->messageLength);
+        convo_write_str(write, CONVO_INST_END);
+        convo_write_text(write, turn->offset + turn->messageLength, turn->replyLength);
+    }
+}
+
+int convo_turns(){
+    return convoNumTurns;
+}
+
+int convo_tokens(){
+    return convoTotalTokens;
+}
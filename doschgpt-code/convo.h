@@ -0,0 +1,50 @@
+// Conversation history kept to give the server context of earlier turns.
+// Messages and replies are stored as JSON-escaped text, ready to be placed in a request body.
+
+#include "memprof.h"
+
+// Bytes of message and reply text held across all turns
+#define CONVO_ARENA_SIZE MEM_CONVO_ARENA_SIZE
+
+// Bytes held when the history is kept in expanded memory
+#define CONVO_EMS_ARENA_SIZE MEM_EMS_CONVO_ARENA_SIZE
+#define CONVO_MAX_TURNS MEM_CONVO_MAX_TURNS
+
+#define CONVO_DEFAULT_TOKEN_BUDGET 1500
+
+// Receives the history piece by piece as it is written out
+typedef void (*ConvoWriteCallback)(const char * data, int length);
+
+// Allocate the history
+// tokenBudget: Approximate tokens of history plus new message allowed in a request
+// useExpandedMemory: Keep the text in expanded memory if it can be allocated, ems_init() must have been called
+bool convo_init(int tokenBudget, bool useExpandedMemory);
+
+// True if the history text is kept in expanded memory
+bool convo_in_expanded_memory();
+
+// Free the history
+void convo_stop();
+
+// Leave the oldest turns out of the next request until the history and the new message fit the
+// token budget. They are dropped by the next convo_add_turn() and kept if the request fails.
+void convo_fit_budget(int newMessageLength);
+
+// Largest length up to maxLength that does not cut a JSON escape sequence in half, also
+// when the text itself already ends in the middle of one
+int convo_escaped_length(char * text, int length, int maxLength);
+
+// Add a completed turn, dropping the turns left out by convo_fit_budget() and the oldest turns if there is no space
+void convo_add_turn(char * message, int messageLength, char * reply, int replyLength);
+
+// Write the history as JSON message objects for ChatGPT and Ollama, each followed by ", "
+void convo_write_chat_messages(ConvoWriteCallback write);
+
+// Write the history as a [INST]message[/INST]reply chain for Hugging Face
+void convo_write_inst_chain(ConvoWriteCallback write);
+
+// Number of turns in the history
+int convo_turns();
+
+// Approximate tokens used by the history
+int convo_tokens();
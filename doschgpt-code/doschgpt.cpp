@@ -4,11 +4,18 @@
 #include <string.h>
 
 #include "network.h"
+#include "convo.h"
+#include "chatlog.h"
+#include "memprof.h"
+#include "ems.h"
+#include "inlines.h"
 #include "utf2cp.h"
 #include "textio.h"
+#include "screen.h"
 #include "sound.h"
+#include "latency.h"
 
-#define VERSION "0.18"
+#define VERSION "0.19"
 
 #define DOS_CHATGPT_WELCOME_MSG "Welcome to DOS ChatGPT client"
 #define DOS_HUGGING_FACE_WELCOME_MSG "Welcome to DOS Hugging Face client"
@@ -28,7 +35,9 @@
 #define CONV_HISTORY_PATH_SIZE 256
 #define CONFIG_PATH_SIZE 256
 
-#define MESSAGE_SIZE 5000
+// Mapping file for -cpXXX
+#define CODE_PAGE_FILENAME_FORMAT "cp%d.txt"
+#define CODE_PAGE_PATH_SIZE 16
 
 enum APIS { CHATGPT, HUGGING_FACE, OLLAMA };
 
@@ -46,10 +55,20 @@ uint16_t config_socketResponseTimeout;
 bool debug_showRequestInfo = false;
 bool debug_showRawReply = false;
 bool debug_showTimeStamp = false;
+bool debug_showLatency = false;
 int codePageInUse = CODE_PAGE_437;
+bool codePageGiven = false;
+char codePagePath[CODE_PAGE_PATH_SIZE];
 bool convHistoryGiven = false;
 char convHistoryPath[CONV_HISTORY_PATH_SIZE];
+bool chatLogGiven = false;
+char chatLogPath[CONV_HISTORY_PATH_SIZE];
 bool sound_blaster_tts = false;
+bool sound_blaster_tts_resident = false;
+bool stream_reply = false;
+bool keep_alive = false;
+bool use_ems = false;
+int convo_token_budget = CONVO_DEFAULT_TOKEN_BUDGET;
 
 bool configPathGiven = false;
 char configPath[CONFIG_PATH_SIZE];
@@ -57,29 +76,82 @@ char configPath[CONFIG_PATH_SIZE];
 enum APIS api_selected = CHATGPT;
 
 // Message Request
-#define SIZE_MSG_TO_SEND 4096
+#define SIZE_MSG_TO_SEND MEM_MESSAGE_TO_SEND_SIZE
 char * messageToSendToNet;
 
-#define SIZE_MESSAGE_IN_BUFFER 1600
+#define SIZE_MESSAGE_IN_BUFFER MEM_MESSAGE_IN_SIZE
 char * messageInBuffer;
+int currentMessagePos = 0;
 
-#define REPLY_DISPLAY_SIZE 5000
+// Request in progress, the next message can be typed meanwhile without being shown
+bool requestInProgress = false;
+COMPLETION_OUTPUT requestOutput;
+
+// Enter was pressed while a request was in progress, send the next message once it is done
+bool sendAfterRequest = false;
+
+// Window of the decoded reply. Once full, a streamed reply that has been printed is dropped
+// and the rest of a complete reply is spilled to a temp file, so replies of any length fit.
+#define REPLY_DISPLAY_SIZE MEM_REPLY_DISPLAY_SIZE
 char * replyDisplayBuffer = NULL;
 int replyDisplayPos = 0;
 
+// Decoding stops to make space once less than this is left in the window
+#define REPLY_DECODE_SPACE_MIN 64
+
+// Spilled reply is read back and printed in pieces of this size
+#define REPLY_SPILL_CHUNK_SIZE 512
+
+#define REPLY_SPILL_FILENAME "DOSCHGPT.TMP"
+#define REPLY_SPILL_PATH_SIZE 128
+
+// With -ems the reply spills to expanded memory first, then to the file once that is full
+#define REPLY_SPILL_EMS_SIZE MEM_EMS_REPLY_SPILL_SIZE
+
+FILE * replySpillFile = NULL;
+char replySpillPath[REPLY_SPILL_PATH_SIZE];
+EMS_BLOCK replySpillEms;
+bool replySpillInEms = false;
+long replySpilledLength = 0;
+
+// Escapes and UTF-8 characters may be split across streamed pieces of the reply
+UTF_DECODER replyDecoder;
+
 volatile bool inProgress = true;
 
+// Set once the first piece of a streamed reply has been printed
+bool replyStreamStarted = false;
+
+// Expanded memory stays allocated after the app ends unless it is freed
+void freeReplySpill(){
+  if(replySpillInEms){
+    ems_free(&replySpillEms);
+    replySpillInEms = false;
+  }
+}
+
 // Called when ending the app
 void endFunction(){
   free(messageToSendToNet);
   free(messageInBuffer);
   free(replyDisplayBuffer);
+
+  if(replySpillFile != NULL){
+    fclose(replySpillFile);
+    remove(replySpillPath);
+  }
+
+  freeReplySpill();
+  latency_end();
   network_stop();
+  convo_stop();
+  chatlog_close();
 
   io_close_history_file();
 
   if(sound_blaster_tts){
-    sbtts_read_str(GOODBYE_SND, strlen(GOODBYE_SND), true);
+    sbtts_stop();
+    sbtts_read_str(GOODBYE_SND, strlen(GOODBYE_SND));
     sbtts_end();
   }
 
@@ -175,10 +247,347 @@ void escapeThisString(char * source, int sourceSize, char * dest, int destMaxSiz
 
 }
 
+// Print the name of the server before its reply
+void printReplyHeader(){
+  switch(api_selected){
+    case CHATGPT:
+      io_str_newline("\nChatGPT:");
+      break;
+    case HUGGING_FACE:
+      io_str_newline("\nHugging Face:");
+      break;
+    case OLLAMA:
+      io_str_newline("\nOllama:");
+      break;
+  }
+}
+
+// Temp file in the TEMP directory if set, otherwise the current directory
+bool openReplySpillFile(){
+  char * tempDir = getenv("TEMP");
+
+  if(tempDir != NULL && strlen(tempDir) + strlen(REPLY_SPILL_FILENAME) + 2 <= REPLY_SPILL_PATH_SIZE){
+    snprintf(replySpillPath, REPLY_SPILL_PATH_SIZE, "%s\\%s", tempDir, REPLY_SPILL_FILENAME);
+  } else {
+    snprintf(replySpillPath, REPLY_SPILL_PATH_SIZE, "%s", REPLY_SPILL_FILENAME);
+  }
+
+  replySpillFile = fopen(replySpillPath, "w+b");
+  return replySpillFile != NULL;
+}
+
+// Bytes of the spilled reply held in expanded memory before the file takes over
+long replySpillEmsSize(){
+  return replySpillInEms ? replySpillEms.size : 0;
+}
+
+// Add text to the end of the spilled reply
+void spillReplyText(char * text, int length){
+
+  if(replySpilledLength < replySpillEmsSize()){
+    int bytesToCopy = replySpillEmsSize() - replySpilledLength < length ? (int) (replySpillEmsSize() - replySpilledLength) : length;
+
+    if(!ems_write(&replySpillEms, replySpilledLength, text, bytesToCopy)){
+      return;
+    }
+
+    replySpilledLength += bytesToCopy;
+    text += bytesToCopy;
+    length -= bytesToCopy;
+  }
+
+  // The file is kept open for the whole session and overwritten by every reply
+  if(length > 0 && (replySpillFile != NULL || openReplySpillFile())){
+    fseek(replySpillFile, replySpilledLength - replySpillEmsSize(), SEEK_SET);
+    replySpilledLength += fwrite(text, sizeof(char), length, replySpillFile);
+  }
+}
+
+// Read up to length bytes of the spilled reply at pos
+// Returns the number of bytes read
+int readSpilledReply(long pos, char * text, int length){
+
+  if(pos < replySpillEmsSize()){
+    int bytesToCopy = replySpillEmsSize() - pos < length ? (int) (replySpillEmsSize() - pos) : length;
+    return ems_read(&replySpillEms, pos, text, bytesToCopy) ? bytesToCopy : 0;
+  }
+
+  fseek(replySpillFile, pos - replySpillEmsSize(), SEEK_SET);
+  return fread(text, sizeof(char), length, replySpillFile);
+}
+
+// Make space in the reply window
+void flushReplyWindow(){
+
+  // A streamed reply has already been printed and queued for speech
+  if(!replyStreamStarted && replyDisplayPos > 0){
+    spillReplyText(replyDisplayBuffer, replyDisplayPos);
+  }
+
+  replyDisplayPos = 0;
+}
+
+// Queue reply text to be spoken, timed as speech
+void queueReplySpeech(char * text, int length){
+  int previousStage = latency_enter(LATENCY_SPEECH);
+  sbtts_queue_str(text, length);
+  latency_enter(previousStage);
+}
+
+// Convert JSON-escaped UTF-8 content to the code page and append it to the reply window.
+// Printed straight away if the reply is streamed.
+void convertReplyForDisplay(char * content, int contentLength){
+
+  int previousStage = latency_enter(LATENCY_DECODE);
+
+  while(contentLength > 0){
+
+    // Keep space for the null terminator
+    int spaceLeft = REPLY_DISPLAY_SIZE - 1 - replyDisplayPos;
+
+    if(spaceLeft < REPLY_DECODE_SPACE_MIN){
+      flushReplyWindow();
+      continue;
+    }
+
+    // A byte of content becomes at most 2 characters, so none is dropped for lack of space
+    int bytesToDecode = contentLength < spaceLeft / 2 ? contentLength : spaceLeft / 2;
+    int startPos = replyDisplayPos;
+
+    latency_enter(LATENCY_DECODE);
+    replyDisplayPos += utf_decode_json(&replyDecoder, content, bytesToDecode, replyDisplayBuffer + replyDisplayPos, spaceLeft);
+    replyDisplayBuffer[replyDisplayPos] = '\0';
+
+    content += bytesToDecode;
+    contentLength -= bytesToDecode;
+
+    if(replyStreamStarted){
+      latency_enter(LATENCY_RENDER);
+      io_stream_str(replyDisplayBuffer + startPos, replyDisplayPos - startPos);
+
+      if(sound_blaster_tts){
+        queueReplySpeech(replyDisplayBuffer + startPos, replyDisplayPos - startPos);
+      }
+    }
+  }
+
+  latency_enter(previousStage);
+}
+
+// Print a complete reply that was not streamed, reading back what was spilled
+void printReplyForDisplay(){
+
+  printReplyHeader();
+
+  if(replySpilledLength == 0){
+    io_str_newline(replyDisplayBuffer);
+
+    if(sound_blaster_tts){
+      queueReplySpeech(replyDisplayBuffer, replyDisplayPos);
+    }
+    return;
+  }
+
+  // Printed like a streamed reply so words are not broken between pieces
+  char chunk[REPLY_SPILL_CHUNK_SIZE];
+  long spillPos = 0;
+
+  io_stream_begin();
+
+  while(spillPos < replySpilledLength){
+    int bytesToRead = replySpilledLength - spillPos < REPLY_SPILL_CHUNK_SIZE ? (int) (replySpilledLength - spillPos) : REPLY_SPILL_CHUNK_SIZE;
+    int bytesRead = readSpilledReply(spillPos, chunk, bytesToRead);
+
+    if(bytesRead <= 0){
+      break;
+    }
+
+    io_stream_str(chunk, bytesRead);
+
+    if(sound_blaster_tts){
+      queueReplySpeech(chunk, bytesRead);
+    }
+
+    spillPos += bytesRead;
+  }
+
+  io_stream_str(replyDisplayBuffer, replyDisplayPos);
+  io_stream_end();
+
+  if(sound_blaster_tts){
+    queueReplySpeech(replyDisplayBuffer, replyDisplayPos);
+  }
+}
+
+// Called by the network for every piece of reply text as it arrives
+void replyContentHandler(char * delta, int length){
+
+  if(stream_reply && !replyStreamStarted){
+    int previousStage = latency_enter(LATENCY_RENDER);
+
+    replyStreamStarted = true;
+    printReplyHeader();
+    io_stream_begin();
+
+    latency_enter(previousStage);
+  }
+
+  convertReplyForDisplay(delta, length);
+}
+
+// Called by the network while waiting for more of the reply
+void networkIdleHandler(){
+  // Speak what has arrived so far, one phrase at a time so packets are still processed in between
+  if(sound_blaster_tts){
+    int previousStage = latency_enter(LATENCY_SPEECH);
+    sbtts_speak_next();
+    latency_enter(previousStage);
+  }
+}
+
+// Print where the time of the last turn went
+void showLatency(){
+  char line[LATENCY_LINE_SIZE];
+
+  latency_format_network(line);
+  io_latency_info(line);
+
+  latency_format_app(line);
+  io_latency_info(line);
+}
+
+// Send the message that has been typed and clear it for the next one
+void startRequest(){
+
+  // Stop speaking the previous reply
+  if(sound_blaster_tts){
+    sbtts_stop();
+  }
+
+  // Writing the request counts from here, before the connection is opened
+  latency_turn_begin(LATENCY_SEND);
+
+  io_write_str_no_print(messageInBuffer, currentMessagePos);
+
+  io_char('\n');
+  if(debug_showTimeStamp){
+    io_timestamp();
+  }
+
+  escapeThisString(messageInBuffer, currentMessagePos, messageToSendToNet, SIZE_MSG_TO_SEND);
+
+  memset(messageInBuffer, 0, SIZE_MESSAGE_IN_BUFFER);
+  currentMessagePos = 0;
+
+  memset((void*) &requestOutput, 0, sizeof(COMPLETION_OUTPUT));
+
+  memset(replyDisplayBuffer, 0, REPLY_DISPLAY_SIZE);
+  replyDisplayPos = 0;
+  replySpilledLength = 0;
+  replyStreamStarted = false;
+  utf_decoder_init(&replyDecoder);
+
+  switch(api_selected){
+    case CHATGPT:
+      network_start_chatgpt_completion(config_proxy_hostname, config_proxy_port, config_apikey, config_model, messageToSendToNet, config_req_temperature, &requestOutput, stream_reply, replyContentHandler);
+      break;
+    case HUGGING_FACE:
+      network_start_huggingface_conversation(config_proxy_hostname, config_proxy_port, config_apikey, config_model, messageToSendToNet, config_req_temperature, &requestOutput, replyContentHandler);
+      break;
+    case OLLAMA:
+      network_start_ollama_conversation(config_proxy_hostname, config_proxy_port, config_model, messageToSendToNet, config_req_temperature, &requestOutput, stream_reply, replyContentHandler);
+      break;
+  }
+
+  requestInProgress = true;
+}
+
+// Show the reply once the request is done and get ready for the next message
+void finishRequest(){
+
+  requestInProgress = false;
+
+  // The reply is taken out of the receive buffer
+  latency_enter(LATENCY_PARSE);
+  network_request_finish();
+  latency_enter(LATENCY_RENDER);
+
+  COMPLETION_OUTPUT * output = &requestOutput;
+
+  // End the streamed reply even if it was cut short
+  if(replyStreamStarted){
+    io_stream_end();
+  }
+
+  if(output->error == COMPLETION_OUTPUT_ERROR_OK){
+
+    // Streamed reply has already been printed
+    if(!replyStreamStarted){
+      printReplyForDisplay();
+    }
+
+    chatlog_add_turn(messageToSendToNet, strlen(messageToSendToNet), output->prompt_tokens, output->content, output->contentLength, output->completion_tokens);
+
+    if(debug_showRequestInfo){
+      io_request_info(output->outPort, output->prompt_tokens, output->completion_tokens);
+    }
+
+  } else if(output->error == COMPLETION_OUTPUT_ERROR_CHATGPT){
+    io_char('\n');
+    io_server_error(output->content, output->contentLength);
+  } else {
+    io_char('\n');
+    io_app_error(output->content, output->contentLength);
+  }
+
+  // The turn is timed until its reply or error has been shown
+  latency_turn_end();
+
+  if(debug_showLatency){
+    showLatency();
+  }
+
+  // Everything to speak has been queued
+  if(sound_blaster_tts){
+    sbtts_queue_end();
+  }
+
+  if(debug_showRawReply){
+    io_str_newline(output->rawData);
+  }
+
+  if(debug_showTimeStamp){
+    io_timestamp();
+  }
+
+  io_str_newline("\nMe:");
+
+  // Write the whole turn to the history file while waiting for the next message
+  io_flush_history();
+
+  // Show what was typed while waiting for the reply
+  if(currentMessagePos > 0){
+    printf("%.*s", currentMessagePos, messageInBuffer);
+    fflush(stdout);
+  }
+
+  // Message may have been erased again after pressing Enter
+  if(sendAfterRequest && currentMessagePos > 0){
+    startRequest();
+  }
+
+  sendAfterRequest = false;
+}
+
 int main(int argc, char * argv[]){
+  // DOS memory before any buffers are allocated, to report what the app really uses
+  uint16_t freeParagraphsAtStart = getFreeDOSMemory();
+
   printf("Started DOS ChatGPT/Hugging Face/Ollama client %s by Yeo Kheng Meng\n", VERSION);
   printf("Compiled on %s %s\n\n", __DATE__, __TIME__);
 
+  screen_init();
+
   // Process command line arguments -dri and -drr
   for(int i = 0; i < argc; i++){
     char * arg = argv[i];
@@ -188,8 +597,23 @@ int main(int argc, char * argv[]){
       debug_showRawReply = true;
     } else if(strstr(arg, "-drt") && strlen(arg) == 4){
       debug_showTimeStamp = true;
-    } else if(strstr(arg, "-cp737") && strlen(arg) == 6){
-      codePageInUse = CODE_PAGE_737;
+    } else if(strstr(arg, "-drl") && strlen(arg) == 4){
+      debug_showLatency = true;
+    } else if(strstr(arg, "-cp") && strlen(arg) == 6 && atoi(arg + 3) > 0){
+      codePageGiven = true;
+      codePageInUse = atoi(arg + 3);
+      snprintf(codePagePath, CODE_PAGE_PATH_SIZE, CODE_PAGE_FILENAME_FORMAT, codePageInUse);
+    } else if(strstr(arg, "-lg") && strlen(arg) > 3){
+      // Checked before -f and -c as the path may contain them
+      chatLogGiven = true;
+
+      if((strlen(arg) - 3) > (CONV_HISTORY_PATH_SIZE - 1)){
+        printf("Conversation Log Path argument exceeded %d characters\n", CONV_HISTORY_PATH_SIZE);
+        return -3;
+      }
+
+      //Copy after -lg
+      memcpy(chatLogPath, arg + 3, strlen(arg) - 3);
     } else if(strstr(arg, "-f") && strlen(arg) != 2){
       convHistoryGiven = true;
 
@@ -215,6 +639,17 @@ int main(int argc, char * argv[]){
       api_selected = OLLAMA;
     } else if(strstr(arg, "-sbtts") && strlen(arg) == 6){
       sound_blaster_tts = true;
+    } else if(strstr(arg, "-sbtsr") && strlen(arg) == 6){
+      sound_blaster_tts = true;
+      sound_blaster_tts_resident = true;
+    } else if(strstr(arg, "-stream") && strlen(arg) == 7){
+      stream_reply = true;
+    } else if(strstr(arg, "-ka") && strlen(arg) == 3){
+      keep_alive = true;
+    } else if(strstr(arg, "-ems") && strlen(arg) == 4){
+      use_ems = true;
+    } else if(strstr(arg, "-tk") && strlen(arg) > 3){
+      convo_token_budget = atoi(arg + 3);
     }
   }
 
@@ -233,8 +668,8 @@ int main(int argc, char * argv[]){
     printf("Proxy hostname,port: %s:%d\n", config_proxy_hostname, config_proxy_port);
     printf("Outgoing start port: %u, end port: %u\n", config_outgoing_start_port, config_outgoing_end_port);
     printf("Socket connect timeout: %u ms, response timeout: %u ms\n", config_socketConnectTimeout, config_socketResponseTimeout);
-    printf("Show request info -dri: %d, raw reply -drr: %d, timestamps -drt: %d\n", debug_showRequestInfo, debug_showRawReply, debug_showTimeStamp);
-    printf("Code page -cpXXX: %d\n", codePageInUse);
+    printf("Show request info -dri: %d, raw reply -drr: %d, timestamps -drt: %d, latency -drl: %d\n", debug_showRequestInfo, debug_showRawReply, debug_showTimeStamp, debug_showLatency);
+    printf("Code page -cpXXX: %d%s\n", codePageInUse, codePageGiven ? "" : " (built-in)");
     printf("Config Path -cX: %s\n", configPathGiven ? configPath : CONFIG_FILENAME_DEFAULT);
 
     if(convHistoryGiven){
@@ -243,9 +678,28 @@ int main(int argc, char * argv[]){
       printf("Conversation history path -fX: Not specified\n");
     }
 
+    if(chatLogGiven){
+      printf("Conversation log path -lgX: %s\n", chatLogPath);
+    } else {
+      printf("Conversation log path -lgX: Not specified\n");
+    }
+
     if(sound_blaster_tts == false){
       printf("Sound Blaster TTS -sbtts: %d\n", sound_blaster_tts);
+    } else if(sound_blaster_tts_resident){
+      printf("Sound Blaster TTS -sbtsr: Load and keep resident\n");
     }
+
+    if(stream_reply && api_selected == HUGGING_FACE){
+      printf("Stream reply -stream: Not supported by Hugging Face\n");
+      stream_reply = false;
+    } else {
+      printf("Stream reply -stream: %d\n", stream_reply);
+    }
+
+    printf("Keep-alive connection -ka: %d\n", keep_alive);
+    printf("Expanded memory -ems: %d\n", use_ems);
+    printf("Conversation history token budget -tkX: %d\n", convo_token_budget);
         
 
   } else {
@@ -253,7 +707,21 @@ int main(int argc, char * argv[]){
     return -2;
   }
 
-  bool status = network_init(config_outgoing_start_port, config_outgoing_end_port, networkBreakHandler, config_socketConnectTimeout, config_socketResponseTimeout);
+  // A mapping file is used if there is one, CP437 and CP737 also work without it
+  if(codePageGiven){
+    if(utf_load_codepage_file(codePagePath)){
+      // Loaded
+    } else if(utf_load_builtin_codepage(codePageInUse)){
+      printf("No %s code page mapping file, using the built-in table\n", codePagePath);
+    } else {
+      printf("Cannot open %s code page mapping file. Copy it from the codepage directory to the current directory.\n", codePagePath);
+      return -2;
+    }
+  } else {
+    utf_load_builtin_codepage(CODE_PAGE_437);
+  }
+
+  bool status = network_init(config_outgoing_start_port, config_outgoing_end_port, networkBreakHandler, networkIdleHandler, config_socketConnectTimeout, config_socketResponseTimeout, keep_alive);
 
   if (status) {
     //printf("Network ok\n");
@@ -262,6 +730,35 @@ int main(int argc, char * argv[]){
     return -1;
   }
 
+  if(use_ems){
+    if(ems_init()){
+      printf("Expanded memory: %luKB free\n", ((uint32_t) ems_free_pages()) * EMS_PAGE_SIZE / 1024);
+      replySpillInEms = ems_alloc(&replySpillEms, REPLY_SPILL_EMS_SIZE);
+    } else {
+      printf("Expanded memory: No EMS 4.0 driver, using conventional memory\n");
+      use_ems = false;
+    }
+  }
+
+  if(!convo_init(convo_token_budget, use_ems)){
+    printf("Cannot allocate memory for conversation history\n");
+    freeReplySpill();
+    network_stop();
+    return -1;
+  }
+
+  if(chatLogGiven){
+    if(!chatlog_open(chatLogPath)){
+      printf("Cannot open conversation log\n");
+      endFunction();
+      return -2;
+    }
+
+    // Continue the conversation where the last session left off
+    int turnsLoaded = chatlog_load_recent(CONVO_MAX_TURNS, convo_add_turn);
+    printf("Loaded %d turns from conversation log\n", turnsLoaded);
+  }
+
   if(convHistoryGiven && !io_open_history_file(convHistoryPath)){
     printf("Cannot open history file to append\n");
     endFunction();
@@ -271,6 +768,8 @@ int main(int argc, char * argv[]){
   messageToSendToNet = (char *) calloc (SIZE_MSG_TO_SEND, sizeof(char));
   if(messageToSendToNet == NULL){
     printf("Cannot allocate memory for messageToSendToNet\n");
+    convo_stop();
+    freeReplySpill();
     network_stop();
     return -1;
   }
@@ -279,6 +778,8 @@ int main(int argc, char * argv[]){
   if(messageInBuffer == NULL){
     printf("Cannot allocate memory for messageInBuffer\n");
     free(messageToSendToNet);
+    convo_stop();
+    freeReplySpill();
     network_stop();
     return -1;
   }
@@ -289,15 +790,28 @@ int main(int argc, char * argv[]){
     printf("Cannot allocate memory for message Display\n");
     free(messageToSendToNet);
     free(messageInBuffer);
+    convo_stop();
+    freeReplySpill();
     network_stop();
     return -1;
   }
 
+  uint16_t freeParagraphs = getFreeDOSMemory();
+  printf("Memory profile %s: %luKB used by buffers and network, %luKB more for connections, %luKB DOS memory free\n", MEMORY_PROFILE_NAME, ((uint32_t) (freeParagraphsAtStart - freeParagraphs)) * 16 / 1024, network_connection_memory() / 1024, ((uint32_t) freeParagraphs) * 16 / 1024);
+
+  if(use_ems){
+    printf("Expanded memory used for conversation history: %s, long replies: %s\n", convo_in_expanded_memory() ? "Yes" : "No", replySpillInEms ? "Yes" : "No");
+  }
+
   if(sound_blaster_tts){
-    bool sbtts_init_status = sbtts_init();
+    bool sbtts_init_status = sbtts_init(sound_blaster_tts_resident);
 
     if(sbtts_init_status == false){
-      printf("Error: First Byte Text-to-Speech Engine is not installed.\n");
+      if(sound_blaster_tts_resident){
+        printf("Error: Cannot load First Byte Text-to-Speech Engine with SBTALKER /dBLASTER\n");
+      } else {
+        printf("Error: First Byte Text-to-Speech Engine is not resident. Load it first with SBTALKER /dBLASTER or use -sbtsr\n");
+      }
       
       endFunction();
       return -3;
@@ -308,13 +822,13 @@ int main(int argc, char * argv[]){
 
     switch(api_selected){
       case CHATGPT:
-        sbtts_read_str(DOS_CHATGPT_WELCOME_SND, strlen(DOS_CHATGPT_WELCOME_SND), false);
+        sbtts_read_str(DOS_CHATGPT_WELCOME_SND, strlen(DOS_CHATGPT_WELCOME_SND));
         break;
       case HUGGING_FACE:
-        sbtts_read_str(DOS_HUGGING_FACE_WELCOME_SND, strlen(DOS_HUGGING_FACE_WELCOME_SND), false);
+        sbtts_read_str(DOS_HUGGING_FACE_WELCOME_SND, strlen(DOS_HUGGING_FACE_WELCOME_SND));
         break;
       case OLLAMA:
-        sbtts_read_str(DOS_OLLAMA_WELCOME_SND, strlen(DOS_OLLAMA_WELCOME_SND), false);
+        sbtts_read_str(DOS_OLLAMA_WELCOME_SND, strlen(DOS_OLLAMA_WELCOME_SND));
         break;
     }
   }
@@ -332,9 +846,11 @@ int main(int argc, char * argv[]){
   }
 
 
-  io_str_newline("Me:");
+  if(debug_showLatency){
+    latency_init();
+  }
 
-  int currentMessagePos = 0;
+  io_str_newline("Me:");
 
   while(inProgress){
 
@@ -342,8 +858,23 @@ int main(int argc, char * argv[]){
     if ( _bios_keybrd(_KEYBRD_READY) ) {
       char character = _bios_keybrd(_KEYBRD_READ);
 
-      // Detect ESC key for quit
+      // Detect ESC key for quit. The first ESC only cancels the request in progress or stops the speech.
       if(character == 27){
+        if(requestInProgress){
+          network_request_cancel();
+          sendAfterRequest = false;
+
+          if(sound_blaster_tts){
+            sbtts_stop();
+          }
+          continue;
+        }
+
+        if(sound_blaster_tts && sbtts_pending()){
+          sbtts_stop();
+          continue;
+        }
+
         inProgress = false;
         break;
       }
@@ -356,140 +887,61 @@ int main(int argc, char * argv[]){
           continue;
         }
 
-        io_write_str_no_print(messageInBuffer, currentMessagePos);
-
-        io_char('\n');
-        if(debug_showTimeStamp){
-          io_timestamp();
-        }
-
-        escapeThisString(messageInBuffer, currentMessagePos, messageToSendToNet, SIZE_MSG_TO_SEND);
-
-        COMPLETION_OUTPUT output;
-        memset((void*) &output, 0, sizeof(COMPLETION_OUTPUT));
-
-        switch(api_selected){
-          case CHATGPT:
-            network_get_chatgpt_completion(config_proxy_hostname, config_proxy_port, config_apikey, config_model, messageToSendToNet, config_req_temperature, &output);
-            break;
-          case HUGGING_FACE:
-            network_get_huggingface_conversation(config_proxy_hostname, config_proxy_port, config_apikey, config_model, messageToSendToNet, config_req_temperature, &output);
-            break;
-          case OLLAMA:
-            network_get_ollama_conversation(config_proxy_hostname, config_proxy_port, config_model, messageToSendToNet, config_req_temperature, &output);
-            break;
-        }
-
-        if(output.error == COMPLETION_OUTPUT_ERROR_OK){
-
-          switch(api_selected){
-            case CHATGPT:
-              io_str_newline("\nChatGPT:");
-              break;
-            case HUGGING_FACE:
-              io_str_newline("\nHugging Face:");
-              break;
-            case OLLAMA:
-              io_str_newline("\nOllama:");
-              break;
-          }
-
-          memset(replyDisplayBuffer, 0, REPLY_DISPLAY_SIZE);
-          replyDisplayPos = 0;
-
-          //To scan for the special format to convert to formatted text
-          for(int i = 0; i < output.contentLength; i++){
-            char currentChar = output.content[i];
-            char nextChar = output.content[i + 1];
-            char followingChar = output.content[i + 2];
-            
-            //Given \n print the newline then advance 2 steps
-            if(currentChar == '\\' && nextChar == 'n'){
-              replyDisplayBuffer[replyDisplayPos++] = '\n';
-              i++;
-            // Given " print the " then advance 2 steps
-            } else if(currentChar == '\\' && nextChar == '\"'){
-              replyDisplayBuffer[replyDisplayPos++] = '\"';
-              i++;
-            // Given \ print the \ then advance 2 steps
-            } else if(currentChar == '\\' && nextChar == '\\'){
-              replyDisplayBuffer[replyDisplayPos++] = '\\';
-              i++;
-            } else {
-
-              CONVERSION_OUTPUT conversionResult;
-              conversionResult = utf_to_cp(codePageInUse, currentChar, nextChar, followingChar);
-
-              unsigned char characterToPrint = conversionResult.character;
-              int numCharactersToAdvance = conversionResult.charactersUsed - 1;
-
-              replyDisplayBuffer[replyDisplayPos++] = characterToPrint;
-              i += numCharactersToAdvance;
-
-            }
-          }
-
-          io_str_newline(replyDisplayBuffer);
-
-          if(debug_showRequestInfo){
-            io_request_info(output.outPort, output.prompt_tokens, output.completion_tokens);
-          }
-
-          if(sound_blaster_tts){
-            sbtts_read_str(replyDisplayBuffer, replyDisplayPos, true);
-          }
-
-        } else if(output.error == COMPLETION_OUTPUT_ERROR_CHATGPT){
-          io_char('\n');
-          io_server_error(output.content, output.contentLength);
-        } else {
-          io_char('\n');
-          io_app_error(output.content, output.contentLength);
-        }
-
-        if(debug_showRawReply){
-          io_str_newline(output.rawData);
-        }
-
-        if(debug_showTimeStamp){
-          io_timestamp();
+        if(requestInProgress){
+          sendAfterRequest = true;
+          continue;
         }
 
-        io_str_newline("\nMe:");
-
-        memset(messageInBuffer, 0, SIZE_MESSAGE_IN_BUFFER);
-        currentMessagePos = 0;
+        startRequest();
       } else if((character >= ' ') && (character <= '~')){
 
         if(currentMessagePos >= SIZE_MESSAGE_IN_BUFFER){
-          printf("Reach buffer max\n");
+          if(!requestInProgress){
+            printf("Reach buffer max\n");
+          }
           continue;
         }
 
         messageInBuffer[currentMessagePos] = character;
         currentMessagePos++;
-        printf("%c", character);
-        fflush(stdout);
+
+        // Typed ahead characters are shown after the reply
+        if(!requestInProgress){
+          printf("%c", character);
+          fflush(stdout);
+        }
 
       //Backspace character
       } else if(character == 8){
 
         if(currentMessagePos > 0){
-          // Remove previous character
-          printf("%s", "\b \b");
           currentMessagePos--;
           messageInBuffer[currentMessagePos] = '\0';
 
-          fflush(stdout);
+          if(!requestInProgress){
+            // Remove previous character
+            printf("%s", "\b \b");
+            fflush(stdout);
+          }
         }
 
 
       }
 
+    } else if(sound_blaster_tts && !requestInProgress){
+      // Speak the reply a phrase at a time so typing ahead is not held up for long
+      sbtts_speak_next();
     }
 
-    // Call this frequently in the "background" to keep network moving
-    network_drivePackets();
+    if(requestInProgress){
+      // Checked for keys again after every step so typing stays responsive
+      if(!network_request_poll()){
+        finishRequest();
+      }
+    } else {
+      // Call this frequently in the "background" to keep network moving
+      network_drivePackets();
+    }
   }
 
   
@@ -0,0 +1,242 @@
+#include <string.h>
+#include <dos.h>
+
+#include "types.h"
+#include "ems.h"
+
+#define EMS_INTERRUPT 0x67
+
+// The driver's name is found at this offset in the segment of its interrupt handler
+#define EMS_DEVICE_NAME "EMMXXXX0"
+#define EMS_DEVICE_NAME_OFFSET 0x0A
+#define EMS_DEVICE_NAME_LENGTH 8
+
+#define EMS_FUNCTION_STATUS 0x40
+#define EMS_FUNCTION_UNALLOCATED_PAGES 0x42
+#define EMS_FUNCTION_ALLOCATE 0x43
+#define EMS_FUNCTION_DEALLOCATE 0x45
+#define EMS_FUNCTION_VERSION 0x46
+#define EMS_FUNCTION_MOVE 0x57
+
+// Move memory region needs version 4.0
+#define EMS_VERSION_MOVE 0x40
+
+#define EMS_STATUS_OK 0x00
+#define EMS_STATUS_MOVE_OVERLAP 0x92
+
+#define EMS_MEMORY_CONVENTIONAL 0
+#define EMS_MEMORY_EXPANDED 1
+
+#pragma pack(push, 1)
+
+// Source or destination of the move memory region function
+typedef struct
+{
+    // One of the EMS_MEMORY_X
+    uint8_t type;
+
+    // 0 for conventional memory
+    uint16_t handle;
+
+    uint16_t offset;
+
+    // Segment for conventional memory, logical page for expanded memory
+    uint16_t segmentOrPage;
+
+} EMS_MOVE_REGION;
+
+typedef struct
+{
+    uint32_t length;
+    EMS_MOVE_REGION source;
+    EMS_MOVE_REGION dest;
+
+} EMS_MOVE;
+
+#pragma pack(pop)
+
+bool emsPresent = false;
+
+// Call a function of the driver, returns its status in AH
+uint8_t ems_call(union REGS * regs){
+
+    int86(EMS_INTERRUPT, regs, regs);
+    return regs->h.ah;
+}
+
+bool ems_init(){
+
+    emsPresent = false;
+
+    // Interrupt 67h is only valid if the driver is loaded
+    uint8_t far * handler = (uint8_t far *) _dos_getvect(EMS_INTERRUPT);
+
+    if(handler == NULL){
+        return false;
+    }
+
+    char far * deviceName = (char far *) MK_FP(FP_SEG(handler), EMS_DEVICE_NAME_OFFSET);
+
+    if(_fmemcmp(deviceName, EMS_DEVICE_NAME, EMS_DEVICE_NAME_LENGTH) != 0){
+        return false;
+    }
+
+    union REGS regs;
+
+    regs.h.ah = EMS_FUNCTION_STATUS;
+    if(ems_call(&regs) != EMS_STATUS_OK){
+        return false;
+    }
+
+    // Version is in BCD, 0x40 is 4.0
+    regs.h.ah = EMS_FUNCTION_VERSION;
+    if(ems_call(&regs) != EMS_STATUS_OK || regs.h.al < EMS_VERSION_MOVE){
+        return false;
+    }
+
+    emsPresent = true;
+    return true;
+}
+
+uint16_t ems_free_pages(){
+
+    if(!emsPresent){
+        return 0;
+    }
+
+    union REGS regs;
+
+    regs.h.ah = EMS_FUNCTION_UNALLOCATED_PAGES;
+    if(ems_call(&regs) != EMS_STATUS_OK){
+        return 0;
+    }
+
+    return regs.x.bx;
+}
+
+bool ems_alloc(EMS_BLOCK * block, long size){
+
+    block->pages = 0;
+    block->size = 0;
+
+    if(!emsPresent || size <= 0){
+        return false;
+    }
+
+    union REGS regs;
+
+    regs.h.ah = EMS_FUNCTION_ALLOCATE;
+    regs.x.bx = (uint16_t) ((size + EMS_PAGE_SIZE - 1) / EMS_PAGE_SIZE);
+
+    if(ems_call(&regs) != EMS_STATUS_OK){
+        return false;
+    }
+
+    block->handle = regs.x.dx;
+    block->pages = (uint16_t) ((size + EMS_PAGE_SIZE - 1) / EMS_PAGE_SIZE);
+    block->size = block->pages * EMS_PAGE_SIZE;
+    return true;
+}
+
+void ems_free(EMS_BLOCK * block){
+
+    if(block->pages == 0){
+        return;
+    }
+
+    union REGS regs;
+
+    regs.h.ah = EMS_FUNCTION_DEALLOCATE;
+    regs.x.dx = block->handle;
+    ems_call(&regs);
+
+    block->pages = 0;
+    block->size = 0;
+}
+
+// Fill in a region of the move for an offset in the block
+void ems_region_expanded(EMS_MOVE_REGION * region, EMS_BLOCK * block, long offset){
+    region->type = EMS_MEMORY_EXPANDED;
+    region->handle = block->handle;
+    region->offset = (uint16_t) (offset % EMS_PAGE_SIZE);
+    region->segmentOrPage = (uint16_t) (offset / EMS_PAGE_SIZE);
+}
+
+// Fill in a region of the move for a far pointer in conventional memory
+void ems_region_conventional(EMS_MOVE_REGION * region, const void far * data){
+    region->type = EMS_MEMORY_CONVENTIONAL;
+    region->handle = 0;
+    region->offset = FP_OFF(data);
+    region->segmentOrPage = FP_SEG(data);
+}
+
+bool ems_do_move(EMS_MOVE * move){
+
+    union REGS regs;
+    struct SREGS sregs;
+
+    segread(&sregs);
+
+    regs.h.ah = EMS_FUNCTION_MOVE;
+    regs.h.al = 0;
+    sregs.ds = FP_SEG(move);
+    regs.x.si = FP_OFF(move);
+
+    int86x(EMS_INTERRUPT, &regs, &regs, &sregs);
+
+    return regs.h.ah == EMS_STATUS_OK || regs.h.ah == EMS_STATUS_MOVE_OVERLAP;
+}
+
+bool ems_write(EMS_BLOCK * block, long offset, const void * data, uint16_t length){
+
+    if(offset < 0 || offset + length > block->size){
+        return false;
+    }
+
+    if(length == 0){
+        return true;
+    }
+
+    EMS_MOVE move;
+    move.length = length;
+    ems_region_conventional(&move.source, data);
+    ems_region_expanded(&move.dest, block, offset);
+
+    return ems_do_move(&move);
+}
+
+bool ems_read(EMS_BLOCK * block, long offset, void * data, uint16_t length){
+
+    if(offset < 0 || offset + length > block->size){
+        return false;
+    }
+
+    if(length == 0){
+        return true;
+    }
+
+    EMS_MOVE move;
+    move.length = length;
+    ems_region_expanded(&move.source, block, offset);
+    ems_region_conventional(&move.dest, data);
+
+    return ems_do_move(&move);
+}
+
+bool ems_move(EMS_BLOCK * block, long destOffset, long sourceOffset, long length){
+
+    if(destOffset < 0 || sourceOffset < 0 || destOffset + length > block->size || sourceOffset + length > block->size){
+        return false;
+    }
+
+    if(length <= 0){
+        return true;
+    }
+
+    EMS_MOVE move;
+    move.length = length;
+    ems_region_expanded(&move.source, block, sourceOffset);
+    ems_region_expanded(&move.dest, block, destOffset);
+
+    return ems_do_move(&move);
+}
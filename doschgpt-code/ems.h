@@ -0,0 +1,41 @@
+// Expanded memory (EMS 4.0) used as a backing store for data that does not need to be in
+// conventional memory all the time. Blocks are copied to and from conventional memory with
+// the EMS move function, so no page frame mapping is left in place between calls.
+
+#include "types.h"
+
+// Size of an EMS page
+#define EMS_PAGE_SIZE 16384L
+
+// Expanded memory allocated with ems_alloc()
+typedef struct
+{
+    uint16_t handle;
+    uint16_t pages;
+
+    // Bytes that can be stored
+    long size;
+
+} EMS_BLOCK;
+
+// Check for an EMS 4.0 driver. Call once before any other function.
+// Returns false if expanded memory cannot be used
+bool ems_init();
+
+// Free pages of expanded memory, 0 if there is no driver
+uint16_t ems_free_pages();
+
+// Allocate at least size bytes of expanded memory
+bool ems_alloc(EMS_BLOCK * block, long size);
+
+// Give the block back to the driver. Must be called before the app ends as DOS does not do it.
+void ems_free(EMS_BLOCK * block);
+
+// Copy length bytes from conventional memory to offset in the block
+bool ems_write(EMS_BLOCK * block, long offset, const void * data, uint16_t length);
+
+// Copy length bytes from offset in the block to conventional memory
+bool ems_read(EMS_BLOCK * block, long offset, void * data, uint16_t length);
+
+// Copy length bytes within the block, the areas may overlap
+bool ems_move(EMS_BLOCK * block, long destOffset, long sourceOffset, long length);
@@ -0,0 +1,291 @@
+#include "http.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define HTTP_VERSION_PREFIX "HTTP/"
+#define HTTP_VERSION_PREFIX_LENGTH 5
+
+// Largest chunk size line we accept, including extensions
+#define HTTP_CHUNK_LINE_MAX 64
+
+void http_response_init(HTTP_RESPONSE * response){
+    response->state = HTTP_STATE_HEADERS;
+    response->statusCode = 0;
+    response->contentLength = -1;
+    response->connectionClose = false;
+    response->headerLength = 0;
+    response->bodyLength = 0;
+    response->bodyReceived = 0;
+    response->rawPos = 0;
+    response->chunkRemaining = 0;
+}
+
+char * http_response_body(HTTP_RESPONSE * response, char * buffer){
+    return buffer + response->headerLength;
+}
+
+// Case-insensitive check if the header line starts with name
+bool http_header_is(char * line, int lineLength, const char * name){
+    int nameLength = strlen(name);
+
+    if(lineLength < nameLength){
+        return false;
+    }
+
+    for(int i = 0; i < nameLength; i++){
+        if(tolower(line[i]) != tolower(name[i])){
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Case-insensitive search for a token in the header value
+bool http_header_value_has(char * value, int valueLength, const char * token){
+    int tokenLength = strlen(token);
+
+    for(int i = 0; i + tokenLength <= valueLength; i++){
+        if(http_header_is(value + i, valueLength - i, token)){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Parse the status line and headers once the empty line ending them has arrived
+void http_parse_headers(HTTP_RESPONSE * response, char * buffer, int headerLength){
+
+    // Status line is like "HTTP/1.1 200 OK"
+    char * statusPtr = (char *) memchr(buffer, ' ', headerLength);
+    if(statusPtr != NULL){
+        response->statusCode = atoi(statusPtr + 1);
+    }
+
+    char * linePtr = (char *) memchr(buffer, '\n', headerLength) + 1;
+    char * headerEnd = buffer + headerLength;
+
+    while(linePtr < headerEnd){
+        char * lineEnd = (char *) memchr(linePtr, '\n', headerEnd - linePtr);
+        if(lineEnd == NULL){
+            break;
+        }
+
+        int lineLength = lineEnd - linePtr;
+
+        if(http_header_is(linePtr, lineLength, "Content-Length:")){
+            response->contentLength = strtol(linePtr + 15, NULL, 10);
+        } else if(http_header_is(linePtr, lineLength, "Transfer-Encoding:")){
+            if(http_header_value_has(linePtr + 18, lineLength - 18, "chunked")){
+                response->state = HTTP_STATE_CHUNK_SIZE;
+            }
+        } else if(http_header_is(linePtr, lineLength, "Connection:")){
+            response->connectionClose = http_header_value_has(linePtr + 11, lineLength - 11, "close");
+        }
+
+        linePtr = lineEnd + 1;
+    }
+
+    // Chunked encoding takes precedence over Content-Length
+    if(response->state == HTTP_STATE_CHUNK_SIZE){
+        return;
+    }
+
+    // These replies never have a body
+    if(response->statusCode == 204 || response->statusCode == 304 || (response->statusCode >= 100 && response->statusCode < 200)){
+        response->state = HTTP_STATE_COMPLETE;
+    } else if(response->contentLength >= 0){
+        response->state = response->contentLength == 0 ? HTTP_STATE_COMPLETE : HTTP_STATE_BODY_LENGTH;
+    } else {
+        response->state = HTTP_STATE_BODY_UNTIL_CLOSE;
+    }
+}
+
+// Look for the end of the headers. Returns false if more bytes are needed.
+bool http_find_headers(HTTP_RESPONSE * response, char * buffer, int bytesInBuffer){
+
+    if(bytesInBuffer < HTTP_VERSION_PREFIX_LENGTH){
+        return false;
+    }
+
+    // Some servers like the mock proxy reply without headers. Treat everything as the body.
+    if(strncmp(buffer, HTTP_VERSION_PREFIX, HTTP_VERSION_PREFIX_LENGTH) != 0){
+        response->headerLength = 0;
+        response->rawPos = 0;
+        response->state = HTTP_STATE_BODY_UNTIL_CLOSE;
+        return true;
+    }
+
+    // Headers end with an empty line
+    for(int i = 0; i + 1 < bytesInBuffer; i++){
+        if(buffer[i] == '\n' && (buffer[i + 1] == '\n' || (buffer[i + 1] == '\r' && i + 2 < bytesInBuffer && buffer[i + 2] == '\n'))){
+            int headerLength = i + (buffer[i + 1] == '\n' ? 2 : 3);
+
+            response->headerLength = headerLength;
+            response->rawPos = headerLength;
+            http_parse_headers(response, buffer, headerLength);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Read the hex size at the start of a chunk. Returns false if the line is incomplete.
+bool http_read_chunk_size(HTTP_RESPONSE * response, char * raw, int rawLength, int * bytesUsed){
+
+    char * lineEnd = (char *) memchr(raw, '\n', rawLength);
+
+    if(lineEnd == NULL){
+        if(rawLength > HTTP_CHUNK_LINE_MAX){
+            response->state = HTTP_STATE_ERROR;
+        }
+        return false;
+    }
+
+    if(!isxdigit(raw[0])){
+        response->state = HTTP_STATE_ERROR;
+        return false;
+    }
+
+    // Any chunk extension after ; is ignored by strtol
+    response->chunkRemaining = strtol(raw, NULL, 16);
+    *bytesUsed = lineEnd - raw + 1;
+
+    response->state = response->chunkRemaining == 0 ? HTTP_STATE_CHUNK_TRAILER : HTTP_STATE_CHUNK_DATA;
+    return true;
+}
+
+bool http_response_feed(HTTP_RESPONSE * response, char * buffer, int * bytesInBuffer){
+
+    if(response->state == HTTP_STATE_HEADERS){
+        if(!http_find_headers(response, buffer, *bytesInBuffer)){
+            return false;
+        }
+    }
+
+    // Body is decoded to writePos while rawPos moves ahead over the chunk framing
+    int writePos = response->headerLength + response->bodyLength;
+    int rawPos = response->rawPos;
+    int end = *bytesInBuffer;
+
+    bool needMore = false;
+
+    while(rawPos < end && !needMore){
+
+        int rawLength = end - rawPos;
+        int bytesUsed = 0;
+
+        switch(response->state){
+            case HTTP_STATE_BODY_LENGTH:
+            case HTTP_STATE_BODY_UNTIL_CLOSE: {
+                int bytesToCopy = rawLength;
+
+                // Ignore anything the server sends past the Content-Length
+                if(response->state == HTTP_STATE_BODY_LENGTH && (response->contentLength - response->bodyReceived) < bytesToCopy){
+                    bytesToCopy = (int) (response->contentLength - response->bodyReceived);
+                }
+
+                memmove(buffer + writePos, buffer + rawPos, bytesToCopy);
+                writePos += bytesToCopy;
+                rawPos += bytesToCopy;
+                response->bodyReceived += bytesToCopy;
+
+                if(response->state == HTTP_STATE_BODY_LENGTH && response->bodyReceived >= response->contentLength){
+                    response->state = HTTP_STATE_COMPLETE;
+                }
+                break;
+            }
+
+            case HTTP_STATE_CHUNK_SIZE:
+                if(http_read_chunk_size(response, buffer + rawPos, rawLength, &bytesUsed)){
+                    rawPos += bytesUsed;
+                } else {
+                    needMore = true;
+                }
+                break;
+
+            case HTTP_STATE_CHUNK_DATA: {
+                int bytesToCopy = response->chunkRemaining < rawLength ? (int) response->chunkRemaining : rawLength;
+
+                memmove(buffer + writePos, buffer + rawPos, bytesToCopy);
+                writePos += bytesToCopy;
+                rawPos += bytesToCopy;
+                response->bodyReceived += bytesToCopy;
+                response->chunkRemaining -= bytesToCopy;
+
+                if(response->chunkRemaining == 0){
+                    response->state = HTTP_STATE_CHUNK_DATA_END;
+                }
+                break;
+            }
+
+            case HTTP_STATE_CHUNK_DATA_END:
+                // Skip the CRLF after the chunk data
+                if(buffer[rawPos] == '\r'){
+                    rawPos++;
+                } else if(buffer[rawPos] == '\n'){
+                    rawPos++;
+                    response->state = HTTP_STATE_CHUNK_SIZE;
+                } else {
+                    response->state = HTTP_STATE_ERROR;
+                }
+                break;
+
+            case HTTP_STATE_CHUNK_TRAILER: {
+                // Skip trailer headers until the empty line
+                char * lineEnd = (char *) memchr(buffer + rawPos, '\n', rawLength);
+
+                if(lineEnd == NULL){
+                    needMore = true;
+                    break;
+                }
+
+                int lineLength = lineEnd - (buffer + rawPos);
+                bool emptyLine = lineLength == 0 || (lineLength == 1 && buffer[rawPos] == '\r');
+
+                rawPos += lineLength + 1;
+
+                if(emptyLine){
+                    response->state = HTTP_STATE_COMPLETE;
+                }
+                break;
+            }
+
+            default:
+                // Complete or error, anything else is ignored
+                rawPos = end;
+                break;
+        }
+    }
+
+    // Move the undecoded bytes to follow the body
+    int rawRemaining = end - rawPos;
+    if(rawRemaining > 0 && rawPos != writePos){
+        memmove(buffer + writePos, buffer + rawPos, rawRemaining);
+    }
+
+    response->bodyLength = writePos - response->headerLength;
+    response->rawPos = writePos;
+    *bytesInBuffer = writePos + rawRemaining;
+
+    // Clear out what was left behind by the framing that has been removed
+    if(end > *bytesInBuffer){
+        memset(buffer + *bytesInBuffer, 0, end - *bytesInBuffer);
+    }
+
+    return response->state == HTTP_STATE_COMPLETE || response->state == HTTP_STATE_ERROR;
+}
+
+bool http_response_remote_closed(HTTP_RESPONSE * response){
+
+    // Only these replies are allowed to end by closing the connection
+    if(response->state == HTTP_STATE_BODY_UNTIL_CLOSE){
+        response->state = HTTP_STATE_COMPLETE;
+    }
+
+    return response->state == HTTP_STATE_COMPLETE;
+}
@@ -0,0 +1,58 @@
+#define HTTP_STATE_HEADERS 0
+#define HTTP_STATE_BODY_LENGTH 1
+#define HTTP_STATE_BODY_UNTIL_CLOSE 2
+#define HTTP_STATE_CHUNK_SIZE 3
+#define HTTP_STATE_CHUNK_DATA 4
+#define HTTP_STATE_CHUNK_DATA_END 5
+#define HTTP_STATE_CHUNK_TRAILER 6
+#define HTTP_STATE_COMPLETE 7
+#define HTTP_STATE_ERROR 8
+
+// Framing state of a HTTP response being received into a buffer.
+// The buffer is laid out as [headers][decoded body][bytes not yet decoded].
+// Chunked bodies are decoded in place so the body is always contiguous after the headers.
+typedef struct
+{
+    // One of the HTTP_STATE_X
+    int state;
+
+    // Status code from the status line. 0 if server did not send a HTTP header.
+    int statusCode;
+
+    // Content-Length header value, -1 if not given
+    long contentLength;
+
+    // Server indicated it will close the connection after this response
+    bool connectionClose;
+
+    // Size of the status line and headers including the empty line
+    int headerLength;
+
+    // Decoded body bytes currently in the buffer after the headers
+    int bodyLength;
+
+    // Total decoded body bytes, including those consumed and removed by the caller
+    long bodyReceived;
+
+    // Offset in buffer of the first byte not yet decoded
+    int rawPos;
+
+    // Bytes left in the current chunk
+    long chunkRemaining;
+
+} HTTP_RESPONSE;
+
+// Reset the state before receiving a new response
+void http_response_init(HTTP_RESPONSE * response);
+
+// Process newly received bytes at the end of buffer.
+// bytesInBuffer: Bytes in buffer, updated as chunk framing is stripped out
+// Returns true once the complete response has been received
+bool http_response_feed(HTTP_RESPONSE * response, char * buffer, int * bytesInBuffer);
+
+// Call when the server has closed the connection.
+// Returns true if the response is complete, as for responses without length that end on close.
+bool http_response_remote_closed(HTTP_RESPONSE * response);
+
+// Pointer to the start of the decoded body in buffer
+char * http_response_body(HTTP_RESPONSE * response, char * buffer);
@@ -0,0 +1,245 @@
+#include "json.h"
+
+#include <string.h>
+
+// Placed in the path when a key does not fit so it can never match a wanted path
+#define JSON_UNMATCHABLE_KEY '#'
+
+void json_init(JSON_SCANNER * scanner, const char ** paths, int numPaths, JsonValueCallback callback){
+    scanner->state = JSON_STATE_VALUE;
+    scanner->paths = paths;
+    scanner->numPaths = numPaths;
+    scanner->callback = callback;
+    scanner->depth = 0;
+    scanner->path[0] = '\0';
+    scanner->pathLength = 0;
+    scanner->keyLength = 0;
+    scanner->stringIsKey = false;
+    scanner->escaped = false;
+    scanner->literalLength = 0;
+    scanner->field = -1;
+    scanner->documents = 0;
+}
+
+// Index of the wanted path equal to the current path, -1 if none
+int json_match_path(JSON_SCANNER * scanner){
+    for(int i = 0; i < scanner->numPaths; i++){
+        if(scanner->paths[i] != NULL && strcmp(scanner->paths[i], scanner->path) == 0){
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Go back to the path of the innermost container
+void json_restore_path(JSON_SCANNER * scanner){
+    scanner->pathLength = scanner->depth > 0 ? scanner->pathLengths[scanner->depth - 1] : 0;
+    scanner->path[scanner->pathLength] = '\0';
+}
+
+// Append the key that was just parsed to the path of its object
+void json_append_key(JSON_SCANNER * scanner){
+    json_restore_path(scanner);
+
+    int pathLength = scanner->pathLength;
+    int separatorLength = pathLength > 0 ? 1 : 0;
+
+    if(scanner->keyLength >= JSON_KEY_SIZE || pathLength + separatorLength + scanner->keyLength >= JSON_PATH_SIZE){
+        if(pathLength + 2 < JSON_PATH_SIZE){
+            scanner->path[pathLength++] = JSON_UNMATCHABLE_KEY;
+        }
+    } else {
+        if(separatorLength){
+            scanner->path[pathLength++] = '.';
+        }
+        memcpy(scanner->path + pathLength, scanner->key, scanner->keyLength);
+        pathLength += scanner->keyLength;
+    }
+
+    scanner->path[pathLength] = '\0';
+    scanner->pathLength = pathLength;
+}
+
+// Open a new object or array
+bool json_push(JSON_SCANNER * scanner, char container){
+    if(scanner->depth >= JSON_MAX_DEPTH){
+        scanner->state = JSON_STATE_ERROR;
+        return false;
+    }
+
+    scanner->containers[scanner->depth] = container;
+    scanner->pathLengths[scanner->depth] = scanner->pathLength;
+    scanner->depth++;
+
+    scanner->state = container == '{' ? JSON_STATE_KEY : JSON_STATE_VALUE;
+    return true;
+}
+
+// A value has ended, the next character should be a separator or the end of the container
+void json_end_value(JSON_SCANNER * scanner){
+    scanner->field = -1;
+
+    if(scanner->depth == 0){
+        // Ready for the next top-level value
+        json_restore_path(scanner);
+        scanner->documents++;
+        scanner->state = JSON_STATE_VALUE;
+    } else {
+        scanner->state = JSON_STATE_AFTER_VALUE;
+    }
+}
+
+// Close the innermost object or array
+bool json_pop(JSON_SCANNER * scanner, char closer){
+    char expectedOpener = closer == '}' ? '{' : '[';
+
+    if(scanner->depth == 0 || scanner->containers[scanner->depth - 1] != expectedOpener){
+        scanner->state = JSON_STATE_ERROR;
+        return false;
+    }
+
+    scanner->depth--;
+    scanner->pathLength = scanner->pathLengths[scanner->depth];
+    scanner->path[scanner->pathLength] = '\0';
+
+    json_end_value(scanner);
+    return true;
+}
+
+void json_end_literal(JSON_SCANNER * scanner){
+    scanner->literal[scanner->literalLength] = '\0';
+
+    if(scanner->field >= 0 && strcmp(scanner->literal, "null") != 0){
+        scanner->callback(scanner->field, scanner->literal, scanner->literalLength, true);
+    }
+
+    json_end_value(scanner);
+}
+
+bool json_feed(JSON_SCANNER * scanner, char * data, int length){
+
+    // Start of the wanted string value within this piece of data
+    int fragmentStart = 0;
+
+    for(int i = 0; i < length; i++){
+        char c = data[i];
+
+        switch(scanner->state){
+
+            case JSON_STATE_STRING:
+                if(scanner->escaped){
+                    scanner->escaped = false;
+                } else if(c == '\\'){
+                    scanner->escaped = true;
+                } else if(c == '"'){
+                    if(scanner->stringIsKey){
+                        json_append_key(scanner);
+                        scanner->state = JSON_STATE_COLON;
+                        break;
+                    }
+
+                    if(scanner->field >= 0){
+                        scanner->callback(scanner->field, data + fragmentStart, i - fragmentStart, true);
+                    }
+
+                    json_end_value(scanner);
+                    break;
+                }
+
+                if(scanner->stringIsKey){
+                    if(scanner->keyLength < JSON_KEY_SIZE){
+                        scanner->key[scanner->keyLength] = c;
+                    }
+                    scanner->keyLength++;
+                }
+                break;
+
+            case JSON_STATE_LITERAL:
+                if(c == ',' || c == '}' || c == ']' || c == ' ' || c == '\t' || c == '\r' || c == '\n'){
+                    json_end_literal(scanner);
+
+                    // The delimiter belongs to the enclosing container
+                    i--;
+                } else if(scanner->literalLength < (JSON_LITERAL_SIZE - 1)){
+                    scanner->literal[scanner->literalLength++] = c;
+                }
+                break;
+
+            case JSON_STATE_VALUE:
+                if(c == ' ' || c == '\t' || c == '\r' || c == '\n'){
+                    break;
+                }
+
+                if(c == '{' || c == '['){
+                    json_push(scanner, c);
+                } else if(c == ']'){
+                    // Empty array
+                    json_pop(scanner, c);
+                } else if(c == '"'){
+                    scanner->state = JSON_STATE_STRING;
+                    scanner->stringIsKey = false;
+                    scanner->escaped = false;
+                    scanner->field = json_match_path(scanner);
+                    fragmentStart = i + 1;
+                } else {
+                    scanner->state = JSON_STATE_LITERAL;
+                    scanner->field = json_match_path(scanner);
+                    scanner->literal[0] = c;
+                    scanner->literalLength = 1;
+                }
+                break;
+
+            case JSON_STATE_KEY:
+                if(c == '"'){
+                    scanner->state = JSON_STATE_STRING;
+                    scanner->stringIsKey = true;
+                    scanner->escaped = false;
+                    scanner->keyLength = 0;
+                } else if(c == '}'){
+                    // Empty object
+                    json_pop(scanner, c);
+                } else if(c != ' ' && c != '\t' && c != '\r' && c != '\n'){
+                    scanner->state = JSON_STATE_ERROR;
+                }
+                break;
+
+            case JSON_STATE_COLON:
+                if(c == ':'){
+                    scanner->state = JSON_STATE_VALUE;
+                } else if(c != ' ' && c != '\t' && c != '\r' && c != '\n'){
+                    scanner->state = JSON_STATE_ERROR;
+                }
+                break;
+
+            case JSON_STATE_AFTER_VALUE:
+                if(c == ','){
+                    if(scanner->containers[scanner->depth - 1] == '{'){
+                        scanner->state = JSON_STATE_KEY;
+                    } else {
+                        scanner->state = JSON_STATE_VALUE;
+                    }
+                    json_restore_path(scanner);
+                } else if(c == '}' || c == ']'){
+                    json_pop(scanner, c);
+                } else if(c != ' ' && c != '\t' && c != '\r' && c != '\n'){
+                    scanner->state = JSON_STATE_ERROR;
+                }
+                break;
+
+            default:
+                return false;
+        }
+
+        if(scanner->state == JSON_STATE_ERROR){
+            return false;
+        }
+    }
+
+    // Hand over the part of a wanted string that has arrived so far
+    if(scanner->state == JSON_STATE_STRING && !scanner->stringIsKey && scanner->field >= 0 && fragmentStart < length){
+        scanner->callback(scanner->field, data + fragmentStart, length - fragmentStart, false);
+    }
+
+    return true;
+}
@@ -0,0 +1,70 @@
+#define JSON_MAX_DEPTH 8
+#define JSON_PATH_SIZE 64
+#define JSON_KEY_SIZE 32
+#define JSON_LITERAL_SIZE 16
+
+#define JSON_STATE_VALUE 0
+#define JSON_STATE_KEY 1
+#define JSON_STATE_COLON 2
+#define JSON_STATE_AFTER_VALUE 3
+#define JSON_STATE_STRING 4
+#define JSON_STATE_LITERAL 5
+#define JSON_STATE_ERROR 6
+
+// Called for values whose key path is in the list given to json_init()
+// field: Index of the path in the list
+// value: String value still in its escaped form, or the text of a number/true/false.
+//        A string split across json_feed() calls is given in several fragments. Null values are not reported.
+// length: Length of this fragment
+// final: True for the last fragment of the value
+typedef void (*JsonValueCallback)(int field, char * value, int length, bool final);
+
+// Resumable, allocation-free JSON scanner. Bytes can be fed in pieces as they arrive.
+// Values are located by key path with object keys separated by '.' and array indices
+// left out, e.g. "choices.message.content" matches {"choices":[{"message":{"content":"..."}}]}
+typedef struct
+{
+    // One of the JSON_STATE_X
+    int state;
+
+    // Wanted paths, NULL entries never match
+    const char ** paths;
+    int numPaths;
+    JsonValueCallback callback;
+
+    // Nesting of objects '{' and arrays '['
+    int depth;
+    char containers[JSON_MAX_DEPTH];
+
+    // Path of the value being parsed and its length at every depth
+    char path[JSON_PATH_SIZE];
+    int pathLength;
+    int pathLengths[JSON_MAX_DEPTH];
+
+    // Key being parsed
+    char key[JSON_KEY_SIZE];
+    int keyLength;
+
+    // Current string is a key rather than a value
+    bool stringIsKey;
+    bool escaped;
+
+    // Number or true/false/null being parsed
+    char literal[JSON_LITERAL_SIZE];
+    int literalLength;
+
+    // Index of the path matching the current value, -1 if not wanted
+    int field;
+
+    // Top-level values completed so far
+    int documents;
+
+} JSON_SCANNER;
+
+// Prepare the scanner for a new document
+// paths: Key paths to report. The array must remain valid while scanning.
+void json_init(JSON_SCANNER * scanner, const char ** paths, int numPaths, JsonValueCallback callback);
+
+// Scan the next piece of the document. Several top-level values may follow each other.
+// Returns false if the document is malformed
+bool json_feed(JSON_SCANNER * scanner, char * data, int length);
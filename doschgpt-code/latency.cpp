@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <conio.h>
+#include <i86.h>
+
+#include "types.h"
+#include "timer.h"
+#include "latency.h"
+
+#define PIT_CHANNEL_0 0x40
+#define PIT_COMMAND 0x43
+
+// Copy the count of channel 0 so both of its bytes are from the same moment
+#define PIT_LATCH_CHANNEL_0 0x00
+
+// Channel 0, low then high byte, binary. The BIOS uses the square wave mode which counts
+// down twice per tick, the rate generator mode counts down once so the count tells how far
+// into the tick we are. Both fire the tick interrupt at the same rate.
+#define PIT_MODE_RATE_GENERATOR 0x34
+#define PIT_MODE_SQUARE_WAVE 0x36
+
+// Count reloaded at every tick, 0 stands for 65536
+#define PIT_RELOAD 0
+
+// Timer chip runs at 1193182 Hz
+#define LATENCY_UNITS_PER_MS 1193
+
+const char * latencyStageNames[LATENCY_STAGE_COUNT] = {"DNS", "ARP", "connect", "send", "first byte", "receive", "parse", "decode", "render", "speech"};
+
+bool latencyStarted = false;
+
+int latencyStage = LATENCY_NONE;
+uint32_t latencyStageStart;
+uint32_t latencyTurnStart;
+
+// Of the last turn in timer chip units
+uint32_t latencyStageTime[LATENCY_STAGE_COUNT];
+uint32_t latencyTurnTime;
+
+void latency_program_timer(uint8_t mode){
+    _disable();
+    outp(PIT_COMMAND, mode);
+    outp(PIT_CHANNEL_0, PIT_RELOAD & 0xFF);
+    outp(PIT_CHANNEL_0, PIT_RELOAD >> 8);
+    _enable();
+}
+
+void latency_init(){
+    latency_program_timer(PIT_MODE_RATE_GENERATOR);
+    latencyStarted = true;
+}
+
+void latency_end(){
+    if(latencyStarted){
+        latency_program_timer(PIT_MODE_SQUARE_WAVE);
+        latencyStarted = false;
+    }
+}
+
+// Timer chip units since an arbitrary point, wraps around after an hour.
+// Read again if a tick went by in between as the count has then started over.
+uint32_t latency_now(){
+    clockTicks_t ticks;
+    uint16_t count;
+
+    do {
+        ticks = TIMER_GET_CURRENT();
+
+        outp(PIT_COMMAND, PIT_LATCH_CHANNEL_0);
+        count = inp(PIT_CHANNEL_0);
+        count |= inp(PIT_CHANNEL_0) << 8;
+
+    } while(ticks != TIMER_GET_CURRENT());
+
+    // Counts down from 65536 during the tick
+    return ((uint32_t) ticks << 16) + (uint16_t) (0 - count);
+}
+
+void latency_turn_begin(int stage){
+    if(!latencyStarted){
+        return;
+    }
+
+    for(int i = 0; i < LATENCY_STAGE_COUNT; i++){
+        latencyStageTime[i] = 0;
+    }
+
+    latencyTurnTime = 0;
+    latencyTurnStart = latency_now();
+    latencyStageStart = latencyTurnStart;
+    latencyStage = stage;
+}
+
+int latency_enter(int stage){
+    int previous = latencyStage;
+
+    if(previous == LATENCY_NONE || stage == LATENCY_NONE || stage == previous){
+        return previous;
+    }
+
+    uint32_t now = latency_now();
+
+    latencyStageTime[previous] += now - latencyStageStart;
+    latencyStageStart = now;
+    latencyStage = stage;
+
+    return previous;
+}
+
+void latency_turn_end(){
+    if(latencyStage == LATENCY_NONE){
+        return;
+    }
+
+    uint32_t now = latency_now();
+
+    latencyStageTime[latencyStage] += now - latencyStageStart;
+    latencyTurnTime = now - latencyTurnStart;
+    latencyStage = LATENCY_NONE;
+}
+
+// Append "name ms.tenths" to the line
+int latency_format_time(char * line, int length, const char * name, uint32_t units){
+    return length + sprintf(line + length, "%s%s %lu.%lu", length > 0 && line[length - 1] != ' ' ? ", " : "", name,
+        (unsigned long) (units / LATENCY_UNITS_PER_MS), (unsigned long) ((units % LATENCY_UNITS_PER_MS) * 10 / LATENCY_UNITS_PER_MS));
+}
+
+void latency_format_network(char * line){
+    int length = sprintf(line, "Network ms: ");
+
+    for(int i = LATENCY_DNS; i <= LATENCY_RECEIVE; i++){
+        length = latency_format_time(line, length, latencyStageNames[i], latencyStageTime[i]);
+    }
+}
+
+void latency_format_app(char * line){
+    int length = sprintf(line, "App ms: ");
+
+    for(int i = LATENCY_PARSE; i <= LATENCY_SPEECH; i++){
+        length = latency_format_time(line, length, latencyStageNames[i], latencyStageTime[i]);
+    }
+
+    latency_format_time(line, length, "total", latencyTurnTime);
+}
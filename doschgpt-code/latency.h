@@ -0,0 +1,61 @@
+// Where the time of each turn goes, shown with -drl. At any moment of a turn one stage is
+// being timed and the time is charged to it, so the stages add up to the whole turn and a
+// stage entered from inside another one, like decoding from inside parsing, is not counted
+// twice. Time is read from the BIOS tick count and the count of timer channel 0 within the
+// tick, so it resolves to about a microsecond instead of 55 ms.
+
+#include "types.h"
+
+// Stages of a turn
+#define LATENCY_NONE -1
+#define LATENCY_DNS 0
+#define LATENCY_ARP 1
+#define LATENCY_CONNECT 2
+
+// Writing the request and waiting until the server has acknowledged all of it
+#define LATENCY_SEND 3
+
+// Waiting for the reply after the request was acknowledged
+#define LATENCY_FIRST_BYTE 4
+
+// Waiting for the rest of the reply, less the time in the stages below
+#define LATENCY_RECEIVE 5
+
+// HTTP framing and JSON scanning
+#define LATENCY_PARSE 6
+
+// Unescaping and code page conversion
+#define LATENCY_DECODE 7
+
+// Word wrapping and printing
+#define LATENCY_RENDER 8
+
+// Queueing and speaking phrases while the reply is still coming in
+#define LATENCY_SPEECH 9
+
+#define LATENCY_STAGE_COUNT 10
+
+// Fits either half of the breakdown
+#define LATENCY_LINE_SIZE 96
+
+// Set the timer chip up to be read within a tick. Nothing is timed until this is called.
+void latency_init();
+
+// Put the timer chip back the way the BIOS left it
+void latency_end();
+
+// Start timing a new turn in the given stage
+void latency_turn_begin(int stage);
+
+// Charge the time so far to the current stage and continue in the given one.
+// Returns the stage that was left so it can be entered again, LATENCY_NONE outside a turn.
+int latency_enter(int stage);
+
+// Charge the time so far to the current stage and stop timing the turn
+void latency_turn_end();
+
+// Network stages of the last turn in milliseconds
+void latency_format_network(char * line);
+
+// Stages of the last turn spent in the app, and the whole turn, in milliseconds
+void latency_format_app(char * line);
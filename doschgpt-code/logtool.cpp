@@ -0,0 +1,262 @@
+// Companion tool to list, search and export conversation logs written with -lgX
+// and to rebuild a missing or damaged index.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "chatlog.h"
+
+#define LOGTOOL_PATH_SIZE 256
+
+// Larger than the reply buffer of any memory profile so content is read in one piece
+#define LOGTOOL_CONTENT_SIZE 32000
+
+#define LOGTOOL_SNIPPET_LENGTH 60
+
+char * contentBuffer;
+
+void printUsage(){
+    printf("Usage: logtool <command> <log file> [arguments]\n");
+    printf("  list                 List every message with its time, role, tokens and length\n");
+    printf("  search <text>        List messages containing text, ignoring case\n");
+    printf("  export [first] [last] Print messages numbered first to last as text\n");
+    printf("  reindex              Rebuild the index from the log\n");
+}
+
+const char * roleName(uint8_t role){
+    switch(role){
+        case CHATLOG_ROLE_USER:
+            return "Me";
+        case CHATLOG_ROLE_ASSISTANT:
+            return "Reply";
+        default:
+            return "?";
+    }
+}
+
+void printTime(uint32_t timestamp){
+    char timeStr[20];
+    time_t t = (time_t) timestamp;
+    strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", localtime(&t));
+    printf("%s", timeStr);
+}
+
+// Print JSON-escaped content as plain text. Characters given as \uXXXX are shown as '?'.
+// Newlines are shown as spaces unless keepNewlines.
+void printUnescaped(char * content, int length, int maxLength, bool keepNewlines){
+    int printed = 0;
+
+    for(int i = 0; i < length && printed < maxLength; i++){
+        char c = content[i];
+
+        if(c == '\\' && i + 1 < length){
+            c = content[++i];
+
+            switch(c){
+                case 'n':
+                    c = keepNewlines ? '\n' : ' ';
+                    break;
+                case 't':
+                    c = ' ';
+                    break;
+                case 'u':
+                    c = '?';
+                    i += 4;
+                    break;
+                case 'r':
+                    continue;
+            }
+        }
+
+        putchar(c);
+        printed++;
+    }
+}
+
+// Escape the search text the same way as the content is stored
+void escapeSearchText(char * text, char * escaped, int escapedSize){
+    int j = 0;
+
+    for(int i = 0; text[i] != '\0' && j < escapedSize - 2; i++){
+        if(text[i] == '"' || text[i] == '\\'){
+            escaped[j++] = '\\';
+        }
+        escaped[j++] = text[i];
+    }
+
+    escaped[j] = '\0';
+}
+
+bool containsIgnoreCase(char * content, int length, char * text){
+    int textLength = strlen(text);
+
+    for(int i = 0; i + textLength <= length; i++){
+        int j = 0;
+
+        while(j < textLength && tolower(content[i + j]) == tolower(text[j])){
+            j++;
+        }
+
+        if(j == textLength){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void printEntry(long number, CHATLOG_INDEX_ENTRY * entry){
+    printf("%5ld ", number);
+    printTime(entry->timestamp);
+    printf(" %-5s %5u tokens %5u bytes\n", roleName(entry->role), entry->tokens, entry->length);
+}
+
+int listLog(FILE * index){
+    long entries = chatlog_index_entries(index);
+    CHATLOG_INDEX_ENTRY entry;
+
+    for(long i = 0; i < entries && chatlog_read_index(index, i, &entry); i++){
+        printEntry(i + 1, &entry);
+    }
+
+    printf("%ld messages\n", entries);
+    return 0;
+}
+
+int searchLog(FILE * log, FILE * index, char * searchText){
+    char text[LOGTOOL_PATH_SIZE];
+    escapeSearchText(searchText, text, LOGTOOL_PATH_SIZE);
+
+    long entries = chatlog_index_entries(index);
+    long matches = 0;
+
+    CHATLOG_INDEX_ENTRY entry;
+    CHATLOG_RECORD record;
+
+    for(long i = 0; i < entries && chatlog_read_index(index, i, &entry); i++){
+        if(!chatlog_read_record(log, entry.offset, &record, contentBuffer, LOGTOOL_CONTENT_SIZE)){
+            continue;
+        }
+
+        int length = record.length < LOGTOOL_CONTENT_SIZE ? record.length : LOGTOOL_CONTENT_SIZE;
+
+        if(containsIgnoreCase(contentBuffer, length, text)){
+            printEntry(i + 1, &entry);
+            printf("      ");
+            printUnescaped(contentBuffer, length, LOGTOOL_SNIPPET_LENGTH, false);
+            printf("\n");
+            matches++;
+        }
+    }
+
+    printf("%ld matches\n", matches);
+    return 0;
+}
+
+int exportLog(FILE * log, FILE * index, long first, long last){
+    long entries = chatlog_index_entries(index);
+
+    if(last > entries){
+        last = entries;
+    }
+
+    CHATLOG_INDEX_ENTRY entry;
+    CHATLOG_RECORD record;
+
+    for(long i = first - 1; i < last && chatlog_read_index(index, i, &entry); i++){
+        if(!chatlog_read_record(log, entry.offset, &record, contentBuffer, LOGTOOL_CONTENT_SIZE)){
+            continue;
+        }
+
+        printf("[");
+        printTime(entry.timestamp);
+        printf("] %s:\n", roleName(entry.role));
+
+        int length = record.length < LOGTOOL_CONTENT_SIZE ? record.length : LOGTOOL_CONTENT_SIZE;
+        printUnescaped(contentBuffer, length, length, true);
+        printf("\n\n");
+    }
+
+    return 0;
+}
+
+int reindexLog(FILE * log, char * indexPath){
+    FILE * index = fopen(indexPath, "w+b");
+
+    if(index == NULL || !chatlog_write_header(index, CHATLOG_INDEX_MAGIC)){
+        printf("Cannot create index %s\n", indexPath);
+        return -1;
+    }
+
+    long entries = chatlog_rebuild_index(log, index);
+    fclose(index);
+
+    printf("Indexed %ld messages\n", entries);
+    return 0;
+}
+
+int main(int argc, char * argv[]){
+
+    if(argc < 3){
+        printUsage();
+        return -1;
+    }
+
+    char * command = argv[1];
+    char * logPath = argv[2];
+
+    char indexPath[LOGTOOL_PATH_SIZE];
+    chatlog_index_path(logPath, indexPath, LOGTOOL_PATH_SIZE);
+
+    FILE * log = fopen(logPath, "rb");
+
+    if(log == NULL || !chatlog_read_header(log, CHATLOG_MAGIC)){
+        printf("Cannot open conversation log %s\n", logPath);
+        return -1;
+    }
+
+    if(strcmp(command, "reindex") == 0){
+        int result = reindexLog(log, indexPath);
+        fclose(log);
+        return result;
+    }
+
+    FILE * index = fopen(indexPath, "rb");
+
+    if(index == NULL || !chatlog_read_header(index, CHATLOG_INDEX_MAGIC)){
+        printf("Cannot open index %s, run logtool reindex %s\n", indexPath, logPath);
+        fclose(log);
+        return -1;
+    }
+
+    contentBuffer = (char *) malloc(LOGTOOL_CONTENT_SIZE);
+
+    if(contentBuffer == NULL){
+        printf("Cannot allocate memory for message content\n");
+        return -1;
+    }
+
+    int result;
+
+    if(strcmp(command, "list") == 0){
+        result = listLog(index);
+    } else if(strcmp(command, "search") == 0 && argc >= 4){
+        result = searchLog(log, index, argv[3]);
+    } else if(strcmp(command, "export") == 0){
+        long first = argc >= 4 ? atol(argv[3]) : 1;
+        long last = argc >= 5 ? atol(argv[4]) : chatlog_index_entries(index);
+        result = exportLog(log, index, first > 0 ? first : 1, last);
+    } else {
+        printUsage();
+        result = -1;
+    }
+
+    free(contentBuffer);
+    fclose(index);
+    fclose(log);
+
+    return result;
+}
@@ -0,0 +1,89 @@
+// Memory profiles that size every buffer of the app and the mTCP stack together.
+// Select one in the MAKEFILE with memory_profile = TINY, STANDARD or MAX.
+// Also included by doschgpt.cfg so it needs its own guard.
+//
+// MEM_RECEIVE_BUFFER_SIZE is the app's buffer the reply is read into. MEM_TCP_RECV_RING_SIZE
+// is the receive ring of the socket in front of it, which mTCP limits to 512 to 16384 bytes.
+
+#ifndef MEMPROF_H
+#define MEMPROF_H
+
+#if defined(MEMORY_PROFILE_TINY)
+
+// 256KB machines. Short prompts and replies with a couple of turns of history.
+#define MEMORY_PROFILE_NAME "TINY"
+
+#define MEM_MESSAGE_IN_SIZE 800
+#define MEM_MESSAGE_TO_SEND_SIZE 2048
+#define MEM_REPLY_DISPLAY_SIZE 2500
+#define MEM_REPLY_CONTENT_SIZE 4000
+#define MEM_RECEIVE_BUFFER_SIZE 5000
+#define MEM_TCP_RECV_RING_SIZE 4096
+#define MEM_CONVO_ARENA_SIZE 2000
+#define MEM_CONVO_MAX_TURNS 4
+#define MEM_HISTORY_BUFFER_SIZE 1024
+#define MEM_TTS_QUEUE_SIZE 512
+
+// Expanded memory used instead with -ems
+#define MEM_EMS_CONVO_ARENA_SIZE 32768L
+#define MEM_EMS_REPLY_SPILL_SIZE 32768L
+
+#define MEM_PACKET_BUFFERS 6
+#define MEM_TCP_MAX_XMIT_BUFS 4
+#define MEM_TCP_SOCKET_RING_SIZE 4
+
+#elif defined(MEMORY_PROFILE_MAX)
+
+// 640KB machines. Long replies and history, more packets in flight both ways.
+#define MEMORY_PROFILE_NAME "MAX"
+
+#define MEM_MESSAGE_IN_SIZE 3200
+#define MEM_MESSAGE_TO_SEND_SIZE 8192
+#define MEM_REPLY_DISPLAY_SIZE 12000
+#define MEM_REPLY_CONTENT_SIZE 24000
+#define MEM_RECEIVE_BUFFER_SIZE 30000
+#define MEM_TCP_RECV_RING_SIZE 16384
+#define MEM_CONVO_ARENA_SIZE 16000
+#define MEM_CONVO_MAX_TURNS 24
+#define MEM_HISTORY_BUFFER_SIZE 8192
+#define MEM_TTS_QUEUE_SIZE 4096
+
+#define MEM_EMS_CONVO_ARENA_SIZE 262144L
+#define MEM_EMS_REPLY_SPILL_SIZE 131072L
+
+#define MEM_PACKET_BUFFERS 20
+#define MEM_TCP_MAX_XMIT_BUFS 16
+#define MEM_TCP_SOCKET_RING_SIZE 8
+
+#else
+
+// Default, same sizes as earlier versions
+#define MEMORY_PROFILE_STANDARD
+#define MEMORY_PROFILE_NAME "STANDARD"
+
+#define MEM_MESSAGE_IN_SIZE 1600
+#define MEM_MESSAGE_TO_SEND_SIZE 4096
+#define MEM_REPLY_DISPLAY_SIZE 5000
+#define MEM_REPLY_CONTENT_SIZE 12000
+#define MEM_RECEIVE_BUFFER_SIZE 14000
+#define MEM_TCP_RECV_RING_SIZE 14000
+#define MEM_CONVO_ARENA_SIZE 6000
+#define MEM_CONVO_MAX_TURNS 12
+#define MEM_HISTORY_BUFFER_SIZE 4096
+#define MEM_TTS_QUEUE_SIZE 2048
+
+#define MEM_EMS_CONVO_ARENA_SIZE 65536L
+#define MEM_EMS_REPLY_SPILL_SIZE 65536L
+
+#define MEM_PACKET_BUFFERS 10
+#define MEM_TCP_MAX_XMIT_BUFS 10
+#define MEM_TCP_SOCKET_RING_SIZE 4
+
+#endif
+
+// Other sizes are refused by TcpSocket::setRecvBuffer()
+#if MEM_TCP_RECV_RING_SIZE < 512 || MEM_TCP_RECV_RING_SIZE > 16384
+#error MEM_TCP_RECV_RING_SIZE must be from 512 to 16384
+#endif
+
+#endif
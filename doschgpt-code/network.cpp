@@ -1,7 +1,13 @@
 #include "network.h"
+#include "http.h"
+#include "json.h"
+#include "convo.h"
+#include "latency.h"
+#include "memprof.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 
 #include "types.h"
 #include "utils.h"
@@ -12,59 +18,200 @@
 #include "tcpsockm.h"
 #include "timer.h"
 
-#define CHATGPT_API_CHAT_COMPLETION "POST /v1/chat/completions HTTP/1.1\r\nContent-Type: application/json\r\nAuthorization: Bearer %s\r\nHost: api.openai.com\r\nContent-Length: %d\r\nConnection: close\r\n\r\n%s"
-#define CHATGPT_API_BODY_INITIAL "{ \"model\": \"%s\", \"messages\": [{\"role\": \"user\", \"content\": \"%s\"}], \"temperature\": %.1f }"
-#define CHATGPT_API_BODY_SUBSEQUENT "{ \"model\": \"%s\", \"messages\": [{\"role\": \"user\", \"content\": \"%s\"}, {\"role\": \"assistant\", \"content\": \"%s\"}, {\"role\": \"user\", \"content\": \"%s\"}], \"temperature\": %.1f }"
+// Requests are written piece by piece: header, body start, conversation history, then the new message
+#define CHATGPT_API_CHAT_COMPLETION "POST /v1/chat/completions HTTP/1.1\r\nContent-Type: application/json\r\nAuthorization: Bearer %s\r\nHost: api.openai.com\r\nContent-Length: %ld\r\nConnection: %s\r\n\r\n"
+#define CHATGPT_API_BODY_START "{ \"model\": \"%s\", \"messages\": ["
+#define CHATGPT_API_BODY_END "\"}], \"temperature\": %.1f%s }"
 
-//Max Hugging Face reply is 400 tokens
-#define HF_API_CHAT_COMPLETION "POST /models/%s HTTP/1.1\r\nContent-Type: application/json\r\nAuthorization: Bearer %s\r\nHost: api-inference.huggingface.co\r\nContent-Length: %d\r\nConnection: close\r\n\r\n%s"
-#define HF_API_BODY_INITIAL "{\"inputs\": \"[INST]%s[/INST]\", \"parameters\": { \"temperature\": %.1f , \"max_new_tokens\": 400} }"
-#define HF_API_BODY_SUBSEQUENT "{\"inputs\": \"[INST]%s[/INST]%s[INST]%s[/INST]\", \"parameters\": { \"temperature\": %.1f , \"max_new_tokens\": 400} }"
-
-#define OL_API_CHAT_COMPLETION "POST /api/chat HTTP/1.1\r\nContent-Type: application/json\r\nHost: %s\r\nContent-Length: %d\r\nConnection: close\r\n\r\n%s"
-#define OL_API_BODY_INITIAL "{ \"model\": \"%s\", \"messages\": [ { \"role\": \"user\", \"content\": \"%s\" } ], \"options\": { \"temperature\": %.1f }, \"stream\": false }"
-#define OL_API_BODY_SUBSEQUENT "{ \"model\": \"%s\", \"messages\": [{\"role\": \"user\", \"content\": \"%s\"}, {\"role\": \"assistant\", \"content\": \"%s\"}, {\"role\": \"user\", \"content\": \"%s\"}], \"options\": { \"temperature\": %.1f }, \"stream\": false }"
-
-#define API_BODY_SIZE_BUFFER 12000
-#define SEND_RECEIVE_BUFFER 14000
-#define PREVIOUS_MESSAGE_SIZE 5000
-#define PREVIOUS_GPT_REPLY_SIZE 8000
+//Appended to the ChatGPT body when streaming. Usage is only sent in the last event if requested.
+#define CHATGPT_API_STREAM_OPTIONS ", \"stream\": true, \"stream_options\": {\"include_usage\": true}"
 
+//Max Hugging Face reply is 400 tokens
+#define HF_API_CHAT_COMPLETION "POST /models/%s HTTP/1.1\r\nContent-Type: application/json\r\nAuthorization: Bearer %s\r\nHost: api-inference.huggingface.co\r\nContent-Length: %ld\r\nConnection: %s\r\n\r\n"
+#define HF_API_BODY_START "{\"inputs\": \""
+#define HF_API_BODY_MESSAGE_START "[INST]"
+#define HF_API_BODY_END "[/INST]\", \"parameters\": { \"temperature\": %.1f , \"max_new_tokens\": 400, \"return_full_text\": false} }"
+
+#define OL_API_CHAT_COMPLETION "POST /api/chat HTTP/1.1\r\nContent-Type: application/json\r\nHost: %s\r\nContent-Length: %ld\r\nConnection: %s\r\n\r\n"
+#define OL_API_BODY_START "{ \"model\": \"%s\", \"messages\": ["
+#define OL_API_BODY_END "\"}], \"options\": { \"temperature\": %.1f }, \"stream\": %s }"
+
+// New message for ChatGPT and Ollama, its text follows
+#define API_BODY_USER_MESSAGE_START "{\"role\": \"user\", \"content\": \""
+
+// Collects the reply text
+#define REPLY_CONTENT_SIZE MEM_REPLY_CONTENT_SIZE
+// Only holds the reply, the request is written straight into the outgoing packets
+#define RECEIVE_BUFFER_SIZE MEM_RECEIVE_BUFFER_SIZE
+// Receive ring of the socket, the reply is moved from it into the receive buffer
+#define TCP_RECV_RING_SIZE MEM_TCP_RECV_RING_SIZE
+
+// Fits the longest header with the largest API key and model name
+#define REQUEST_FORMAT_SIZE 640
+
+#define REQUEST_WRITE_MEASURE 0
+#define REQUEST_WRITE_SEND 1
+
+// Steps of a request, each advanced by network_request_poll() without waiting
+#define REQUEST_STATE_IDLE 0
+#define REQUEST_STATE_RESOLVING 1
+#define REQUEST_STATE_CONNECTING 2
+#define REQUEST_STATE_SENDING 3
+#define REQUEST_STATE_WAIT_ACKED 4
+#define REQUEST_STATE_RECEIVING 5
+#define REQUEST_STATE_DONE 6
+
+#define NETWORK_EXCHANGE_OK 0
+#define NETWORK_EXCHANGE_FAILED 1
+#define NETWORK_EXCHANGE_NO_REPLY 2
+#define NETWORK_EXCHANGE_BUSY 3
+#define NETWORK_EXCHANGE_TOO_LARGE 4
+
+// How long to let a socket finish closing when the app ends
+#define TIME_TO_WAIT_CLOSE_ON_STOP 1000
+
+// Only used for replies without Content-Length or chunked encoding that do not close the connection
 #define TIME_TO_WAIT_AFTER_LAST_FRAME 2000
 
-char * api_body_buffer = NULL;
-char * sendRecvBuffer = NULL;
-
-char * previousMessage = NULL;
-int sizeOfPreviousMessage = 0;
-char * previousGPTReply = NULL;
-int sizeOfPreviousGPTReply = 0;
-char * previousTempMessage = NULL;
+#define SSE_DATA_PREFIX "data:"
+#define SSE_DATA_PREFIX_LENGTH 5
+#define SSE_DONE_MARKER "[DONE]"
+#define SSE_DONE_MARKER_LENGTH 6
+
+#define REPLY_ERROR_SIZE 512
+
+// Index of each key path in the REPLY_FIELDS tables
+#define REPLY_FIELD_CONTENT 0
+#define REPLY_FIELD_ERROR 1
+#define REPLY_FIELD_ERROR_MESSAGE 2
+#define REPLY_FIELD_PROMPT_TOKENS 3
+#define REPLY_FIELD_COMPLETION_TOKENS 4
+#define REPLY_FIELD_DONE 5
+#define REPLY_FIELD_COUNT 6
+
+// Key paths of the values we need from each reply format, NULL if the API does not have it
+const char * CHATGPT_REPLY_FIELDS[REPLY_FIELD_COUNT] = {"choices.message.content", "error", "error.message", "usage.prompt_tokens", "usage.completion_tokens", NULL};
+const char * CHATGPT_STREAM_REPLY_FIELDS[REPLY_FIELD_COUNT] = {"choices.delta.content", "error", "error.message", "usage.prompt_tokens", "usage.completion_tokens", NULL};
+const char * HF_REPLY_FIELDS[REPLY_FIELD_COUNT] = {"generated_text", "error", NULL, NULL, NULL, NULL};
+const char * OL_REPLY_FIELDS[REPLY_FIELD_COUNT] = {"message.content", "error", NULL, "prompt_eval_count", "eval_count", "done"};
+
+#define HF_INST_START_MARKER "[INST]"
+#define HF_INST_START_MARKER_LENGTH 6
+#define HF_INST_END_MARKER "[/INST]"
+#define HF_INST_END_MARKER_LENGTH 7
+
+// Progress through a Hugging Face reply that may repeat the prompt before the reply
+#define HF_ECHO_CHECKING 0
+#define HF_ECHO_SKIPPING 1
+#define HF_ECHO_DONE 2
+
+char * recvBuffer = NULL;
+
+// Request in progress, see network_request_poll()
+int requestState = REQUEST_STATE_IDLE;
+int requestResult;
+bool requestCancelled;
+bool requestReusingConnection;
+long requestContentLength;
+int requestPort;
+uint16_t * requestOutgoingPort;
+IpAddr_t requestServerAddr;
+clockTicks_t requestStateStartTime;
+RequestHeaderCallback requestHeaderCall;
+RequestBodyCallback requestBodyCall;
+ReceiveCallback requestReceiveCall;
+
+// Request being written, see network_write()
+int requestWriteMode;
+long requestLength;
+long requestBytesQueued;
+bool requestWriteBlocked;
+bool requestWriteFailed;
+clockTicks_t requestWriteStartTime;
+TcpBuffer * requestXmitBuf = NULL;
+uint16_t requestXmitSize;
+char requestFormatBuffer[REQUEST_FORMAT_SIZE];
+
+// Parameters of the current request for the request callbacks
+char * requestHostname;
+char * requestApiKey;
+char * requestModel;
+char * requestMessage;
+int requestMessageLength;
+float requestTemperature;
+bool requestStream;
+
+// Hugging Face may repeat the whole prompt before the reply despite return_full_text.
+// The prompt starts with [INST] and the reply follows the last of its [/INST] markers.
+bool requestTrimInst;
+int hfPromptMarkers;
+int hfEchoState;
+int hfEchoStartMatched;
+int hfEchoEndMatched;
+int hfEchoMarkersLeft;
+
+// Framing of the reply currently being received
+HTTP_RESPONSE httpResponse;
+char * receiveBuffer;
+int receiveBufferSize;
+int receiveBytesSoFar;
+bool receivedFirstByte;
+
+// The connection is waiting for ARP to find the first hop towards the server
+bool requestArpPending;
+bool receiveCallbackComplete;
+clockTicks_t receiveLastFrameTime;
+
+// Reply being parsed for the current request
+JSON_SCANNER replyScanner;
+COMPLETION_OUTPUT * replyOutput = NULL;
+StreamCallback streamCallback = NULL;
+int replyScanPos = 0;
+bool replyDone = false;
+bool replyGotContent = false;
+bool replyGotError = false;
+bool replyMalformed = false;
+
+// Collects the escaped reply text, from every event if streamed
+char * replyContentBuffer = NULL;
+int replyContentLength = 0;
+
+char replyErrorBuffer[REPLY_ERROR_SIZE];
+int replyErrorLength = 0;
 
 //Network configuration obtained from network_init()
 uint16_t startingPort;
 uint16_t endingPort;
 uint16_t network_socketConnectTimeout;
 uint16_t network_socketResponseTimeout;
+bool network_keepAlive;
 
-// Only one socket is used in this app
+// Socket of the request, kept open between requests with -ka
 TcpSocket *mySocket = NULL;
 
+// Socket of an earlier request still closing in the background
+TcpSocket *closingSocket = NULL;
+
 // Check this flag once in a while to see if the user wants out.
 volatile uint8_t CtrlBreakDetected = 0;
 
 EndCallback endF;
+IdleCallback idleF;
 
 void __interrupt __far ctrlBreakHandler( ) {
     CtrlBreakDetected = 1;
-    endF();
+
+    // A request in progress is cancelled by network_request_poll() instead of ending the app
+    if(requestState == REQUEST_STATE_IDLE || requestState == REQUEST_STATE_DONE){
+        endF();
+    }
 }
 
 void __interrupt __far ctrlCHandler( ) {
   // Do Nothing - Ctrl-C is a legal character
 }
 
-bool network_init(uint16_t startPort, uint16_t endPort, EndCallback endCall, uint16_t socketConnectTimeout, uint16_t socketResponseTimeout){
+bool network_init(uint16_t startPort, uint16_t endPort, EndCallback endCall, IdleCallback idleCall, uint16_t socketConnectTimeout, uint16_t socketResponseTimeout, bool keepAlive){
 
     // Setup mTCP environment
     if(Utils::parseEnv()){
@@ -72,55 +219,28 @@ bool network_init(uint16_t startPort, uint16_t endPort, EndCallback endCall, uin
         return false;
     }
 
-    // Initialize TCP/IP stack with 1 socket
-    if(Utils::initStack(1, TCP_SOCKET_RING_SIZE, ctrlBreakHandler, ctrlCHandler)){
+    // Initialize TCP/IP stack with a socket for the request and one closing in the background
+    if(Utils::initStack(TCP_MAX_SOCKETS, TCP_SOCKET_RING_SIZE, ctrlBreakHandler, ctrlCHandler)){
         fprintf(stderr, "Cannot init stack\n" );
         return false;
     }
 
-    sendRecvBuffer = (char *) calloc(SEND_RECEIVE_BUFFER, sizeof(char));
-
-    if(sendRecvBuffer == NULL){
-        printf("Cannot allocate memory for sendRecvBuffer\n");
-
-        network_stop();
-
-        return false;
-    }
-
-
-    api_body_buffer = (char *) calloc(API_BODY_SIZE_BUFFER, sizeof(char));
+    recvBuffer = (char *) calloc(RECEIVE_BUFFER_SIZE, sizeof(char));
 
-    if(api_body_buffer == NULL){
-        printf("Cannot allocate memory for API Body Buffer\n");
+    if(recvBuffer == NULL){
+        printf("Cannot allocate memory for Receive Buffer\n");
 
         network_stop();
 
         return false;
     }
 
-    previousMessage = (char *) calloc(PREVIOUS_MESSAGE_SIZE, sizeof(char));
-    if(previousMessage == NULL){
-        printf("Cannot allocate memory for Previous Message Buffer\n");
-        
-        network_stop();
-
-        return false;
-    }
 
-    previousGPTReply = (char *) calloc(PREVIOUS_GPT_REPLY_SIZE, sizeof(char));
-    if(previousGPTReply == NULL){
-        printf("Cannot allocate memory for Previous GPT Reply Buffer\n");
-        
-        network_stop();
+    replyContentBuffer = (char *) calloc(REPLY_CONTENT_SIZE, sizeof(char));
 
-        return false;
-    }
+    if(replyContentBuffer == NULL){
+        printf("Cannot allocate memory for Reply Content Buffer\n");
 
-    previousTempMessage = (char *) calloc(PREVIOUS_MESSAGE_SIZE, sizeof(char));
-    if(previousTempMessage == NULL){
-        printf("Cannot allocate memory for Temp Message Buffer\n");
-        
         network_stop();
 
         return false;
@@ -130,80 +250,97 @@ bool network_init(uint16_t startPort, uint16_t endPort, EndCallback endCall, uin
     endingPort = endPort;
 
     endF = endCall;
+    idleF = idleCall;
     network_socketConnectTimeout = socketConnectTimeout;
     network_socketResponseTimeout = socketResponseTimeout;
+    network_keepAlive = keepAlive;
     
     return true;
 }
 
 void network_stop(){
 
-    if(sendRecvBuffer != NULL){
-        free(sendRecvBuffer);
-        sendRecvBuffer = NULL;
+    if(recvBuffer != NULL){
+        free(recvBuffer);
+        recvBuffer = NULL;
     }
 
-    if(api_body_buffer != NULL){
-        free(api_body_buffer);
-        api_body_buffer = NULL;
+    if(replyContentBuffer != NULL){
+        free(replyContentBuffer);
+        replyContentBuffer = NULL;
     }
 
-    if(previousMessage != NULL){
-        free(previousMessage);
-        previousMessage = NULL;
-    }
+    network_closeCurrentSocket();
 
-    if(previousGPTReply != NULL){
-        free(previousGPTReply);
-        previousGPTReply = NULL;
-    }
+    // Give the server a moment to acknowledge the close, the stack is ended either way
+    clockTicks_t stopTime = TIMER_GET_CURRENT();
 
-    if(previousTempMessage != NULL){
-        free(previousTempMessage);
-        previousTempMessage = NULL;
+    while(closingSocket != NULL && Timer_diff(stopTime, TIMER_GET_CURRENT()) < TIMER_MS_TO_TICKS(TIME_TO_WAIT_CLOSE_ON_STOP)){
+        network_drivePackets();
     }
-
-    network_closeCurrentSocket();
     
     Utils::endStack( );
     //Utils::dumpStats(stderr);
 }
 
-bool network_connectToSocket(char * hostname, int port, uint16_t * outgoingPort){
+uint32_t network_connection_memory(){
+    // A socket that is closing in the background keeps its ring while the next one connects
+    return (uint32_t) TCP_MAX_SOCKETS * TCP_RECV_RING_SIZE;
+}
 
-    network_closeCurrentSocket();
+// Start resolving the hostname of the request, the connection is opened once it is known
+bool network_connect_start(){
 
-    IpAddr_t serverAddr;
+    network_closeCurrentSocket();
+    latency_enter(LATENCY_DNS);
 
-    // Resolve the name and send the request
-    int8_t rc2 = Dns::resolve(hostname, serverAddr, 1 );
-    if ( rc2 < 0 ) {
+    // Resolved straight away from the cache or an IP address, otherwise a query is sent
+    int8_t rc = Dns::resolve(requestHostname, requestServerAddr, 1);
+    if ( rc < 0 ) {
       fprintf( stderr, "Error resolving server\n" );
       return false;
     }
 
-    uint8_t done = 0;
+    requestState = REQUEST_STATE_RESOLVING;
+    return true;
+}
 
-    while ( !done ) {
+// True if the Ethernet address of the first hop towards the server is known,
+// the server itself on the local network or else the gateway
+bool network_next_hop_known(){
+    EthAddr_t nextHopEthAddr;
+    uint32_t serverAddr_u = *(uint32_t *) requestServerAddr;
 
-      if ( CtrlBreakDetected ) break;
-      if ( !Dns::isQueryPending( ) ) break;
+    if((MyIpAddr_u & Netmask_u) != (serverAddr_u & Netmask_u)){
+        return Arp::resolve(Gateway, nextHopEthAddr) == 0;
+    }
 
-        network_drivePackets();
+    return Arp::resolve(requestServerAddr, nextHopEthAddr) == 0;
+}
 
-    }
+// Open the socket to the resolved server without waiting for the handshake
+bool network_connect_open(){
 
-    //fprintf(stderr, "Server resolved to %d.%d.%d.%d - connecting\n\n", serverAddr[0], serverAddr[1], serverAddr[2], serverAddr[3] );
+    //fprintf(stderr, "Server resolved to %d.%d.%d.%d - connecting\n\n", requestServerAddr[0], requestServerAddr[1], requestServerAddr[2], requestServerAddr[3] );
 
     mySocket = TcpSocketMgr::getSocket();
 
-    mySocket->setRecvBuffer(SEND_RECEIVE_BUFFER);
+    if(mySocket == NULL){
+        return false;
+    }
+
+    // Without a receive ring nothing of the reply would ever be read
+    if(mySocket->setRecvBuffer(TCP_RECV_RING_SIZE) != TCP_RC_GOOD){
+        TcpSocketMgr::freeSocket(mySocket);
+        mySocket = NULL;
+        return false;
+    }
 
     uint16_t currentPort = ((uint16_t) rand()) % (endingPort + 1 - startingPort) + startingPort;
-    *outgoingPort = currentPort;
+    *requestOutgoingPort = currentPort;
 
-    // Non-blocking connect.  Wait 10 seconds before giving up.
-    int8_t rc = mySocket->connect(currentPort++, serverAddr, port, network_socketConnectTimeout);
+    // Handshake continues as packets are driven by network_request_poll()
+    int8_t rc = mySocket->connectNonBlocking(currentPort++, requestServerAddr, requestPort);
 
     if(currentPort > endingPort){
         currentPort = startingPort;
@@ -214,442 +351,864 @@ bool network_connectToSocket(char * hostname, int port, uint16_t * outgoingPort)
         return false;
     }
 
+    // Opening the socket has asked ARP for the first hop if it was not known
+    requestArpPending = !network_next_hop_known();
+    latency_enter(requestArpPending ? LATENCY_ARP : LATENCY_CONNECT);
+
+    requestState = REQUEST_STATE_CONNECTING;
+    requestStateStartTime = TIMER_GET_CURRENT();
     return true;
 }
 
+// Free the closing socket once the server has acknowledged the close or it timed out
+void network_drive_closing(){
+    if(closingSocket == NULL){
+        return;
+    }
+
+    // Nothing reads from it any more, keep the window open so the server can get to its FIN
+    closingSocket->flushRecv();
+
+    if(closingSocket->isCloseDone()){
+        TcpSocketMgr::freeSocket(closingSocket);
+        closingSocket = NULL;
+    }
+}
+
+// Free the closing socket straight away. Backdating the start of its close makes
+// isCloseDone() destroy it as it does with any close that has taken too long.
+void network_abort_closing(){
+    if(closingSocket == NULL){
+        return;
+    }
+
+    if(!closingSocket->isCloseDone()){
+        closingSocket->closeStarted = TIMER_GET_CURRENT() - TIMER_MS_TO_TICKS(TCP_CLOSE_TIMEOUT);
+        closingSocket->isCloseDone();
+    }
+
+    TcpSocketMgr::freeSocket(closingSocket);
+    closingSocket = NULL;
+}
+
 void network_closeCurrentSocket(){
-    if(mySocket != NULL){
-        mySocket->close();
-        TcpSocketMgr::freeSocket(mySocket);
-        mySocket = NULL;
+    if(mySocket == NULL){
+        return;
     }
+
+    // Only one socket can be closing, give up on an earlier one instead of waiting for it
+    network_abort_closing();
+
+    // The close completes in the background while packets are driven
+    mySocket->closeNonblocking();
+    closingSocket = mySocket;
+    mySocket = NULL;
+
+    network_drivePackets();
 }
 
 void network_drivePackets(){
     PACKET_PROCESS_SINGLE;
     Arp::driveArp();
     Tcp::drivePackets();
+    Dns::drivePendingQuery();
+    network_drive_closing();
 }
 
-bool network_send_receive(char * hostname, int port, char * to_send, int to_send_size, char * to_receive, int to_receive_size, uint16_t * outgoingPort){
-    bool status = network_connectToSocket(hostname, port, outgoingPort);
-    if (status) {
-        //fprintf(stderr, "Can connect\n");
-    } else {
-        //fprintf(stderr, "Cannot connect\n");
-        return false;
+// Value of the Connection header in requests
+const char * network_connection_header(){
+    return network_keepAlive ? "keep-alive" : "close";
+}
+
+// True if a connection from a previous request is still usable
+bool network_isConnectionOpen(){
+    return mySocket != NULL && mySocket->isEstablished();
+}
+
+// Take a TcpBuffer to fill if there is space in the outgoing queue
+bool network_write_get_buffer(){
+    uint16_t sendSize = mySocket->getSuggestedSendSize();
+
+    if(!mySocket->outgoingQueueIsFull() && sendSize > 0){
+        requestXmitBuf = TcpBuffer::getXmitBuf();
+
+        if(requestXmitBuf != NULL){
+            requestXmitBuf->dataLen = 0;
+            requestXmitSize = sendSize;
+            return true;
+        }
     }
 
-    int16_t bytesSent = mySocket->send((unsigned char *) to_send, to_send_size);
-    memset(to_receive, 0, to_receive_size);
+    // The next pass carries on from here once the ACKs have freed up buffers
+    requestWriteBlocked = true;
+    return false;
+}
 
-    if(bytesSent == to_send_size){
-        //fprintf(stderr, "Waiting for data\n");
-        int bytesReceivedThisInstant = 0;
+// Queue the TcpBuffer being filled for sending
+void network_write_flush(){
+    if(requestXmitBuf == NULL){
+        return;
+    }
 
-        clockTicks_t startTime = TIMER_GET_CURRENT();
+    uint16_t dataLen = requestXmitBuf->dataLen;
 
-        bool receivedfirstByte = false;
+    if(dataLen > 0 && !requestWriteFailed && mySocket->enqueue(requestXmitBuf) == 0){
+        requestXmitBuf = NULL;
+        requestBytesQueued += dataLen;
+        network_drivePackets();
+        return;
+    }
 
-        char * pointerToReceiveAt = to_receive;
-        int bytesReceivedSoFar = 0;
+    if(dataLen > 0){
+        requestWriteFailed = true;
+    }
 
-        clockTicks_t timeReceivedLastFrame = startTime;
+    TcpBuffer::returnXmitBuf(requestXmitBuf);
+    requestXmitBuf = NULL;
+}
 
-        while(!mySocket->isClosed()){
+void network_write(const char * data, int length){
+    long writePos = requestLength;
+    requestLength += length;
 
-            int bytesAbleToReceive = to_receive_size - bytesReceivedSoFar;
-            
-            //Receive as much as we can then loop again as sometimes cannot fill up the buffer on first try
-            bytesReceivedThisInstant = mySocket->recv((unsigned char *) pointerToReceiveAt, bytesAbleToReceive);
+    if(requestWriteMode == REQUEST_WRITE_MEASURE || requestWriteBlocked){
+        return;
+    }
 
-            if(bytesReceivedThisInstant > 0){
-                pointerToReceiveAt = pointerToReceiveAt + bytesReceivedThisInstant;
-                bytesReceivedSoFar += bytesReceivedThisInstant;
+    // Skip what an earlier pass has already queued
+    if(writePos < requestBytesQueued){
+        long bytesToSkip = requestBytesQueued - writePos;
 
-                receivedfirstByte = true;
-                timeReceivedLastFrame = TIMER_GET_CURRENT();
-            } else {
-                // We no longer get any bytes after receiving something. Menas end of message
-                if(receivedfirstByte){
-                    // Short timeout after we no longer receive any bytes
-                    if(Timer_diff(timeReceivedLastFrame, TIMER_GET_CURRENT()) > TIMER_MS_TO_TICKS(TIME_TO_WAIT_AFTER_LAST_FRAME)) {
-                        // We don't break immediately as we might just have temporarily 0 bytes
-                        break;
-                    }
-                }
-            }
+        if(bytesToSkip >= length){
+            return;
+        }
 
-            network_drivePackets();
+        data += bytesToSkip;
+        length -= (int) bytesToSkip;
+    }
 
-            // Timeout after no reply for some time
-            if(Timer_diff(startTime, TIMER_GET_CURRENT()) > TIMER_MS_TO_TICKS(network_socketResponseTimeout) ) {
-                status = false;
-                break;
-            }
+    // Copy straight into the packets, each filled up to the size the server can take
+    while(length > 0 && !requestWriteFailed){
+        if(requestXmitBuf == NULL && !network_write_get_buffer()){
+            return;
+        }
+
+        int bytesToCopy = requestXmitSize - requestXmitBuf->dataLen;
+        if(length < bytesToCopy){
+            bytesToCopy = length;
+        }
+
+        uint8_t * dataStart = ((uint8_t *) requestXmitBuf) + sizeof(TcpBuffer);
+        memcpy(dataStart + requestXmitBuf->dataLen, data, bytesToCopy);
+
+        requestXmitBuf->dataLen += bytesToCopy;
+        data += bytesToCopy;
+        length -= bytesToCopy;
+
+        if(requestXmitBuf->dataLen == requestXmitSize){
+            network_write_flush();
         }
-        
-    } else {
-        fprintf(stderr, "Did not send required %d bytes\n", to_send_size);
-        status = false;
     }
+}
 
-    network_closeCurrentSocket();
-    return status;
+void network_write_str(const char * str){
+    network_write(str, strlen(str));
 }
 
-bool network_get_chatgpt_completion(char * hostname, int port, char * api_key, char * model, char * message, float temperature, COMPLETION_OUTPUT * output){
-    
-    int messageLength = strlen(message);
+void network_write_format(const char * format, ...){
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(requestFormatBuffer, REQUEST_FORMAT_SIZE, format, args);
+    va_end(args);
+
+    if(length > REQUEST_FORMAT_SIZE - 1){
+        length = REQUEST_FORMAT_SIZE - 1;
+    }
 
-    memset(previousTempMessage, 0, PREVIOUS_MESSAGE_SIZE);
-    memcpy(previousTempMessage, message, messageLength < PREVIOUS_MESSAGE_SIZE ? messageLength : PREVIOUS_MESSAGE_SIZE);
+    if(length > 0){
+        network_write(requestFormatBuffer, length);
+    }
+}
 
-    int actual_body_size = 0;
+// Generate the body without sending it to find its length for the Content-Length header,
+// so it never has to be held in memory
+long network_measure_request(RequestBodyCallback bodyCall){
+    requestWriteMode = REQUEST_WRITE_MEASURE;
+    requestLength = 0;
+    bodyCall();
 
-    memset(api_body_buffer, 0, API_BODY_SIZE_BUFFER);
+    return requestLength;
+}
 
-    if(strlen(previousMessage) > 0 && strlen(previousGPTReply) > 0){
-        actual_body_size = snprintf(api_body_buffer, API_BODY_SIZE_BUFFER, CHATGPT_API_BODY_SUBSEQUENT, model, previousMessage, previousGPTReply, message, temperature);
-    } else {
-        actual_body_size = snprintf(api_body_buffer, API_BODY_SIZE_BUFFER, CHATGPT_API_BODY_INITIAL, model, message, temperature);
+// Get ready to send the request on the open socket and receive the reply
+void network_send_begin(){
+    memset(receiveBuffer, 0, receiveBufferSize);
+    http_response_init(&httpResponse);
+
+    requestBytesQueued = 0;
+    requestWriteFailed = false;
+    requestXmitBuf = NULL;
+    requestWriteStartTime = TIMER_GET_CURRENT();
+    latency_enter(LATENCY_SEND);
+
+    requestState = REQUEST_STATE_SENDING;
+}
+
+// Write as much of the request as the outgoing queue takes. The request is generated again
+// from the start on every pass and the part already queued is skipped.
+// Returns true once all of it has been queued
+bool network_write_pass(){
+    requestWriteMode = REQUEST_WRITE_SEND;
+    requestLength = 0;
+    requestWriteBlocked = false;
+
+    requestHeaderCall(requestContentLength);
+    requestBodyCall();
+
+    if(requestWriteBlocked){
+        return false;
     }
 
-    memset(sendRecvBuffer, 0, SEND_RECEIVE_BUFFER);
-    snprintf(sendRecvBuffer, SEND_RECEIVE_BUFFER, CHATGPT_API_CHAT_COMPLETION, api_key, actual_body_size, api_body_buffer);
-    //puts(sendRecvBuffer);
+    network_write_flush();
+    return true;
+}
 
-    int actualRequestBufferLength = strlen(sendRecvBuffer);
-    bool status = network_send_receive(hostname, port, sendRecvBuffer, actualRequestBufferLength, sendRecvBuffer, SEND_RECEIVE_BUFFER, &output->outPort);
+// True if the request cannot be sent any more
+bool network_write_stalled(){
+    return requestWriteFailed || CtrlBreakDetected || mySocket->isClosed() || Timer_diff(requestWriteStartTime, TIMER_GET_CURRENT()) > TIMER_MS_TO_TICKS(network_socketResponseTimeout);
+}
 
-    output->error = COMPLETION_OUTPUT_ERROR_OK;
-    output->rawData = sendRecvBuffer;
+// Get ready to receive the reply once the server has acknowledged the whole request
+void network_receive_begin(){
+    receiveBytesSoFar = 0;
+    receivedFirstByte = false;
+    receiveCallbackComplete = false;
 
-    if(status){
-        //puts(sendRecvBuffer);
+    requestStateStartTime = TIMER_GET_CURRENT();
+    receiveLastFrameTime = requestStateStartTime;
+    latency_enter(LATENCY_FIRST_BYTE);
 
-        //Find if contains error
-        char * errorPtr = strstr(sendRecvBuffer, "\"error\": {");
+    requestState = REQUEST_STATE_RECEIVING;
+}
 
-        if(errorPtr){
-            //fprintf(stderr, "Found error\n");
-            char * errorMsgKeyPtr = strstr(sendRecvBuffer, "\"message\": \"");
+// Receive what has arrived of the reply
+// Returns one of the NETWORK_EXCHANGE_X
+int network_receive_step(){
 
-            if(errorMsgKeyPtr != NULL){
+    if(mySocket->isClosed()){
+        return receivedFirstByte ? NETWORK_EXCHANGE_OK : NETWORK_EXCHANGE_NO_REPLY;
+    }
 
-                //Advance to start of message
-                char * messageStartPointer = errorMsgKeyPtr + 12;
+    char * pointerToReceiveAt = receiveBuffer + receiveBytesSoFar;
 
-                //Locate message termination
-                char * messageEndPointer = strstr(messageStartPointer, "\",");
+    // Leave space for the null terminator as the reply is parsed as a string
+    int bytesAbleToReceive = receiveBufferSize - receiveBytesSoFar - 1;
 
-                if(messageEndPointer != NULL){
-                    int length = messageEndPointer - messageStartPointer;
-                    output->error = COMPLETION_OUTPUT_ERROR_CHATGPT;
-                    output->content = messageStartPointer;
-                    output->contentLength = length;
-                } else {
-                    output->error = COMPLETION_OUTPUT_ERROR_APP;
-                    output->content = "Error but no error_message ending found";
-                    output->contentLength = strlen(output->content);
-                }
-            } else {
-                output->error = COMPLETION_OUTPUT_ERROR_APP;
-                output->content = "Error but no error_message ending found";
-                output->contentLength = strlen(output->content);
-            }
+    // Headers or a line of the body fill the whole buffer and cannot be taken out of it,
+    // nothing more would ever be received
+    if(bytesAbleToReceive <= 0){
+        return NETWORK_EXCHANGE_TOO_LARGE;
+    }
 
-        } else {
-            //Search for prompt_tokens key
-            char * prompt_token_ptr = strstr(sendRecvBuffer, "\"prompt_tokens\":");
+    int bytesReceivedThisInstant = mySocket->recv((unsigned char *) pointerToReceiveAt, bytesAbleToReceive);
 
-            if(prompt_token_ptr){
-                //Jump to number position
-                output->prompt_tokens = strtol(prompt_token_ptr + 16, NULL, 10);
-            }
+    if(bytesReceivedThisInstant > 0){
+        receiveBytesSoFar += bytesReceivedThisInstant;
 
-            char * completion_token_ptr = strstr(sendRecvBuffer, "\"completion_tokens\":");
+        if(!receivedFirstByte){
+            latency_enter(LATENCY_RECEIVE);
+        }
 
-            if(completion_token_ptr){
-                //Jump to number position
-                output->completion_tokens = strtol(completion_token_ptr + 20, NULL, 10);
-            }
+        receivedFirstByte = true;
+        receiveLastFrameTime = TIMER_GET_CURRENT();
 
-            char * content_ptr = strstr(sendRecvBuffer, "\"content\":");
+        int previousStage = latency_enter(LATENCY_PARSE);
 
-            if(content_ptr){
-                //Advance to start of content
-                char * contentStartPointer = content_ptr + 12;
+        // Strips the chunked encoding and tells us when the body is complete
+        bool complete = http_response_feed(&httpResponse, receiveBuffer, &receiveBytesSoFar);
 
-                //Locate message termination
-                char * contentEndPointer = strstr(contentStartPointer, "\",");
+        if(requestReceiveCall != NULL && httpResponse.state != HTTP_STATE_HEADERS){
+            char * body = http_response_body(&httpResponse, receiveBuffer);
+            int bodyLengthBefore = httpResponse.bodyLength;
 
-                if(contentEndPointer != NULL){
-                    output->content = contentStartPointer;
-                    output->contentLength = contentEndPointer - contentStartPointer;
-                } else {
-                    output->error = COMPLETION_OUTPUT_ERROR_APP;
-                    output->content = "Cannot find end of content";
-                    output->contentLength = strlen(output->content);
-                }
-            } else {
-                output->error = COMPLETION_OUTPUT_ERROR_APP;
-                output->content = "Cannot find content";
-                output->contentLength = strlen(output->content);
+            if(!receiveCallbackComplete && requestReceiveCall(body, &httpResponse.bodyLength)){
+                receiveCallbackComplete = true;
             }
+
+            // Callback may have consumed some of the body, move the undecoded bytes up to follow it
+            int bytesConsumed = bodyLengthBefore - httpResponse.bodyLength;
+            if(bytesConsumed > 0){
+                int rawRemaining = receiveBytesSoFar - httpResponse.rawPos;
+                memmove(body + httpResponse.bodyLength, receiveBuffer + httpResponse.rawPos, rawRemaining);
+
+                httpResponse.rawPos -= bytesConsumed;
+                receiveBytesSoFar -= bytesConsumed;
+                memset(receiveBuffer + receiveBytesSoFar, 0, bytesConsumed);
+            }
+        }
+
+        latency_enter(previousStage);
+
+        // No need to wait for the rest of the body if the callback knows the reply has ended.
+        // A connection that is kept alive must still be read to the end of the body.
+        if(complete || (receiveCallbackComplete && !network_keepAlive)){
+            return NETWORK_EXCHANGE_OK;
         }
+    } else if(mySocket->isRemoteClosed() && !mySocket->recvDataWaiting()){
+        // Server has closed the connection and there is nothing left to read
+        http_response_remote_closed(&httpResponse);
+        return receivedFirstByte ? NETWORK_EXCHANGE_OK : NETWORK_EXCHANGE_NO_REPLY;
     } else {
-        output->error = COMPLETION_OUTPUT_ERROR_APP;
-        output->content = "Cannot connect to socket or response timeout";
-        output->contentLength = strlen(output->content);
+        if(idleF != NULL){
+            clockTicks_t idleStartTime = TIMER_GET_CURRENT();
+            idleF();
+
+            // Time spent in the callback does not count towards the timeouts
+            clockTicks_t idleTime = Timer_diff(idleStartTime, TIMER_GET_CURRENT());
+            requestStateStartTime += idleTime;
+            receiveLastFrameTime += idleTime;
+        }
+
+        // Without any framing we can only assume the end of message once we no longer get any bytes
+        if(receivedFirstByte && httpResponse.state == HTTP_STATE_BODY_UNTIL_CLOSE){
+            // Short timeout after we no longer receive any bytes
+            if(Timer_diff(receiveLastFrameTime, TIMER_GET_CURRENT()) > TIMER_MS_TO_TICKS(TIME_TO_WAIT_AFTER_LAST_FRAME)) {
+                // We don't break immediately as we might just have temporarily 0 bytes
+                return NETWORK_EXCHANGE_OK;
+            }
+        }
     }
 
-    if(output->error == COMPLETION_OUTPUT_ERROR_OK){
-        //All is good, we keep the messages
+    // Timeout after no reply for some time
+    if(Timer_diff(requestStateStartTime, TIMER_GET_CURRENT()) > TIMER_MS_TO_TICKS(network_socketResponseTimeout) ) {
+        return NETWORK_EXCHANGE_FAILED;
+    }
+
+    return NETWORK_EXCHANGE_BUSY;
+}
+
+// Finish the request with one of the NETWORK_EXCHANGE_X
+void network_exchange_end(int result){
 
-        memset(previousMessage, 0, PREVIOUS_MESSAGE_SIZE);
-        memset(previousGPTReply, 0, PREVIOUS_GPT_REPLY_SIZE);
+    // Server closed the kept-alive connection before replying, try again once with a new connection
+    if(result == NETWORK_EXCHANGE_NO_REPLY && requestReusingConnection){
+        requestReusingConnection = false;
 
-        memcpy(previousMessage, message, messageLength < PREVIOUS_MESSAGE_SIZE ? messageLength : PREVIOUS_MESSAGE_SIZE);
-        memcpy(previousGPTReply, output->content, output->contentLength < PREVIOUS_GPT_REPLY_SIZE ? output->contentLength : PREVIOUS_GPT_REPLY_SIZE);
+        if(network_connect_start()){
+            return;
+        }
+
+        result = NETWORK_EXCHANGE_FAILED;
     }
 
-    // if(output->error == 1){
-    //     puts(puts(sendRecvBuffer););
-    // }
-    
-    return status;
+    // Only keep the connection if the server agrees and the reply ended cleanly
+    if(!network_keepAlive || result != NETWORK_EXCHANGE_OK || httpResponse.connectionClose || httpResponse.state != HTTP_STATE_COMPLETE){
+        network_closeCurrentSocket();
+    }
+
+    requestResult = result;
+    requestState = REQUEST_STATE_DONE;
 }
 
-bool network_get_huggingface_conversation(char * hostname, int port, char * api_key, char * model, char * message, float temperature, COMPLETION_OUTPUT * output){
-    
-    int messageLength = strlen(message);
+// Start sending a request, reusing a kept-alive connection if it is still open
+// to_receive: Receive buffer
+// to_receive_size: Size of to_receive
+// outgoingPort: outgoing port to use
+// receiveCall: Called after every receive to process data early. NULL to wait for end of reply.
+void network_request_begin(int port, RequestHeaderCallback headerCall, RequestBodyCallback bodyCall, char * to_receive, int to_receive_size, uint16_t * outgoingPort, ReceiveCallback receiveCall){
+
+    requestPort = port;
+    requestHeaderCall = headerCall;
+    requestBodyCall = bodyCall;
+    requestReceiveCall = receiveCall;
+    requestOutgoingPort = outgoingPort;
+    requestCancelled = false;
+
+    receiveBuffer = to_receive;
+    receiveBufferSize = to_receive_size;
+
+    requestReusingConnection = network_keepAlive && network_isConnectionOpen();
+    requestContentLength = -1;
+
+    if(requestReusingConnection){
+        // Discard anything left over from the previous reply
+        mySocket->flushRecv();
+        *outgoingPort = mySocket->srcPort;
+
+        requestContentLength = network_measure_request(bodyCall);
+        network_send_begin();
+    } else if(!network_connect_start()){
+        network_exchange_end(NETWORK_EXCHANGE_FAILED);
+    }
+}
 
-    memset(previousTempMessage, 0, PREVIOUS_MESSAGE_SIZE);
-    memcpy(previousTempMessage, message, messageLength < PREVIOUS_MESSAGE_SIZE ? messageLength : PREVIOUS_MESSAGE_SIZE);
+bool network_request_poll(){
 
-    int actual_body_size = 0;
+    network_drivePackets();
 
-    memset(api_body_buffer, 0, API_BODY_SIZE_BUFFER);
+    if(requestState == REQUEST_STATE_IDLE || requestState == REQUEST_STATE_DONE){
+        return false;
+    }
 
-    if(strlen(previousMessage) > 0 && strlen(previousGPTReply) > 0){
-        actual_body_size = snprintf(api_body_buffer, API_BODY_SIZE_BUFFER, HF_API_BODY_SUBSEQUENT, previousMessage, previousGPTReply, message, temperature);
-    } else {
-        actual_body_size = snprintf(api_body_buffer, API_BODY_SIZE_BUFFER, HF_API_BODY_INITIAL, message, temperature);
+    // Ctrl-Break only stops the request, the app carries on
+    if(CtrlBreakDetected){
+        CtrlBreakDetected = 0;
+        network_request_cancel();
+        return false;
     }
 
-    memset(sendRecvBuffer, 0, SEND_RECEIVE_BUFFER);
-    snprintf(sendRecvBuffer, SEND_RECEIVE_BUFFER, HF_API_CHAT_COMPLETION, model, api_key, actual_body_size, api_body_buffer);
-    //puts(sendRecvBuffer);
+    switch(requestState){
+        case REQUEST_STATE_RESOLVING:
+            if(Dns::isQueryPending()){
+                break;
+            }
 
-    int actualRequestBufferLength = strlen(sendRecvBuffer);
-    bool status = network_send_receive(hostname, port, sendRecvBuffer, actualRequestBufferLength, sendRecvBuffer, SEND_RECEIVE_BUFFER, &output->outPort);
+            if(Dns::resolve(requestHostname, requestServerAddr, 0) != 0){
+                fprintf( stderr, "Error resolving server\n" );
+                network_exchange_end(NETWORK_EXCHANGE_FAILED);
+                break;
+            }
 
-    output->error = COMPLETION_OUTPUT_ERROR_OK;
-    output->rawData = sendRecvBuffer;
+            if(!network_connect_open()){
+                network_exchange_end(NETWORK_EXCHANGE_FAILED);
+                break;
+            }
 
-    if(status){
-        //puts(recvBuffer);
+            // Measure the body while the handshake is in flight
+            if(requestContentLength < 0){
+                requestContentLength = network_measure_request(requestBodyCall);
+            }
+            break;
 
-        //Find if contains error
-        char * errorPtr = strstr(sendRecvBuffer, "\"error\":");
+        case REQUEST_STATE_CONNECTING:
+            if(requestArpPending && network_next_hop_known()){
+                requestArpPending = false;
+                latency_enter(LATENCY_CONNECT);
+            }
 
-        if(errorPtr){
+            if(mySocket->isConnectComplete()){
+                network_send_begin();
+            } else if(mySocket->isClosed() || Timer_diff(requestStateStartTime, TIMER_GET_CURRENT()) > TIMER_MS_TO_TICKS(network_socketConnectTimeout)){
+                network_exchange_end(NETWORK_EXCHANGE_FAILED);
+            }
+            break;
 
-            //Advance to start of message
-            char * messageStartPointer = errorPtr + 9;
+        case REQUEST_STATE_SENDING:
+            // A kept-alive connection may have been closed by the server while idle
+            if(requestBytesQueued == 0 && mySocket->isRemoteClosed()){
+                network_exchange_end(NETWORK_EXCHANGE_NO_REPLY);
+                break;
+            }
 
-            //Locate message termination
-            char * messageEndPointer = strstr(messageStartPointer, "\"}");
+            // Nothing can be written until the ACKs free up space
+            if(!mySocket->outgoingQueueIsFull() && network_write_pass()){
+                requestState = REQUEST_STATE_WAIT_ACKED;
+            }
 
-            if(messageEndPointer != NULL){
-                int length = messageEndPointer - messageStartPointer;
-                output->error = COMPLETION_OUTPUT_ERROR_CHATGPT;
-                output->content = messageStartPointer;
-                output->contentLength = length;
-            } else {
-                output->error = COMPLETION_OUTPUT_ERROR_APP;
-                output->content = "Error but no error_message ending found";
-                output->contentLength = strlen(output->content);
+            if(network_write_stalled()){
+                fprintf(stderr, "Did not send the request\n");
+                network_exchange_end(NETWORK_EXCHANGE_FAILED);
             }
-   
-
-        } else {
-            //Go to last occurence of [/INST] as after that is the start of the latest reply
-            char * content_ptr = network_strrstr(sendRecvBuffer, "[/INST]");
-
-            if(content_ptr){
-                //Advance to start of generated_text
-                char * contentStartPointer = content_ptr + 7;
-
-                //Locate message termination
-                char * contentEndPointer = strstr(contentStartPointer, "\"}");
-
-                if(contentEndPointer != NULL){
-                    output->content = contentStartPointer;
-                    output->contentLength = contentEndPointer - contentStartPointer;
-                } else {
-                    output->error = COMPLETION_OUTPUT_ERROR_APP;
-                    output->content = "Cannot find end of generated_text";
-                    output->contentLength = strlen(output->content);
-                }
-            } else {
-                output->error = COMPLETION_OUTPUT_ERROR_APP;
-                output->content = "Cannot find generated_text";
-                output->contentLength = strlen(output->content);
+            break;
+
+        case REQUEST_STATE_WAIT_ACKED:
+            // Server has acknowledged everything that was sent
+            if(mySocket->outgoing.entries == 0 && mySocket->sent.entries == 0){
+                network_receive_begin();
+            } else if(network_write_stalled()){
+                fprintf(stderr, "Did not send the request\n");
+                network_exchange_end(NETWORK_EXCHANGE_FAILED);
+            }
+            break;
+
+        case REQUEST_STATE_RECEIVING: {
+            int result = network_receive_step();
+
+            if(result != NETWORK_EXCHANGE_BUSY){
+                network_exchange_end(result);
             }
+            break;
         }
-    } else {
-        output->error = COMPLETION_OUTPUT_ERROR_APP;
-        output->content = "Cannot connect to socket or response timeout";
-        output->contentLength = strlen(output->content);
     }
 
-    if(output->error == COMPLETION_OUTPUT_ERROR_OK){
-        //All is good, we keep the messages
+    return requestState != REQUEST_STATE_DONE;
+}
 
-        memset(previousMessage, 0, PREVIOUS_MESSAGE_SIZE);
-        memset(previousGPTReply, 0, PREVIOUS_GPT_REPLY_SIZE);
+void network_request_cancel(){
 
-        memcpy(previousMessage, message, messageLength < PREVIOUS_MESSAGE_SIZE ? messageLength : PREVIOUS_MESSAGE_SIZE);
-        memcpy(previousGPTReply, output->content, output->contentLength < PREVIOUS_GPT_REPLY_SIZE ? output->contentLength : PREVIOUS_GPT_REPLY_SIZE);
+    if(requestState == REQUEST_STATE_DONE || requestState == REQUEST_STATE_IDLE){
+        return;
     }
 
-    // if(output->error == 1){
-    //     puts(recvBuffer);
-    // }
-    
-    return status;
+    // Whatever is still queued or arriving is of no use. Closing does not wait for the server.
+    network_closeCurrentSocket();
+
+    requestCancelled = true;
+    requestResult = NETWORK_EXCHANGE_FAILED;
+    requestState = REQUEST_STATE_DONE;
 }
 
-bool network_get_ollama_conversation(char * hostname, int port, char * model, char * message, float temperature, COMPLETION_OUTPUT * output){
-    int messageLength = strlen(message);
+// Append to a buffer, dropping whatever does not fit
+void network_append(char * buffer, int * bufferLength, int bufferSize, char * data, int length){
+    int spaceLeft = bufferSize - 1 - *bufferLength;
+    int lengthToKeep = length < spaceLeft ? length : spaceLeft;
 
-    memset(previousTempMessage, 0, PREVIOUS_MESSAGE_SIZE);
-    memcpy(previousTempMessage, message, messageLength < PREVIOUS_MESSAGE_SIZE ? messageLength : PREVIOUS_MESSAGE_SIZE);
+    if(lengthToKeep > 0){
+        memcpy(buffer + *bufferLength, data, lengthToKeep);
+        *bufferLength += lengthToKeep;
+    }
+}
 
-    int actual_body_size = 0;
+// Keep the start of the reply text and pass all of it on to streamCallback
+void network_reply_content(char * content, int length){
+    network_append(replyContentBuffer, &replyContentLength, REPLY_CONTENT_SIZE, content, length);
 
-    memset(api_body_buffer, 0, API_BODY_SIZE_BUFFER);
+    if(streamCallback != NULL && length > 0){
+        streamCallback(content, length);
+    }
+}
 
-    if(strlen(previousMessage) > 0 && strlen(previousGPTReply) > 0){
-        actual_body_size = snprintf(api_body_buffer, API_BODY_SIZE_BUFFER, OL_API_BODY_SUBSEQUENT, model, previousMessage, previousGPTReply, message, temperature);
+// Match marker one character at a time, matched is how much of it has been seen so far.
+// Returns true once the whole marker has been seen
+bool network_match_marker(const char * marker, int markerLength, int * matched, char c){
+    if(c == marker[*matched]){
+        (*matched)++;
     } else {
-        actual_body_size = snprintf(api_body_buffer, API_BODY_SIZE_BUFFER, OL_API_BODY_INITIAL, model, message, temperature);
+        *matched = c == marker[0] ? 1 : 0;
     }
 
-    memset(sendRecvBuffer, 0, SEND_RECEIVE_BUFFER);
-    snprintf(sendRecvBuffer, SEND_RECEIVE_BUFFER, OL_API_CHAT_COMPLETION, hostname, actual_body_size, api_body_buffer);
-    //puts(sendRecvBuffer);
+    if(*matched == markerLength){
+        *matched = 0;
+        return true;
+    }
 
-    int actualRequestBufferLength = strlen(sendRecvBuffer);
-    bool status = network_send_receive(hostname, port, sendRecvBuffer, actualRequestBufferLength, sendRecvBuffer, SEND_RECEIVE_BUFFER, &output->outPort);
+    return false;
+}
 
-    output->error = COMPLETION_OUTPUT_ERROR_OK;
-    output->rawData = sendRecvBuffer;
+// Hugging Face content, skipping a repeated prompt as it is scanned so only the reply is kept
+void network_hf_content(char * content, int length){
 
-    if(status){
-        //puts(sendRecvBuffer);
+    while(length > 0 && hfEchoState != HF_ECHO_DONE){
+        char c = *content++;
+        length--;
 
-        //Find if contains error
-        char * errorPtr = strstr(sendRecvBuffer, "\"error\":");
+        if(hfEchoState == HF_ECHO_CHECKING){
+            if(c == HF_INST_START_MARKER[hfEchoStartMatched]){
+                if(++hfEchoStartMatched == HF_INST_START_MARKER_LENGTH){
+                    hfEchoState = HF_ECHO_SKIPPING;
+                    hfEchoEndMatched = 0;
+                    hfEchoMarkersLeft = hfPromptMarkers;
+                }
+            } else {
+                // Only the reply was given, pass on what was held back while checking
+                hfEchoState = HF_ECHO_DONE;
+                network_reply_content((char *) HF_INST_START_MARKER, hfEchoStartMatched);
+                content--;
+                length++;
+            }
+        } else if(network_match_marker(HF_INST_END_MARKER, HF_INST_END_MARKER_LENGTH, &hfEchoEndMatched, c) && --hfEchoMarkersLeft == 0){
+            hfEchoState = HF_ECHO_DONE;
+        }
+    }
 
-        if(errorPtr){
-            //Advance to start of message
-            char * messageStartPointer = errorPtr + 9;
+    if(length > 0){
+        network_reply_content(content, length);
+    }
+}
 
-            //Locate message termination
-            char * messageEndPointer = strstr(messageStartPointer, "\"}");
+// ConvoWriteCallback counting the [/INST] markers in the Hugging Face prompt
+void network_count_prompt_markers(const char * data, int length){
+    for(int i = 0; i < length; i++){
+        if(network_match_marker(HF_INST_END_MARKER, HF_INST_END_MARKER_LENGTH, &hfEchoEndMatched, data[i])){
+            hfPromptMarkers++;
+        }
+    }
+}
 
-            if(messageEndPointer != NULL){
-                int length = messageEndPointer - messageStartPointer;
-                output->error = COMPLETION_OUTPUT_ERROR_CHATGPT;
-                output->content = messageStartPointer;
-                output->contentLength = length;
+// JsonValueCallback for the values listed in the REPLY_FIELDS tables
+void network_reply_value(int field, char * value, int length, bool final){
+    switch(field){
+        case REPLY_FIELD_CONTENT:
+            replyGotContent = true;
+
+            if(requestTrimInst){
+                network_hf_content(value, length);
             } else {
-                output->error = COMPLETION_OUTPUT_ERROR_APP;
-                output->content = "Error but no error_message ending found";
-                output->contentLength = strlen(output->content);
+                network_reply_content(value, length);
             }
-        
+            break;
 
-        } else {
-            //Search for prompt_tokens key
-            char * prompt_token_ptr = strstr(sendRecvBuffer, "\"prompt_eval_count\":");
+        case REPLY_FIELD_ERROR:
+        case REPLY_FIELD_ERROR_MESSAGE:
+            replyGotError = true;
+            network_append(replyErrorBuffer, &replyErrorLength, REPLY_ERROR_SIZE, value, length);
+            break;
 
-            if(prompt_token_ptr){
-                //Jump to number position
-                output->prompt_tokens = strtol(prompt_token_ptr + 20, NULL, 10);
-            }
+        case REPLY_FIELD_PROMPT_TOKENS:
+            replyOutput->prompt_tokens = strtol(value, NULL, 10);
+            break;
 
-            char * completion_token_ptr = strstr(sendRecvBuffer, "\"eval_count\":");
+        case REPLY_FIELD_COMPLETION_TOKENS:
+            replyOutput->completion_tokens = strtol(value, NULL, 10);
+            break;
 
-            if(completion_token_ptr){
-                //Jump to number position
-                output->completion_tokens = strtol(completion_token_ptr + 13, NULL, 10);
-            }
+        case REPLY_FIELD_DONE:
+            replyDone = strcmp(value, "true") == 0;
+            break;
+    }
+}
+
+// ReceiveCallback for complete replies. Scans the body as it arrives and leaves it in the buffer
+// for -drr, until it takes up half of the buffer. Then the scanned part is removed so a reply
+// of any length passes through.
+bool network_reply_receive(char * buffer, int * bytesInBuffer){
 
-            char * content_ptr = strstr(sendRecvBuffer, "\"content\":");
+    if(*bytesInBuffer > replyScanPos){
+        if(!json_feed(&replyScanner, buffer + replyScanPos, *bytesInBuffer - replyScanPos)){
+            replyMalformed = true;
+            return true;
+        }
+        replyScanPos = *bytesInBuffer;
+    }
 
-            if(content_ptr){
-                //Advance to start of content
-                char * contentStartPointer = content_ptr + 11;
+    if(*bytesInBuffer > RECEIVE_BUFFER_SIZE / 2){
+        *bytesInBuffer = 0;
+        replyScanPos = 0;
+    }
 
-                //Locate message termination
-                char * contentEndPointer = strstr(contentStartPointer, "\"}");
+    // Reply ends with the end of the JSON document
+    return replyScanner.documents > 0;
+}
 
-                if(contentEndPointer != NULL){
-                    output->content = contentStartPointer;
-                    output->contentLength = contentEndPointer - contentStartPointer;
-                } else {
-                    output->error = COMPLETION_OUTPUT_ERROR_APP;
-                    output->content = "Cannot find end of content";
-                    output->contentLength = strlen(output->content);
-                }
-            } else {
-                output->error = COMPLETION_OUTPUT_ERROR_APP;
-                output->content = "Cannot find content";
-                output->contentLength = strlen(output->content);
+// True for a Server-Sent Events line other than data, such as a ": keep-alive" comment or an
+// "event:", "id:" or "retry:" field. JSON never starts a line with a letter or ':'.
+bool network_sse_other_line(char * line){
+    return *line == ':' || (*line >= 'a' && *line <= 'z');
+}
+
+// ReceiveCallback for streaming mode. Scans every complete line of the body then removes it
+// from the buffer so the receive buffer does not fill up with per-token overhead.
+bool network_stream_receive(char * buffer, int * bytesInBuffer){
+
+    char * lineEnd;
+    int scanPos = 0;
+
+    while(!replyDone && !replyMalformed && (lineEnd = (char *) memchr(buffer + scanPos, '\n', *bytesInBuffer - scanPos)) != NULL){
+
+        char * jsonPtr = buffer + scanPos;
+        int lineLength = lineEnd - jsonPtr + 1;
+        int jsonLength = lineLength;
+
+        // ChatGPT sends Server-Sent Events, only the payload of "data:" lines is JSON.
+        // Ollama sends one JSON object per line, as does an error body which may also be pretty-printed.
+        if(strncmp(jsonPtr, SSE_DATA_PREFIX, SSE_DATA_PREFIX_LENGTH) == 0){
+            jsonPtr += SSE_DATA_PREFIX_LENGTH;
+            jsonLength -= SSE_DATA_PREFIX_LENGTH;
+
+            // The space after the field name is optional
+            if(*jsonPtr == ' '){
+                jsonPtr++;
+                jsonLength--;
+            }
+
+            if(strncmp(jsonPtr, SSE_DONE_MARKER, SSE_DONE_MARKER_LENGTH) == 0){
+                replyDone = true;
             }
+        } else if(network_sse_other_line(jsonPtr)){
+            jsonLength = 0;
         }
-    } else {
+
+        // A string value never spans lines so each content piece is complete for streamCallback
+        if(!replyDone && jsonLength > 0 && !json_feed(&replyScanner, jsonPtr, jsonLength)){
+            replyMalformed = true;
+        }
+
+        scanPos += lineLength;
+    }
+
+    // Remove the lines that have been scanned
+    if(scanPos > 0){
+        memmove(buffer, buffer + scanPos, *bytesInBuffer - scanPos);
+        *bytesInBuffer -= scanPos;
+
+        // Clear out the bytes that have been moved forward
+        memset(buffer + *bytesInBuffer, 0, scanPos);
+    }
+
+    return replyDone || replyMalformed;
+}
+
+// Reset reply state before a new request
+// fields: One of the REPLY_FIELDS tables
+void network_reply_start(const char ** fields, StreamCallback streamCall, COMPLETION_OUTPUT * output){
+    json_init(&replyScanner, fields, REPLY_FIELD_COUNT, network_reply_value);
+
+    streamCallback = streamCall;
+    replyOutput = output;
+    replyScanPos = 0;
+    replyDone = false;
+    replyGotContent = false;
+    replyGotError = false;
+    replyMalformed = false;
+
+    replyContentLength = 0;
+    memset(replyContentBuffer, 0, REPLY_CONTENT_SIZE);
+
+    replyErrorLength = 0;
+    memset(replyErrorBuffer, 0, REPLY_ERROR_SIZE);
+}
+
+// Fill in output from what has been scanned
+// status: True if the reply was received
+void network_reply_finish(bool status, COMPLETION_OUTPUT * output){
+
+    output->error = COMPLETION_OUTPUT_ERROR_OK;
+    output->rawData = recvBuffer;
+
+    // A streamed reply already passed to streamCall is kept even if the connection failed later on
+    bool streamed = requestStream && (replyGotContent || replyDone);
+
+    if(requestCancelled){
+        output->error = COMPLETION_OUTPUT_ERROR_APP;
+        output->content = "Request cancelled";
+        output->contentLength = strlen(output->content);
+    } else if(replyGotError){
+        output->error = COMPLETION_OUTPUT_ERROR_CHATGPT;
+        output->content = replyErrorBuffer;
+        output->contentLength = replyErrorLength;
+    } else if(replyMalformed){
+        output->error = COMPLETION_OUTPUT_ERROR_APP;
+        output->content = "Cannot parse reply";
+        output->contentLength = strlen(output->content);
+    } else if(requestResult == NETWORK_EXCHANGE_TOO_LARGE){
+        output->error = COMPLETION_OUTPUT_ERROR_APP;
+        output->content = "Reply too large for the receive buffer";
+        output->contentLength = strlen(output->content);
+    } else if(!status && !streamed){
         output->error = COMPLETION_OUTPUT_ERROR_APP;
         output->content = "Cannot connect to socket or response timeout";
         output->contentLength = strlen(output->content);
+    } else if(!replyGotContent && !replyDone){
+        output->error = COMPLETION_OUTPUT_ERROR_APP;
+        output->content = "Cannot find content";
+        output->contentLength = strlen(output->content);
+    } else if(requestTrimInst && hfEchoState == HF_ECHO_SKIPPING){
+        output->error = COMPLETION_OUTPUT_ERROR_APP;
+        output->content = "Cannot find the reply after the repeated prompt";
+        output->contentLength = strlen(output->content);
+    } else {
+        // A reply cut off at the end of the buffer may stop inside an escape sequence, which
+        // would leave the history and the next request as invalid JSON
+        replyContentLength = convo_escaped_length(replyContentBuffer, replyContentLength, replyContentLength);
+        replyContentBuffer[replyContentLength] = '\0';
+
+        output->content = replyContentBuffer;
+        output->contentLength = replyContentLength;
     }
+}
 
+// Keep the message and reply for the next request once the reply is good
+void network_remember_conversation(char * message, int messageLength, COMPLETION_OUTPUT * output){
     if(output->error == COMPLETION_OUTPUT_ERROR_OK){
-        //All is good, we keep the messages
+        convo_add_turn(message, messageLength, output->content, output->contentLength);
+    }
+}
+
+// Keep the parameters of the request for the request callbacks
+void network_request_start(char * hostname, char * api_key, char * model, char * message, float temperature, bool stream){
+    requestHostname = hostname;
+    requestApiKey = api_key;
+    requestModel = model;
+    requestMessage = message;
+    requestMessageLength = strlen(message);
+    requestTemperature = temperature;
+    requestStream = stream;
+    requestTrimInst = false;
+
+    convo_fit_budget(requestMessageLength);
+}
 
-        memset(previousMessage, 0, PREVIOUS_MESSAGE_SIZE);
-        memset(previousGPTReply, 0, PREVIOUS_GPT_REPLY_SIZE);
+void network_write_chatgpt_header(long contentLength){
+    network_write_format(CHATGPT_API_CHAT_COMPLETION, requestApiKey, contentLength, network_connection_header());
+}
 
-        memcpy(previousMessage, message, messageLength < PREVIOUS_MESSAGE_SIZE ? messageLength : PREVIOUS_MESSAGE_SIZE);
-        memcpy(previousGPTReply, output->content, output->contentLength < PREVIOUS_GPT_REPLY_SIZE ? output->contentLength : PREVIOUS_GPT_REPLY_SIZE);
-    }
+void network_write_chatgpt_body(){
+    network_write_format(CHATGPT_API_BODY_START, requestModel);
+    convo_write_chat_messages(network_write);
+    network_write_str(API_BODY_USER_MESSAGE_START);
+    network_write_str(requestMessage);
+    network_write_format(CHATGPT_API_BODY_END, requestTemperature, requestStream ? CHATGPT_API_STREAM_OPTIONS : "");
+}
 
-    // if(output->error == 1){
-    //     puts(puts(sendRecvBuffer););
-    // }
-    
-    return status;
+void network_write_huggingface_header(long contentLength){
+    network_write_format(HF_API_CHAT_COMPLETION, requestModel, requestApiKey, contentLength, network_connection_header());
 }
 
-// Custom function to find the last occurrence of a substring
-char * network_strrstr(const char *haystack, const char *needle) {
-    char *last_occurrence = NULL;
-    char *current_occurrence = (char *)haystack;
+void network_write_huggingface_body(){
+    network_write_str(HF_API_BODY_START);
+    convo_write_inst_chain(network_write);
+    network_write_str(HF_API_BODY_MESSAGE_START);
+    network_write_str(requestMessage);
+    network_write_format(HF_API_BODY_END, requestTemperature);
+}
 
-    // If the needle is an empty string, return the haystack
-    if (*needle == '\0') {
-        return (char *)haystack;
-    }
+void network_write_ollama_header(long contentLength){
+    network_write_format(OL_API_CHAT_COMPLETION, requestHostname, contentLength, network_connection_header());
+}
 
-    // Search for occurrences of the needle
-    while ((current_occurrence = strstr(current_occurrence, needle)) != NULL) {
-        last_occurrence = current_occurrence;
-        current_occurrence++;  // Move past the current occurrence to continue searching
+void network_write_ollama_body(){
+    network_write_format(OL_API_BODY_START, requestModel);
+    convo_write_chat_messages(network_write);
+    network_write_str(API_BODY_USER_MESSAGE_START);
+    network_write_str(requestMessage);
+    network_write_format(OL_API_BODY_END, requestTemperature, requestStream ? "true" : "false");
+}
+
+void network_start_chatgpt_completion(char * hostname, int port, char * api_key, char * model, char * message, float temperature, COMPLETION_OUTPUT * output, bool stream, StreamCallback streamCall){
+    network_request_start(hostname, api_key, model, message, temperature, stream);
+    network_reply_start(stream ? CHATGPT_STREAM_REPLY_FIELDS : CHATGPT_REPLY_FIELDS, streamCall, output);
+
+    network_request_begin(port, network_write_chatgpt_header, network_write_chatgpt_body, recvBuffer, RECEIVE_BUFFER_SIZE, &output->outPort, stream ? network_stream_receive : network_reply_receive);
+}
+
+void network_start_huggingface_conversation(char * hostname, int port, char * api_key, char * model, char * message, float temperature, COMPLETION_OUTPUT * output, StreamCallback streamCall){
+    network_request_start(hostname, api_key, model, message, temperature, false);
+    network_reply_start(HF_REPLY_FIELDS, streamCall, output);
+    requestTrimInst = true;
+
+    // A repeated prompt has as many [/INST] as the prompt that is sent
+    hfPromptMarkers = 0;
+    hfEchoEndMatched = 0;
+    convo_write_inst_chain(network_count_prompt_markers);
+    network_count_prompt_markers(HF_INST_START_MARKER, HF_INST_START_MARKER_LENGTH);
+    network_count_prompt_markers(requestMessage, requestMessageLength);
+    network_count_prompt_markers(HF_INST_END_MARKER, HF_INST_END_MARKER_LENGTH);
+
+    hfEchoState = HF_ECHO_CHECKING;
+    hfEchoStartMatched = 0;
+
+    network_request_begin(port, network_write_huggingface_header, network_write_huggingface_body, recvBuffer, RECEIVE_BUFFER_SIZE, &output->outPort, network_reply_receive);
+}
+
+void network_start_ollama_conversation(char * hostname, int port, char * model, char * message, float temperature, COMPLETION_OUTPUT * output, bool stream, StreamCallback streamCall){
+    network_request_start(hostname, NULL, model, message, temperature, stream);
+    network_reply_start(OL_REPLY_FIELDS, streamCall, output);
+
+    network_request_begin(port, network_write_ollama_header, network_write_ollama_body, recvBuffer, RECEIVE_BUFFER_SIZE, &output->outPort, stream ? network_stream_receive : network_reply_receive);
+}
+
+bool network_request_finish(){
+    bool status = requestResult == NETWORK_EXCHANGE_OK;
+
+    // A reply too short to tell apart from a repeated prompt is still held back
+    if(requestTrimInst && hfEchoState == HF_ECHO_CHECKING){
+        hfEchoState = HF_ECHO_DONE;
+        network_reply_content((char *) HF_INST_START_MARKER, hfEchoStartMatched);
     }
 
-    return last_occurrence;
-}
\ No newline at end of file
+    network_reply_finish(status, replyOutput);
+    network_remember_conversation(requestMessage, requestMessageLength, replyOutput);
+
+    requestState = REQUEST_STATE_IDLE;
+    return status;
+}
@@ -6,7 +6,7 @@
 #define COMPLETION_OUTPUT_ERROR_APP 2
 
 
-// Structure to return after calling network_get_completion
+// Structure filled in by network_request_finish()
 typedef struct
 {
     // One the COMPLETION_OUTPUT_ERROR_X
@@ -16,7 +16,8 @@ typedef struct
     int completion_tokens;
     int prompt_tokens;
 
-    // The parsed text comepletion
+    // The parsed text comepletion. Only the start of a reply longer than the content buffer is kept,
+    // use the StreamCallback for all of it.
     char * content;
 
     // Length of text completion
@@ -25,26 +26,49 @@ typedef struct
     // Outgoing port used in the current request
     uint16_t outPort;
 
-    // Raw Header and JSON reply for debug use
+    // Raw Header and JSON reply for debug use. Only the end of a long reply is kept.
     char * rawData;
     
 } COMPLETION_OUTPUT;
 
 
-//Callback for network_init() on Break
+//Callback for network_init() on Break while no request is in progress
 typedef void (*EndCallback)(void);
 
+// Callback for network_init() while waiting for the reply with nothing received.
+// May take a while, the time spent is not counted towards the response timeout.
+typedef void (*IdleCallback)(void);
+
+// Callback for each piece of reply text as it arrives, whether the reply is streamed or not
+// delta: JSON-escaped content fragment (not null-terminated)
+// length: Size of delta
+typedef void (*StreamCallback)(char * delta, int length);
+
+// Callback for the request after every receive
+// buffer: Receive buffer
+// bytesInBuffer: Bytes currently in buffer. Callback may consume bytes and reduce this.
+// Return true once the complete reply has been received
+typedef bool (*ReceiveCallback)(char * buffer, int * bytesInBuffer);
+
+// Callback for the request to write the header with network_write()
+// contentLength: Length of the body that follows
+typedef void (*RequestHeaderCallback)(long contentLength);
+
+// Callback for the request to write the request body with network_write().
+// Called first to measure the body then again each time more of it can be sent, so it must write the same data every time.
+typedef void (*RequestBodyCallback)(void);
+
 // Init MTCP network stack and setup other variables
-bool network_init(uint16_t startPort, uint16_t endPort, EndCallback endCall, uint16_t socketConnectTimeout, uint16_t socketResponseTimeout);
+// idleCall: Called while waiting for the reply, NULL if not needed
+// keepAlive: Keep the connection to the proxy open across requests
+bool network_init(uint16_t startPort, uint16_t endPort, EndCallback endCall, IdleCallback idleCall, uint16_t socketConnectTimeout, uint16_t socketResponseTimeout, bool keepAlive);
 
 // Stop MTCP network before shutting down
 void network_stop();
 
-// Open a socket to the proxy server. Socket number is stored internally
-// hostname: Hostname or IP address. MTCP will resolve the hostname to IP
-// port: Port number of proxy server to connect to
-// outgoingPort: outgoing port to use
-bool network_connectToSocket(char * hostname, int port, uint16_t * outgoingPort);
+// Most memory the TCP receive rings take while sockets are open. Nothing of it is allocated
+// until the first connection so it is not part of what network_init() used.
+uint32_t network_connection_memory();
 
 // Close currently open socket
 void network_closeCurrentSocket();
@@ -52,29 +76,39 @@ void network_closeCurrentSocket();
 // Call this regularly to process packets in the background
 void network_drivePackets();
 
-// Send a request and return the reply. Internally calls network_connectToSocket()
-// hostname: hostname of proxy
-// port: Proxy port
-// to_send: Raw data to send to server
-// to_send_size: Size of to_send
-// to_receive: Receive buffer
-// to_receive_size: Size of to_receive
-// outgoingPort: outgoing port to use
-bool network_send_receive(char * hostname, int port, char * to_send, int to_send_size, char * to_receive, int to_receive_size, uint16_t * outgoingPort);
-
-// Forms and makes API call to chat completion. Internally calls network_send_receive()
+// Write part of the request from a RequestHeaderCallback or RequestBodyCallback.
+// Data is copied straight into the outgoing packets.
+void network_write(const char * data, int length);
+
+// Forms the API call to chat completion and starts sending it without waiting for the reply.
+// Call network_request_poll() until it returns false, then network_request_finish().
+// Opens a connection to the proxy unless a kept-alive connection is still open.
 // hostname: hostname of proxy
 // port: Proxy port
 // api_key: API key
 // model: GPT model (See OpenAL dev page)
-// message: Message request to send (See OpenAL dev page)
+// message: Message request to send (See OpenAL dev page). Must stay unchanged until the request is finished.
 // temperature: randomness of reply (See OpenAL dev page)
-// output: struct containing parsed json output
-bool network_get_chatgpt_completion(char * hostname, int port, char * api_key, char * model, char * message, float temperature, COMPLETION_OUTPUT * output);
+// output: struct filled in with the parsed json output by network_request_finish()
+// stream: Ask for the reply to be sent as it is generated
+// streamCall: Receives every piece of reply text as it arrives, NULL if not needed
+void network_start_chatgpt_completion(char * hostname, int port, char * api_key, char * model, char * message, float temperature, COMPLETION_OUTPUT * output, bool stream, StreamCallback streamCall);
+
+// Same as network_start_chatgpt_completion() without streaming. A prompt the server repeats before
+// the reply is skipped, streamCall and output only get the reply.
+void network_start_huggingface_conversation(char * hostname, int port, char * api_key, char * model, char * message, float temperature, COMPLETION_OUTPUT * output, StreamCallback streamCall);
+
+void network_start_ollama_conversation(char * hostname, int port, char * model, char * message, float temperature, COMPLETION_OUTPUT * output, bool stream, StreamCallback streamCall);
 
-bool network_get_huggingface_conversation(char * hostname, int port, char * api_key, char * model, char * message, float temperature, COMPLETION_OUTPUT * output);
+// Advance the request by one step: resolving, connecting, sending or receiving.
+// Drives packets each time so it also replaces network_drivePackets() while a request is in progress.
+// Returns true while the request is still in progress
+bool network_request_poll();
 
-bool network_get_ollama_conversation(char * hostname, int port, char * model, char * message, float temperature, COMPLETION_OUTPUT * output);
+// Abandon the request in progress, also done on Ctrl-Break. The connection closes in the background
+// so this returns straight away. network_request_finish() then reports it as cancelled.
+void network_request_cancel();
 
-// Custom function to locate the last instance of needle in haystack
-char * network_strrstr(const char *haystack, const char *needle);
\ No newline at end of file
+// Fill in the output of the finished request and keep the turn in the conversation history if it succeeded.
+// Returns true if the reply was received
+bool network_request_finish();
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <string.h>
+#include <dos.h>
+#include <io.h>
+
+#include "types.h"
+#include "screen.h"
+
+// BIOS data area
+#define BIOS_DATA_SEG 0x40
+#define BIOS_VIDEO_MODE 0x49
+#define BIOS_PAGE_OFFSET 0x4E
+#define BIOS_CURSOR_POS 0x50
+#define BIOS_ACTIVE_PAGE 0x62
+#define BIOS_SCREEN_ROWS 0x84
+
+#define VIDEO_MODE_MONO 7
+#define VIDEO_MODE_TEXT_LAST 3
+#define VIDEO_SEG_COLOUR 0xB800
+#define VIDEO_SEG_MONO 0xB000
+
+// CGA and MDA do not store the row count in the BIOS data area
+#define SCREEN_ROWS_DEFAULT 25
+#define SCREEN_COLUMNS_DEFAULT 80
+
+#define SCREEN_ATTRIBUTE_DEFAULT 0x07
+
+bool screenDirect = false;
+bool screenConsole = false;
+
+uint8_t far * screenBase;
+int screenRows = SCREEN_ROWS_DEFAULT;
+int screenCols = SCREEN_COLUMNS_DEFAULT;
+
+// Attribute of new lines scrolled in at the bottom
+uint8_t screenAttribute = SCREEN_ATTRIBUTE_DEFAULT;
+
+//Reference https://www.equestionanswers.com/c/c-int86-dos-bios-system-interrupts.php
+int screen_bios_columns(){
+
+    union REGS input_regs, output_regs;
+
+    input_regs.h.ah = 0x0F;
+    int86(0x10, &input_regs, &output_regs);
+
+    return output_regs.h.ah;
+}
+
+void screen_set_cursor(int row, int col){
+
+    union REGS input_regs, output_regs;
+
+    input_regs.h.ah = 0x02;
+    input_regs.h.bh = 0;
+    input_regs.h.dh = row;
+    input_regs.h.dl = col;
+    int86(0x10, &input_regs, &output_regs);
+}
+
+void screen_init(){
+
+    screenCols = screen_bios_columns();
+
+    // Redirected output has to go through DOS to reach the file or device
+    screenConsole = isatty(fileno(stdout));
+
+    if(!screenConsole){
+        screenDirect = false;
+        return;
+    }
+
+    uint8_t mode = *((uint8_t far *) MK_FP(BIOS_DATA_SEG, BIOS_VIDEO_MODE));
+    uint8_t activePage = *((uint8_t far *) MK_FP(BIOS_DATA_SEG, BIOS_ACTIVE_PAGE));
+
+    // Graphics modes and other display pages are left to DOS
+    if((mode > VIDEO_MODE_TEXT_LAST && mode != VIDEO_MODE_MONO) || activePage != 0){
+        screenDirect = false;
+        return;
+    }
+
+    uint16_t pageOffset = *((uint16_t far *) MK_FP(BIOS_DATA_SEG, BIOS_PAGE_OFFSET));
+    screenBase = (uint8_t far *) MK_FP(mode == VIDEO_MODE_MONO ? VIDEO_SEG_MONO : VIDEO_SEG_COLOUR, pageOffset);
+
+    // Only EGA and later fill in the row count
+    uint8_t lastRow = *((uint8_t far *) MK_FP(BIOS_DATA_SEG, BIOS_SCREEN_ROWS));
+    screenRows = lastRow > 0 ? lastRow + 1 : SCREEN_ROWS_DEFAULT;
+
+    // Keep the colours of the cursor position at startup
+    uint8_t col = *((uint8_t far *) MK_FP(BIOS_DATA_SEG, BIOS_CURSOR_POS));
+    uint8_t row = *((uint8_t far *) MK_FP(BIOS_DATA_SEG, BIOS_CURSOR_POS + 1));
+    uint8_t attribute = screenBase[((row * screenCols) + col) * 2 + 1];
+
+    screenAttribute = attribute != 0 ? attribute : SCREEN_ATTRIBUTE_DEFAULT;
+    screenDirect = true;
+}
+
+int screen_columns(){
+    return screenCols;
+}
+
+// Move every line up by one and blank the bottom line
+void screen_scroll(){
+
+    uint16_t bytesPerRow = screenCols * 2;
+
+    _fmemmove(screenBase, screenBase + bytesPerRow, (screenRows - 1) * bytesPerRow);
+
+    uint16_t far * lastRow = (uint16_t far *) (screenBase + (screenRows - 1) * bytesPerRow);
+    uint16_t blank = (screenAttribute << 8) | ' ';
+
+    for(int i = 0; i < screenCols; i++){
+        lastRow[i] = blank;
+    }
+}
+
+void screen_write(const char * str, int length){
+
+    if(!screenDirect){
+        fwrite(str, sizeof(char), length, stdout);
+
+        // Text on the screen should show up straight away, a file can wait
+        if(screenConsole){
+            fflush(stdout);
+        }
+        return;
+    }
+
+    // Anything printed through DOS must appear first as it moves the cursor
+    fflush(stdout);
+
+    // The BIOS keeps the cursor position that DOS also uses
+    int col = *((uint8_t far *) MK_FP(BIOS_DATA_SEG, BIOS_CURSOR_POS));
+    int row = *((uint8_t far *) MK_FP(BIOS_DATA_SEG, BIOS_CURSOR_POS + 1));
+
+    uint8_t far * cell = screenBase + ((row * screenCols) + col) * 2;
+
+    for(int i = 0; i < length; i++){
+        char c = str[i];
+
+        if(c == '\r'){
+            col = 0;
+        } else if(c == '\n'){
+            col = 0;
+            row++;
+        } else {
+            // Only the character changes, like the BIOS teletype output
+            *cell = c;
+            cell += 2;
+
+            // The next cell in memory is already the start of the next line
+            if(++col < screenCols){
+                continue;
+            }
+
+            col = 0;
+            row++;
+        }
+
+        if(row >= screenRows){
+            screen_scroll();
+            row = screenRows - 1;
+        }
+
+        // Only a line break or scroll needs the position worked out again
+        cell = screenBase + ((row * screenCols) + col) * 2;
+    }
+
+    screen_set_cursor(row, col);
+}
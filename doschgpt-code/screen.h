@@ -0,0 +1,13 @@
+// Text output written straight into the video buffer at B800 (colour) or B000 (mono)
+// instead of going through DOS. Falls back to stdout when the output is redirected
+// or the screen is in a mode the video buffer cannot be used for.
+
+// Detect the video mode and screen size. Call once at startup.
+void screen_init();
+
+// Number of columns on the screen, read once by screen_init()
+int screen_columns();
+
+// Write text at the cursor, wrapping at the end of the line and scrolling at the bottom.
+// Handles '\n' and '\r', other characters are shown as their code page glyph.
+void screen_write(const char * str, int length);
@@ -1,53 +1,54 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <process.h>
+#include "sound.h"
 #include "speech.h"
+#include "memprof.h"
 
-#define READ_STR_FORMAT "read %.*s"
+#define SBTTS_LOADER "SBTALKER"
+#define SBTTS_LOADER_ARGS "/dBLASTER"
 #define READ_SIZE_BUFF 256
 
 #define MAX_TO_READ 250
 
-char phraseToRead[READ_SIZE_BUFF];
-
-int sbtts_run_command(char * command, bool redirectStdout){
+// Sentences shorter than this are spoken together with the next one
+#define MIN_TO_READ 40
 
-    if(redirectStdout){
-        // Send stdout to nul
-        freopen("nul", "r", stdout);
-    }
-    
-    int returnCode = system(command);
+#define TTS_QUEUE_SIZE MEM_TTS_QUEUE_SIZE
 
-    if(redirectStdout){
-        fflush(stdout);
+// A full queue must hold at least one phrase so speaking always makes space
+#if TTS_QUEUE_SIZE <= MAX_TO_READ
+#error MEM_TTS_QUEUE_SIZE must be larger than MAX_TO_READ
+#endif
 
-        //Restore the stdout
-        freopen("con", "a", stdout);
-    }
+char phraseToRead[READ_SIZE_BUFF];
 
-    return returnCode;
-    
-}
+bool sbtts_init(bool loadResident){
 
-bool sbtts_init(){
-    sbtts_run_command("SBTALKER /dBLASTER", false);
+    // Use the engine if it is already resident, such as from an earlier run with -sbtsr
+    if(!DetectSpeech()){
+        if(!loadResident){
+            return false;
+        }
 
-    if(DetectSpeech()){
-        ResetSpeech();
-        return true;
-    } else {
-        return false;
+        // Run directly without COMMAND.COM to save the time and memory of loading a shell.
+        // Smoothtalker stays resident after this app ends so later runs find it straight away.
+        if(spawnlp(P_WAIT, SBTTS_LOADER, SBTTS_LOADER, SBTTS_LOADER_ARGS, NULL) != 0 || !DetectSpeech()){
+            return false;
+        }
     }
+
+    ResetSpeech();
+    return true;
 }
  
 void sbtts_end(){
     ResetSpeech();
-    sbtts_run_command("REMOVE", false);
 }
 
-void sbtts_read_this_phrase(char * phrase, int length, bool redirectStdout){
-    //Clear buffer before starting every new phrase
+void sbtts_read_this_phrase(char * phrase, int length){
+    //Clear buffer once before every group of sentences
     ResetSpeech();
     //Set appropriate speed
     SetGlobals(0, 0, 5, 5, 3);
@@ -58,48 +59,145 @@ void sbtts_read_this_phrase(char * phrase, int length, bool redirectStdout){
     Say(phraseToRead);
 }
 
-void sbtts_read_str(char * str_to_read, int length, bool redirectStdout){
-
-    int currentStartPointer = 0;
-
-    if(length < MAX_TO_READ){
-        sbtts_read_this_phrase(str_to_read, length, redirectStdout); 
-    } else {
-        //Look for first break
-        for(int i = 0; i < length; i++){
-            char currentChar = str_to_read[i];
-            int currentLength = i - currentStartPointer;
-
-            if(currentLength > MAX_TO_READ){
-                //Since we reach the end before any punctuation, we should backtrack to find a space to avoid breaking up word.
-                int j;
-                for(j = i; i > currentStartPointer; j--){
-                    char candidateSpace = str_to_read[j];
-                    if(candidateSpace == ' '){
-                        break;
-                    }
-                }
-
-                i = j;
-
-                sbtts_read_this_phrase(str_to_read + currentStartPointer, i - currentStartPointer, redirectStdout);            
-                currentStartPointer = i;
-
-            } else {
-                // Split along the punctuation
-                if('!' <= currentChar && currentChar <= '/' 
-                || ':' <= currentChar && currentChar <= '@' 
-                || '[' <= currentChar && currentChar <= '`' 
-                || '{' <= currentChar && currentChar <= '~'){
-
-                    //printf("start %d length %d stop at %c\n", currentStartPointer, i - currentStartPointer, currentChar);
-                    sbtts_read_this_phrase(str_to_read + currentStartPointer, i - currentStartPointer, redirectStdout);            
-                    currentStartPointer = i;      
-                }
+// Text waiting to be spoken. ttsQueue[ttsHead] to ttsQueue[ttsTail] has not been spoken yet.
+char ttsQueue[TTS_QUEUE_SIZE];
+int ttsHead = 0;
+int ttsTail = 0;
+
+// No more text will follow so the last phrase can be spoken without its punctuation
+bool ttsQueueEnded = true;
+
+// Segmenter state so every character is only looked at once.
+// Positions are in ttsQueue, -1 if not found since ttsHead.
+int ttsScanPos = 0;
+int ttsSentenceEnd = -1;
+int ttsLastSpace = -1;
+
+bool sbtts_ends_sentence(char c){
+    return c == '.' || c == '!' || c == '?' || c == ':' || c == ';';
+}
+
+void sbtts_reset_segmenter(){
+    ttsScanPos = ttsHead;
+    ttsSentenceEnd = -1;
+    ttsLastSpace = -1;
+}
+
+// Move the unspoken text to the front to make space
+void sbtts_compact_queue(){
+    memmove(ttsQueue, ttsQueue + ttsHead, ttsTail - ttsHead);
+    ttsTail -= ttsHead;
+    ttsScanPos -= ttsHead;
+    ttsSentenceEnd = ttsSentenceEnd > ttsHead ? ttsSentenceEnd - ttsHead : -1;
+    ttsLastSpace = ttsLastSpace > ttsHead ? ttsLastSpace - ttsHead : -1;
+    ttsHead = 0;
+}
+
+void sbtts_queue_str(char * str, int length){
+    ttsQueueEnded = false;
+
+    while(length > 0){
+        if(ttsTail + length > TTS_QUEUE_SIZE && ttsHead > 0){
+            sbtts_compact_queue();
+        }
+
+        // A full queue always holds a whole phrase, speak it to make space for the rest
+        if(ttsTail == TTS_QUEUE_SIZE){
+            if(!sbtts_speak_next()){
+                return;
             }
+            continue;
+        }
+
+        int lengthToQueue = length < TTS_QUEUE_SIZE - ttsTail ? length : TTS_QUEUE_SIZE - ttsTail;
+
+        memcpy(ttsQueue + ttsTail, str, lengthToQueue);
+        ttsTail += lengthToQueue;
+        str += lengthToQueue;
+        length -= lengthToQueue;
+    }
+}
+
+void sbtts_queue_end(){
+    ttsQueueEnded = true;
+}
 
+void sbtts_stop(){
+    ttsHead = 0;
+    ttsTail = 0;
+    ttsQueueEnded = true;
+    sbtts_reset_segmenter();
+    ResetSpeech();
+}
+
+bool sbtts_pending(){
+    return ttsHead < ttsTail;
+}
+
+// Length of the next phrase to speak from the queue, 0 if it is not complete yet.
+// A phrase is one or more whole sentences up to MAX_TO_READ. A sentence ends at a newline or
+// at . ! ? : ; followed by a space so numbers, abbreviations and addresses are not split.
+// Text longer than MAX_TO_READ without a sentence end is split at the last space.
+int sbtts_next_phrase_length(){
+    int limit = ttsHead + MAX_TO_READ;
+
+    while(ttsScanPos < ttsTail && ttsScanPos < limit){
+        char currentChar = ttsQueue[ttsScanPos++];
+
+        if(currentChar != ' ' && currentChar != '\n'){
+            continue;
+        }
+
+        ttsLastSpace = ttsScanPos;
+
+        if(currentChar == '\n' || (ttsScanPos - ttsHead >= 2 && sbtts_ends_sentence(ttsQueue[ttsScanPos - 2]))){
+            ttsSentenceEnd = ttsScanPos;
+
+            if(ttsSentenceEnd - ttsHead >= MIN_TO_READ){
+                return ttsSentenceEnd - ttsHead;
+            }
         }
     }
 
+    if(ttsScanPos >= limit){
+        if(ttsSentenceEnd > ttsHead){
+            return ttsSentenceEnd - ttsHead;
+        }
+
+        // Avoid breaking up a word unless there is no space at all
+        if(ttsLastSpace > ttsHead){
+            return ttsLastSpace - ttsHead;
+        }
 
-}
\ No newline at end of file
+        return MAX_TO_READ;
+    }
+
+    return ttsQueueEnded ? ttsTail - ttsHead : 0;
+}
+
+bool sbtts_speak_next(){
+    int length = sbtts_next_phrase_length();
+
+    if(length == 0){
+        return false;
+    }
+
+    sbtts_read_this_phrase(ttsQueue + ttsHead, length);
+    ttsHead += length;
+
+    if(ttsHead == ttsTail){
+        ttsHead = 0;
+        ttsTail = 0;
+        sbtts_reset_segmenter();
+    }
+
+    return true;
+}
+
+void sbtts_read_str(char * str_to_read, int length){
+    sbtts_queue_str(str_to_read, length);
+    sbtts_queue_end();
+
+    while(sbtts_speak_next()){
+    }
+}
@@ -1,3 +1,24 @@
-bool sbtts_init();
+// Use the First Byte engine if it is resident. If it is not and loadResident, load Smoothtalker
+// and leave it resident for later runs. Returns false if the engine is not available
+bool sbtts_init(bool loadResident);
+
 void sbtts_end();
-void sbtts_read_str(char * str_to_read, int length, bool redirectStdout);
\ No newline at end of file
+// Speak the whole text before returning
+void sbtts_read_str(char * str_to_read, int length);
+
+// Add text to be spoken a phrase at a time by sbtts_speak_next(). If the queue is full,
+// phrases are spoken straight away to make space, so no text is dropped.
+void sbtts_queue_str(char * str, int length);
+
+// No more text follows for now, the last phrase may be spoken without ending punctuation
+void sbtts_queue_end();
+
+// Speak the next complete phrase in the queue. Blocks for as long as the phrase takes.
+// Returns false if there is no complete phrase to speak
+bool sbtts_speak_next();
+
+// Text is waiting to be spoken
+bool sbtts_pending();
+
+// Drop everything waiting to be spoken
+void sbtts_stop();
\ No newline at end of file
@@ -1,7 +1,11 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <time.h>
 #include <string.h>
-#include <dos.h>
+
+#include "screen.h"
+#include "memprof.h"
 
 #define TIMESTAMP_FORMAT "%Y-%m-%d %H:%M:%S"
 
@@ -11,6 +15,68 @@ char timestampStr[TIMESTAMP_SIZE];
 
 FILE *historyFile = NULL;
 
+// History is collected here and written to the file in large pieces, see io_flush_history()
+#define HISTORY_BUFFER_SIZE MEM_HISTORY_BUFFER_SIZE
+char * historyBuffer = NULL;
+int historyBufferUsed = 0;
+
+// Fits the longest formatted line written to history
+#define HISTORY_FORMAT_SIZE 128
+char historyFormatBuffer[HISTORY_FORMAT_SIZE];
+
+void io_flush_history(){
+    if(historyFile == NULL || historyBufferUsed == 0){
+        return;
+    }
+
+    fwrite(historyBuffer, sizeof(char), historyBufferUsed, historyFile);
+    fflush(historyFile);
+    historyBufferUsed = 0;
+}
+
+// Add text to the history, writing out the buffer only once it is full
+void io_history_write(const char * str, int length){
+    if(historyFile == NULL){
+        return;
+    }
+
+    if(historyBufferUsed + length > HISTORY_BUFFER_SIZE){
+        io_flush_history();
+    }
+
+    // Too large to buffer, write it straight out
+    if(length > HISTORY_BUFFER_SIZE){
+        fwrite(str, sizeof(char), length, historyFile);
+        return;
+    }
+
+    memcpy(historyBuffer + historyBufferUsed, str, length);
+    historyBufferUsed += length;
+}
+
+void io_history_str(const char * str){
+    io_history_write(str, strlen(str));
+}
+
+void io_history_format(const char * format, ...){
+    if(historyFile == NULL){
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(historyFormatBuffer, HISTORY_FORMAT_SIZE, format, args);
+    va_end(args);
+
+    if(length > HISTORY_FORMAT_SIZE - 1){
+        length = HISTORY_FORMAT_SIZE - 1;
+    }
+
+    if(length > 0){
+        io_history_write(historyFormatBuffer, length);
+    }
+}
+
 void updateTimeStamp(){
     time_t currentTime;
     struct tm* timeInfo;
@@ -21,55 +87,39 @@ void updateTimeStamp(){
     strftime(timestampStr, TIMESTAMP_SIZE, TIMESTAMP_FORMAT, timeInfo);
 }
 
-//Reference https://www.equestionanswers.com/c/c-int86-dos-bios-system-interrupts.php
-int getScreenColumns(){
-
-    union REGS input_regs, output_regs;
-    int numCols;
-
-    input_regs.h.ah = 0x0F;
-    int86(0x10, &input_regs, &output_regs);
-    numCols = output_regs.h.ah;
-
-    return numCols;
-}
-
 void io_timestamp(){
     updateTimeStamp();
 
     #define TIMESTAMP_PRINT_FORMAT "[%s]\n"
     printf(TIMESTAMP_PRINT_FORMAT, timestampStr);
 
-    if(historyFile){
-        fprintf(historyFile, TIMESTAMP_PRINT_FORMAT, timestampStr);
-    }
-    
+    io_history_format(TIMESTAMP_PRINT_FORMAT, timestampStr);
 }
 
 void io_app_error(char * str, int length){
 
-    #define APP_ERROR_FORMAT "App Error:\n%.*s\n"
-    printf(APP_ERROR_FORMAT, length, str);
+    #define APP_ERROR_TITLE "App Error:\n"
+    printf(APP_ERROR_TITLE "%.*s\n", length, str);
 
-    if(historyFile){
-        fprintf(historyFile, APP_ERROR_FORMAT, length, str);
-    }
+    io_history_str(APP_ERROR_TITLE);
+    io_history_write(str, length);
+    io_history_str("\n");
 }
 
 void io_server_error(char * str, int length){
-    #define GPT_ERROR_FORMAT "Server Error:\n%.*s\n"
-    printf(GPT_ERROR_FORMAT, length, str);
+    #define GPT_ERROR_TITLE "Server Error:\n"
+    printf(GPT_ERROR_TITLE "%.*s\n", length, str);
 
-    if(historyFile){
-        fprintf(historyFile, GPT_ERROR_FORMAT, length, str);
-    }
+    io_history_str(GPT_ERROR_TITLE);
+    io_history_write(str, length);
+    io_history_str("\n");
 }
 
 void io_str_newline(char * str){
 
     //First part of this function will do word wrapping
 
-    int columns = getScreenColumns();
+    int columns = screen_columns();
 
     int len = strlen(str);
 
@@ -82,7 +132,7 @@ void io_str_newline(char * str){
 
         // Find and print the last chunk
         if((charactersRemaining) <= columns){
-            printf("%.*s", charactersRemaining, str + startPos);
+            screen_write(str + startPos, charactersRemaining);
             break;
         }
 
@@ -111,34 +161,98 @@ void io_str_newline(char * str){
 
         int lengthToPrint = endPosOfCurrentString - startPos;
 
-        printf("%.*s\n", lengthToPrint, str + startPos);
+        screen_write(str + startPos, lengthToPrint);
+        screen_write("\n", 1);
 
         startPos = endPosOfCurrentString + 1;
     }
 
-    printf("\n");
+    screen_write("\n", 1);
 
+    //This part writes the non-wrapped portion to file.
+    io_history_write(str, len);
+    io_history_str("\n");
+}
 
-    //printf("%s\n", str);
+// Word wrap state for text printed piece by piece
+#define STREAM_WORD_SIZE 256
+char streamWord[STREAM_WORD_SIZE];
+int streamWordLength = 0;
+int streamColumn = 0;
+int streamColumns = 80;
 
-    //This part writes the non-wrapped portion to file.
-    if(historyFile){
-        fprintf(historyFile, "%s\n", str);
+// Print the pending word, moving to the next line first if it does not fit
+void io_stream_flush_word(){
+
+    if(streamWordLength == 0){
+        return;
+    }
+
+    if(streamColumn > 0 && (streamColumn + streamWordLength) > (streamColumns - 1)){
+        screen_write("\n", 1);
+        streamColumn = 0;
     }
+
+    screen_write(streamWord, streamWordLength);
+    streamColumn += streamWordLength;
+    streamWordLength = 0;
 }
 
-void io_write_str_no_print(char * str, int length){
-    if(historyFile){
-        fprintf(historyFile, "%.*s", length, str);
+void io_stream_begin(){
+    streamColumns = screen_columns();
+    streamWordLength = 0;
+    streamColumn = 0;
+}
+
+void io_stream_str(char * str, int length){
+
+    for(int i = 0; i < length; i++){
+        char currentChar = str[i];
+
+        if(currentChar == '\n'){
+            io_stream_flush_word();
+            screen_write("\n", 1);
+            streamColumn = 0;
+        } else if(currentChar == ' '){
+            io_stream_flush_word();
+
+            // Space at the end of the line is replaced by the line break
+            if(streamColumn < (streamColumns - 1)){
+                screen_write(" ", 1);
+                streamColumn++;
+            } else {
+                screen_write("\n", 1);
+                streamColumn = 0;
+            }
+        } else {
+            streamWord[streamWordLength++] = currentChar;
+
+            // Word is too long to fit in a line, break it up
+            if(streamWordLength >= (streamColumns - 1) || streamWordLength >= STREAM_WORD_SIZE){
+                io_stream_flush_word();
+            }
+        }
     }
+
+    //Write the non-wrapped portion to file.
+    io_history_write(str, length);
+}
+
+void io_stream_end(){
+    io_stream_flush_word();
+    screen_write("\n", 1);
+
+    io_history_str("\n");
+}
+
+void io_write_str_no_print(char * str, int length){
+    io_history_write(str, length);
 }
 
 void io_char(char c){
-    printf("%c", c);
+    screen_write(&c, 1);
 
-    if(historyFile){
-        fprintf(historyFile, "%c", c);
-    }
+    io_history_write(&c, 1);
 }
 
 void io_request_info(unsigned int port, int promptTokens, int completionTokens){
@@ -147,26 +261,50 @@ void io_request_info(unsigned int port, int promptTokens, int completionTokens){
 
     printf(INFO_FORMAT, port, promptTokens, completionTokens);
 
-    if(historyFile){
-        fprintf(historyFile, INFO_FORMAT, port, promptTokens, completionTokens);
-    }
+    io_history_format(INFO_FORMAT, port, promptTokens, completionTokens);
+}
+
+void io_latency_info(char * line){
+
+    #define LATENCY_FORMAT "[%s]\n"
+
+    printf(LATENCY_FORMAT, line);
+
+    io_history_format(LATENCY_FORMAT, line);
 }
 
 bool io_open_history_file(char * filePath){
+    historyBuffer = (char *) malloc(HISTORY_BUFFER_SIZE);
+
+    if(historyBuffer == NULL){
+        return false;
+    }
+
     historyFile = fopen(filePath, "a");
 
     if(historyFile == NULL){
+        free(historyBuffer);
+        historyBuffer = NULL;
         return false;
-    } else {
-        return true;
     }
+
+    // Our own buffer already batches the writes
+    setvbuf(historyFile, NULL, _IONBF, 0);
+    historyBufferUsed = 0;
+    return true;
 }
 
 void io_close_history_file(){
     if(historyFile != NULL){
+        io_flush_history();
         fclose(historyFile);
         historyFile = NULL;
     }
+
+    if(historyBuffer != NULL){
+        free(historyBuffer);
+        historyBuffer = NULL;
+    }
 }
 
 
@@ -2,9 +2,16 @@ void io_timestamp();
 void io_app_error(char * str, int length);
 void io_server_error(char * str, int length);
 void io_str_newline(char * str);
+void io_stream_begin();
+void io_stream_str(char * str, int length);
+void io_stream_end();
 void io_write_str_no_print(char * str, int length);
 void io_char(char c);
 void io_request_info(unsigned int port, int promptTokens, int completionTokens);
+void io_latency_info(char * line);
 
 bool io_open_history_file(char * filePath);
-void io_close_history_file();
\ No newline at end of file
+void io_close_history_file();
+
+// Write out the buffered history, done at the end of every turn and when closing
+void io_flush_history();
\ No newline at end of file
@@ -2,66 +2,229 @@
 #include "utfcp437.h"
 #include "utfcp737.h"
 
-CONVERSION_OUTPUT utf_to_cp(int codepage, int value0, int value1, int value2){
-    CONVERSION_OUTPUT output;
+#include "unicode.h"
 
-    if(value0 <= 127){
-        output.character = value0;
-        output.charactersUsed = 1;
-        return output;
+#define UTF_HIGH_SURROGATE_START 0xD800
+#define UTF_LOW_SURROGATE_START 0xDC00
+#define UTF_LOW_SURROGATE_END 0xDFFF
+#define UTF_SUPPLEMENTARY_START 0x10000UL
+
+// mTCP's table only holds the Basic Multilingual Plane
+#define UTF_BMP_END 0xFFFFUL
+
+// Plain ASCII look-alikes for punctuation that is common in replies but missing from the code pages
+const UTF_CP_MAPPING utf_ascii_fallback_table[] = {
+    {0x2010, '-'}, {0x2011, '-'}, {0x2012, '-'}, {0x2013, '-'},
+    {0x2014, '-'}, {0x2015, '-'}, {0x2018, '\''}, {0x2019, '\''},
+    {0x201A, '\''}, {0x201B, '\''}, {0x201C, '"'}, {0x201D, '"'},
+    {0x201E, '"'}, {0x2022, '*'}, {0x2032, '\''}, {0x2033, '"'},
+    {0x2039, '<'}, {0x203A, '>'}, {0x2212, '-'}
+};
+
+const int utf_ascii_fallback_table_size = sizeof(utf_ascii_fallback_table) / sizeof(UTF_CP_MAPPING);
+
+// Add the look-alikes after the code page so they never replace a real mapping
+void utf_add_ascii_fallback(){
+    for(int i = 0; i < utf_ascii_fallback_table_size; i++){
+        Unicode::addToXlateTable(utf_ascii_fallback_table[i].codepoint, utf_ascii_fallback_table[i].character);
     }
-    output.character = UNKNOWN_CHAR_REPLACEMENT;
-
-    switch(value0){
-        case 0xC2:
-            if(codepage == CODE_PAGE_737){
-                output.character = utf_to_cp737_c2(value1);
-            } else {
-                output.character = utf_to_cp437_c2(value1);
-            }
-            output.charactersUsed = 2;
-            break;
-        case 0xC3:
-            if(codepage == CODE_PAGE_737){
-                output.character = utf_to_cp737_c3(value1);
-            } else {
-                output.character = utf_to_cp437_c3(value1);
-            }
-            output.charactersUsed = 2;
+}
+
+bool utf_load_builtin_codepage(int codePage){
+    const UTF_CP_MAPPING * table;
+    int tableSize;
+
+    switch(codePage){
+        case CODE_PAGE_437:
+            table = utf_cp437_table;
+            tableSize = utf_cp437_table_size;
             break;
-        case 0xC6:
-            output.character = utf_to_cp437_c6(value1);
-            output.charactersUsed = 2;
+        case CODE_PAGE_737:
+            table = utf_cp737_table;
+            tableSize = utf_cp737_table_size;
             break;
-        case 0xCE:
-            if(codepage == CODE_PAGE_737){
-                output.character = utf_to_cp737_ce(value1);
-            } else {
-                output.character = utf_to_cp437_ce(value1);
+        default:
+            return false;
+    }
+
+    for(int i = 0; i < tableSize; i++){
+        Unicode::addToXlateTable(table[i].codepoint, table[i].character);
+    }
+
+    utf_add_ascii_fallback();
+    return true;
+}
+
+bool utf_load_codepage_file(char * path){
+    Unicode::loadXlateTable(path);
+
+    if(!Unicode::XlateTableLoaded()){
+        return false;
+    }
+
+    utf_add_ascii_fallback();
+    return true;
+}
+
+unsigned char utf_codepoint_to_cp(unsigned long codepoint){
+
+    if(codepoint < 0x80){
+        return (unsigned char) codepoint;
+    }
+
+    if(codepoint > UTF_BMP_END){
+        return UNKNOWN_CHAR_REPLACEMENT;
+    }
+
+    // Hash lookup, returns UNKNOWN_CHAR_REPLACEMENT if there is no mapping
+    return Unicode::findDisplayChar((small_cp_t) codepoint);
+}
+
+void utf_decoder_init(UTF_DECODER * decoder){
+    decoder->state = UTF_DECODE_NORMAL;
+    decoder->codepoint = 0;
+    decoder->bytesRemaining = 0;
+    decoder->hexDigits = 0;
+    decoder->highSurrogate = 0;
+}
+
+// Write one character to output if there is space
+void utf_put(char * output, int * written, int outputSize, unsigned char character){
+    if(*written < outputSize){
+        output[(*written)++] = character;
+    }
+}
+
+// Convert a decoded code point and write it out, pairing up UTF-16 surrogates from \u escapes
+void utf_emit(UTF_DECODER * decoder, unsigned long codepoint, char * output, int * written, int outputSize){
+
+    if(codepoint >= UTF_HIGH_SURROGATE_START && codepoint < UTF_LOW_SURROGATE_START){
+        if(decoder->highSurrogate != 0){
+            utf_put(output, written, outputSize, UNKNOWN_CHAR_REPLACEMENT);
+        }
+
+        // Wait for the low surrogate that should follow
+        decoder->highSurrogate = (unsigned int) codepoint;
+        return;
+    }
+
+    if(codepoint >= UTF_LOW_SURROGATE_START && codepoint <= UTF_LOW_SURROGATE_END){
+        if(decoder->highSurrogate == 0){
+            utf_put(output, written, outputSize, UNKNOWN_CHAR_REPLACEMENT);
+            return;
+        }
+
+        codepoint = UTF_SUPPLEMENTARY_START + ((unsigned long) (decoder->highSurrogate - UTF_HIGH_SURROGATE_START) << 10) + (codepoint - UTF_LOW_SURROGATE_START);
+        decoder->highSurrogate = 0;
+    } else if(decoder->highSurrogate != 0){
+        // High surrogate without its pair
+        utf_put(output, written, outputSize, UNKNOWN_CHAR_REPLACEMENT);
+        decoder->highSurrogate = 0;
+    }
+
+    utf_put(output, written, outputSize, utf_codepoint_to_cp(codepoint));
+}
+
+// Value of a hex digit, -1 if not one
+int utf_hex_value(unsigned char c){
+    if(c >= '0' && c <= '9'){
+        return c - '0';
+    } else if(c >= 'a' && c <= 'f'){
+        return c - 'a' + 10;
+    } else if(c >= 'A' && c <= 'F'){
+        return c - 'A' + 10;
+    }
+
+    return -1;
+}
+
+int utf_decode_json(UTF_DECODER * decoder, char * input, int inputLength, char * output, int outputSize){
+
+    int written = 0;
+
+    for(int i = 0; i < inputLength && written < outputSize; i++){
+        unsigned char c = (unsigned char) input[i];
+
+        if(decoder->state == UTF_DECODE_ESCAPE){
+            decoder->state = UTF_DECODE_NORMAL;
+
+            switch(c){
+                case 'n':
+                    utf_emit(decoder, '\n', output, &written, outputSize);
+                    break;
+                case 't':
+                    utf_emit(decoder, ' ', output, &written, outputSize);
+                    break;
+                case 'r':
+                case 'b':
+                case 'f':
+                    // Not useful on screen
+                    break;
+                case 'u':
+                    decoder->state = UTF_DECODE_UNICODE_ESCAPE;
+                    decoder->codepoint = 0;
+                    decoder->hexDigits = 0;
+                    break;
+                default:
+                    // \" \\ \/
+                    utf_emit(decoder, c, output, &written, outputSize);
+                    break;
             }
-            output.charactersUsed = 2;
-            break;
-        case 0xCF:
-            if(codepage == CODE_PAGE_737){
-                output.character = utf_to_cp737_cf(value1);
-            } else {
-                output.character = utf_to_cp437_cf(value1);
+            continue;
+        }
+
+        if(decoder->state == UTF_DECODE_UNICODE_ESCAPE){
+            int hexValue = utf_hex_value(c);
+
+            if(hexValue < 0){
+                // Malformed escape, process this character normally
+                decoder->state = UTF_DECODE_NORMAL;
+                utf_put(output, &written, outputSize, UNKNOWN_CHAR_REPLACEMENT);
+                i--;
+                continue;
             }
-            output.charactersUsed = 2;
-            break;
-        case 0xE2:
-            if(codepage == CODE_PAGE_737){
-                output.character = utf_to_cp737_e2(value1, value2);
-            } else {
-                output.character = utf_to_cp437_e2(value1, value2);
+
+            decoder->codepoint = (decoder->codepoint << 4) | hexValue;
+
+            if(++decoder->hexDigits == 4){
+                decoder->state = UTF_DECODE_NORMAL;
+                utf_emit(decoder, decoder->codepoint, output, &written, outputSize);
             }
-            output.charactersUsed = 3;
-            break;
-        default:
-            output.character = UNKNOWN_CHAR_REPLACEMENT;
-            output.charactersUsed = 1;
-    }
+            continue;
+        }
+
+        if(decoder->bytesRemaining > 0){
+            if((c & 0xC0) == 0x80){
+                decoder->codepoint = (decoder->codepoint << 6) | (c & 0x3F);
 
-    return output;
+                if(--decoder->bytesRemaining == 0){
+                    utf_emit(decoder, decoder->codepoint, output, &written, outputSize);
+                }
+                continue;
+            }
+
+            // Sequence cut short, this byte starts something new
+            decoder->bytesRemaining = 0;
+            utf_put(output, &written, outputSize, UNKNOWN_CHAR_REPLACEMENT);
+        }
+
+        if(c == '\\'){
+            decoder->state = UTF_DECODE_ESCAPE;
+        } else if(c < 0x80){
+            utf_emit(decoder, c, output, &written, outputSize);
+        } else if(c >= 0xC2 && c <= 0xDF){
+            decoder->codepoint = c & 0x1F;
+            decoder->bytesRemaining = 1;
+        } else if(c >= 0xE0 && c <= 0xEF){
+            decoder->codepoint = c & 0x0F;
+            decoder->bytesRemaining = 2;
+        } else if(c >= 0xF0 && c <= 0xF4){
+            decoder->codepoint = c & 0x07;
+            decoder->bytesRemaining = 3;
+        } else {
+            utf_put(output, &written, outputSize, UNKNOWN_CHAR_REPLACEMENT);
+        }
+    }
 
+    return written;
 }
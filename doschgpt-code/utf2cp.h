@@ -1,19 +1,64 @@
 #define UNKNOWN_CHAR_REPLACEMENT 0xFE
 
-#define CODE_PAGE_737 737
+// Built into the app, other code pages are loaded from a mapping file
 #define CODE_PAGE_437 437
+#define CODE_PAGE_737 737
+
+// One entry of a code page table
+typedef struct
+{
+    // Unicode code point, tables only cover the Basic Multilingual Plane
+    unsigned int codepoint;
+
+    // Character in the code page
+    unsigned char character;
+
+} UTF_CP_MAPPING;
 
+#define UTF_DECODE_NORMAL 0
+#define UTF_DECODE_ESCAPE 1
+#define UTF_DECODE_UNICODE_ESCAPE 2
+
+// State of utf_decode_json() kept between calls so an escape sequence or
+// UTF-8 character may be split across pieces of the reply
 typedef struct
 {
-    //How many values was used during parsing
-    int charactersUsed;
+    // One of the UTF_DECODE_X
+    int state;
+
+    // Code point being assembled from UTF-8 bytes or \uXXXX hex digits
+    unsigned long codepoint;
+
+    // UTF-8 continuation bytes still expected
+    int bytesRemaining;
+
+    // Hex digits of \uXXXX read so far
+    int hexDigits;
+
+    // First half of a UTF-16 surrogate pair given as \uD8XX, 0 if none
+    unsigned int highSurrogate;
+
+} UTF_DECODER;
+
+// Use the built-in table of CODE_PAGE_437 or CODE_PAGE_737.
+// Returns false if the code page is not built in
+bool utf_load_builtin_codepage(int codePage);
 
-    //Page code of the character. Using int to avoid padding compilation problem
-    // If character cannot be matched, will return UNKNOWN_CHAR_REPLACEMENT
-    unsigned int character;
+// Load the table for another code page from a mapping file. Each line has a Unicode
+// code point and the code page character in hex, as read by mTCP's Unicode::loadXlateTable().
+// Returns false if the file cannot be read
+bool utf_load_codepage_file(char * path);
 
-} CONVERSION_OUTPUT;
+// Reset the decoder before a new reply
+void utf_decoder_init(UTF_DECODER * decoder);
 
+// Unescape JSON string content, decode UTF-8 and convert to the code page in a single pass.
+// Characters not in the code page become UNKNOWN_CHAR_REPLACEMENT.
+// input: JSON-escaped UTF-8 text, not null-terminated
+// output: Code page text is written here, not null-terminated
+// outputSize: Space in output. Remaining input is dropped once it is full.
+// Returns the number of characters written to output
+int utf_decode_json(UTF_DECODER * decoder, char * input, int inputLength, char * output, int outputSize);
 
-//Provide up to 3 bytes of the string to attempt to parse to code page
-CONVERSION_OUTPUT utf_to_cp(int codepage, int value0, int value1, int value2);
+// Convert a single Unicode code point to the loaded code page
+unsigned char utf_codepoint_to_cp(unsigned long codepoint);
@@ -1,9 +1,2 @@
-unsigned char utf_to_cp437_c2(int value1);
-unsigned char utf_to_cp437_c3(int value1);
-unsigned char utf_to_cp437_c6(int value1);
-unsigned char utf_to_cp437_ce(int value1);
-unsigned char utf_to_cp437_cf(int value1);
-
-// 2nd character with e2 will require another value for parsing
-unsigned char utf_to_cp437_e2(int value1, int value2);
-
+extern const UTF_CP_MAPPING utf_cp437_table[];
+extern const int utf_cp437_table_size;
@@ -1,188 +1,41 @@
+#include "utf2cp.h"
 #include "utfcp737.h"
-#define UNKNOWN_CHAR_REPLACEMENT 0xFE
 
-unsigned char utf_to_cp737_ce(int value1){
-
-    switch(value1){
-        case 0x91: return 128;
-        case 0x92: return 129;
-        case 0x93: return 130;
-        case 0x94: return 131;
-        case 0x95: return 132;
-        case 0x96: return 133;
-        case 0x97: return 134;
-        case 0x98: return 135;
-        case 0x99: return 136;
-        case 0x9A: return 137;
-        case 0x9B: return 138;
-        case 0x9C: return 139;
-        case 0x9D: return 140;
-        case 0x9E: return 141;
-        case 0x9F: return 142;
-        case 0xA0: return 143;
-        case 0xA1: return 144;
-        case 0xA3: return 145;
-        case 0xA4: return 146;
-        case 0xA5: return 147;
-        case 0xA6: return 148;
-        case 0xA7: return 149;
-        case 0xA8: return 150;
-        case 0xA9: return 151;
-        case 0xB1: return 152;
-        case 0xB2: return 153;
-        case 0xB3: return 154;
-        case 0xB4: return 155;
-        case 0xB5: return 156;
-        case 0xB6: return 157;
-        case 0xB7: return 158;
-        case 0xB8: return 159;
-        case 0xB9: return 160;
-        case 0xBA: return 161;
-        case 0xBB: return 162;
-        case 0xBC: return 163;
-        case 0xBD: return 164;
-        case 0xBE: return 165;
-        case 0xBF: return 166;
-        case 0xAC: return 225;
-        case 0xAD: return 226;
-        case 0xAE: return 227;
-        case 0xAF: return 229;
-        case 0x86: return 234;
-        case 0x88: return 235;
-        case 0x89: return 236;
-        case 0x8A: return 237;
-        case 0x8C: return 238;
-        case 0x8E: return 239;
-        case 0x8F: return 240;
-        case 0xAA: return 244;
-        case 0xAB: return 245;
-        default: return UNKNOWN_CHAR_REPLACEMENT;
-    }
-    
-}
-
-unsigned char utf_to_cp737_cf(int value1){
-
-    switch(value1){
-        case 0x80: return 167;
-        case 0x81: return 168;
-        case 0x82: return 170;
-        case 0x83: return 169;
-        case 0x84: return 171;
-        case 0x85: return 172;
-        case 0x86: return 173;
-        case 0x87: return 174;
-        case 0x88: return 175;
-        case 0x89: return 224;
-        case 0x8A: return 228;
-        case 0x8C: return 230;
-        case 0x8D: return 231;
-        case 0x8B: return 232;
-        case 0x8E: return 233;
-        default: return UNKNOWN_CHAR_REPLACEMENT;
-    }
-
-}
-
-unsigned char utf_to_cp737_c2(int value1){
-    switch(value1){
-        case 0xB1: return 241;
-        case 0xB0: return 248;
-        case 0xB7: return 250;
-        case 0xB2: return 253;
-        default: return UNKNOWN_CHAR_REPLACEMENT;
-    }
-}
-
-unsigned char utf_to_cp737_c3(int value1){
-    switch(value1){
-        case 0xB7: return 246;
-        default: return UNKNOWN_CHAR_REPLACEMENT;
-    }
-}
-
-unsigned char utf_to_cp737_e2(int value1, int value2){
-
-    if(value1 == 0x96){
-        switch(value2){
-            case 0x91: return 176;
-            case 0x92: return 177;
-            case 0x93: return 178;
-            case 0x88: return 219;
-            case 0x84: return 220;
-            case 0x8C: return 221;
-            case 0x90: return 222;
-            case 0x80: return 223;
-            case 0xA0: return 254;
-            default: return UNKNOWN_CHAR_REPLACEMENT;
-        }
-    } else if(value1 == 0x94){
-        switch(value2){
-            case 0x82: return 179;
-            case 0xA4: return 180;
-            case 0x90: return 191;
-            case 0x94: return 192;
-            case 0xB4: return 193;
-            case 0xAC: return 194;
-            case 0x9C: return 195;
-            case 0x80: return 196;
-            case 0xBC: return 197;
-            case 0x98: return 217;
-            case 0x8C: return 218;
-            default: return UNKNOWN_CHAR_REPLACEMENT;
-        }
-    } else if(value1 == 0x95){
-        switch(value2){
-            case 0xA1: return 181;
-            case 0xA2: return 182;
-            case 0x96: return 183;
-            case 0x95: return 184;
-            case 0xA3: return 185;
-            case 0x91: return 186;
-            case 0x97: return 187;
-            case 0x9D: return 188;
-            case 0x9C: return 189;
-            case 0x9B: return 190;
-            case 0x9E: return 198;
-            case 0x9F: return 199;
-            case 0x9A: return 200;
-            case 0x94: return 201;
-            case 0xA9: return 202;
-            case 0xA6: return 203;
-            case 0xA0: return 204;
-            case 0x90: return 205;
-            case 0xAC: return 206;
-            case 0xA7: return 207;
-            case 0xA8: return 208;
-            case 0xA4: return 209;
-            case 0xA5: return 210;
-            case 0x99: return 211;
-            case 0x98: return 212;
-            case 0x92: return 213;
-            case 0x93: return 214;
-            case 0xAB: return 215;
-            case 0xAA: return 216;
-            default: return UNKNOWN_CHAR_REPLACEMENT;
-        }
-    } else if (value1 == 0x88){
-        switch(value2){
-            case 0x99: return 249;
-            case 0x9A: return 251;
-            default: return UNKNOWN_CHAR_REPLACEMENT;
-        }
-    } else if (value1 == 0x89){
-        switch(value2){
-            case 0xA5: return 242;
-            case 0xA4: return 243;
-            case 0x88: return 247;
-            default: return UNKNOWN_CHAR_REPLACEMENT;
-        }
-    } else if (value1 == 0x81){
-        switch(value2){
-            case 0xBF: return 252;
-            default: return UNKNOWN_CHAR_REPLACEMENT;
-        }
-    }
-
-    return UNKNOWN_CHAR_REPLACEMENT;
-}
\ No newline at end of file
+// Built-in Unicode code point to CP737 (Greek) for the characters 128-255, sorted by code point.
+// Same as codepage/cp737.txt so -cp737 works without the mapping file, as in earlier versions.
+const UTF_CP_MAPPING utf_cp737_table[] = {
+    {0x00A0, 255}, {0x00B0, 248}, {0x00B1, 241}, {0x00B2, 253},
+    {0x00B7, 250}, {0x00F7, 246}, {0x0386, 234}, {0x0388, 235},
+    {0x0389, 236}, {0x038A, 237}, {0x038C, 238}, {0x038E, 239},
+    {0x038F, 240}, {0x0391, 128}, {0x0392, 129}, {0x0393, 130},
+    {0x0394, 131}, {0x0395, 132}, {0x0396, 133}, {0x0397, 134},
+    {0x0398, 135}, {0x0399, 136}, {0x039A, 137}, {0x039B, 138},
+    {0x039C, 139}, {0x039D, 140}, {0x039E, 141}, {0x039F, 142},
+    {0x03A0, 143}, {0x03A1, 144}, {0x03A3, 145}, {0x03A4, 146},
+    {0x03A5, 147}, {0x03A6, 148}, {0x03A7, 149}, {0x03A8, 150},
+    {0x03A9, 151}, {0x03AA, 244}, {0x03AB, 245}, {0x03AC, 225},
+    {0x03AD, 226}, {0x03AE, 227}, {0x03AF, 229}, {0x03B1, 152},
+    {0x03B2, 153}, {0x03B3, 154}, {0x03B4, 155}, {0x03B5, 156},
+    {0x03B6, 157}, {0x03B7, 158}, {0x03B8, 159}, {0x03B9, 160},
+    {0x03BA, 161}, {0x03BB, 162}, {0x03BC, 163}, {0x03BD, 164},
+    {0x03BE, 165}, {0x03BF, 166}, {0x03C0, 167}, {0x03C1, 168},
+    {0x03C2, 170}, {0x03C3, 169}, {0x03C4, 171}, {0x03C5, 172},
+    {0x03C6, 173}, {0x03C7, 174}, {0x03C8, 175}, {0x03C9, 224},
+    {0x03CA, 228}, {0x03CB, 232}, {0x03CC, 230}, {0x03CD, 231},
+    {0x03CE, 233}, {0x207F, 252}, {0x2219, 249}, {0x221A, 251},
+    {0x2248, 247}, {0x2264, 243}, {0x2265, 242}, {0x2500, 196},
+    {0x2502, 179}, {0x250C, 218}, {0x2510, 191}, {0x2514, 192},
+    {0x2518, 217}, {0x251C, 195}, {0x2524, 180}, {0x252C, 194},
+    {0x2534, 193}, {0x253C, 197}, {0x2550, 205}, {0x2551, 186},
+    {0x2552, 213}, {0x2553, 214}, {0x2554, 201}, {0x2555, 184},
+    {0x2556, 183}, {0x2557, 187}, {0x2558, 212}, {0x2559, 211},
+    {0x255A, 200}, {0x255B, 190}, {0x255C, 189}, {0x255D, 188},
+    {0x255E, 198}, {0x255F, 199}, {0x2560, 204}, {0x2561, 181},
+    {0x2562, 182}, {0x2563, 185}, {0x2564, 209}, {0x2565, 210},
+    {0x2566, 203}, {0x2567, 207}, {0x2568, 208}, {0x2569, 202},
+    {0x256A, 216}, {0x256B, 215}, {0x256C, 206}, {0x2580, 223},
+    {0x2584, 220}, {0x2588, 219}, {0x258C, 221}, {0x2590, 222},
+    {0x2591, 176}, {0x2592, 177}, {0x2593, 178}, {0x25A0, 254}
+};
+
+const int utf_cp737_table_size = sizeof(utf_cp737_table) / sizeof(UTF_CP_MAPPING);
@@ -1,5 +1,2 @@
-unsigned char utf_to_cp737_ce(int value1);
-unsigned char utf_to_cp737_cf(int value1);
-unsigned char utf_to_cp737_c2(int value1);
-unsigned char utf_to_cp737_c3(int value1);
-unsigned char utf_to_cp737_e2(int value1, int value2);
\ No newline at end of file
+extern const UTF_CP_MAPPING utf_cp737_table[];
+extern const int utf_cp737_table_size;
@@ -0,0 +1,326 @@
+// Speed of each stage a reply goes through once it has arrived, for finding the stage
+// worth making faster and for catching regressions.
+//
+// replybench [-iN] [-cpFILE] <reply files>
+//
+// Reply files are JSON bodies as recorded in api-data, or whole HTTP responses. Each body
+// is sent again as a chunked HTTP response in packet sized pieces and goes through the
+// same code as in the app: HTTP framing, JSON scanning, unescaping with the code page
+// conversion, then word wrapping. -iN runs every stage N times instead of for a fixed
+// time. -cpFILE uses a code page mapping file instead of the built-in CP437.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define BENCH_HAS_CYCLES 1
+#else
+#define BENCH_HAS_CYCLES 0
+#endif
+
+#include "http.h"
+#include "json.h"
+#include "utf2cp.h"
+#include "textio.h"
+#include "screen.h"
+
+// Largest reply file, as the app would never see more than its receive buffer
+#define BENCH_FILE_SIZE 65536
+#define BENCH_RESPONSE_SIZE (BENCH_FILE_SIZE * 2)
+
+// Bytes given to http_response_feed() and json_feed() at a time, as one TCP segment
+#define BENCH_SEGMENT_SIZE 1460
+
+// Bytes in each chunk of the chunked encoding
+#define BENCH_CHUNK_SIZE 512
+
+// Each stage runs for at least this long unless -iN is given
+#define BENCH_MIN_NS 200000000ULL
+
+#define BENCH_SCREEN_COLUMNS 80
+
+#define BENCH_HTTP_HEADER "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nTransfer-Encoding: chunked\r\nConnection: keep-alive\r\n\r\n"
+
+#define BENCH_STAGE_HTTP 0
+#define BENCH_STAGE_JSON 1
+#define BENCH_STAGE_DECODE 2
+#define BENCH_STAGE_WRAP 3
+#define BENCH_STAGE_COUNT 4
+
+const char * benchStageNames[BENCH_STAGE_COUNT] = {"HTTP framing", "JSON scan", "Unescape+code page", "Word wrap"};
+
+// Reply text of all three APIs, see the REPLY_FIELDS tables in network.cpp
+#define BENCH_CONTENT_PATH_COUNT 3
+const char * benchContentPaths[BENCH_CONTENT_PATH_COUNT] = {"choices.message.content", "generated_text", "message.content"};
+
+typedef struct
+{
+    // Input bytes of the stage over all runs
+    uint64_t bytes;
+    uint64_t ns;
+    uint64_t cycles;
+
+} BENCH_RESULT;
+
+BENCH_RESULT benchResults[BENCH_STAGE_COUNT];
+
+// Input of each stage, made once from the reply file by bench_prepare()
+char benchResponse[BENCH_RESPONSE_SIZE];
+int benchResponseLength;
+
+char benchBody[BENCH_FILE_SIZE];
+int benchBodyLength;
+
+char benchEscaped[BENCH_FILE_SIZE];
+int benchEscapedLength;
+
+char benchDecoded[BENCH_FILE_SIZE + 1];
+int benchDecodedLength;
+
+// Working space the stages write into
+char benchBuffer[BENCH_RESPONSE_SIZE];
+HTTP_RESPONSE benchHttp;
+JSON_SCANNER benchScanner;
+uint64_t benchScreenBytes;
+
+long benchIterations = 0;
+
+// Word wrap writes here instead of the screen
+void screen_init(){
+}
+
+int screen_columns(){
+    return BENCH_SCREEN_COLUMNS;
+}
+
+void screen_write(const char * str, int length){
+    benchScreenBytes += length;
+}
+
+uint64_t bench_now_ns(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+uint64_t bench_cycles(){
+#if BENCH_HAS_CYCLES
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+void bench_json_value(int field, char * value, int length, bool final){
+    if(benchEscapedLength + length <= BENCH_FILE_SIZE){
+        memcpy(benchEscaped + benchEscapedLength, value, length);
+        benchEscapedLength += length;
+    }
+}
+
+// Feed the response to the framing code a segment at a time as network_receive_step() does
+void bench_http(){
+    int bytesInBuffer = 0;
+
+    http_response_init(&benchHttp);
+
+    for(int pos = 0; pos < benchResponseLength; pos += BENCH_SEGMENT_SIZE){
+        int length = benchResponseLength - pos < BENCH_SEGMENT_SIZE ? benchResponseLength - pos : BENCH_SEGMENT_SIZE;
+
+        memcpy(benchBuffer + bytesInBuffer, benchResponse + pos, length);
+        bytesInBuffer += length;
+        http_response_feed(&benchHttp, benchBuffer, &bytesInBuffer);
+    }
+}
+
+// The framing has to give back the body it was wrapped around
+bool bench_http_check(){
+    bench_http();
+
+    return benchHttp.state == HTTP_STATE_COMPLETE && benchHttp.bodyLength == benchBodyLength &&
+        memcmp(http_response_body(&benchHttp, benchBuffer), benchBody, benchBodyLength) == 0;
+}
+
+void bench_json(){
+    benchEscapedLength = 0;
+    json_init(&benchScanner, benchContentPaths, BENCH_CONTENT_PATH_COUNT, bench_json_value);
+
+    // Scanned where it lies, the scanner does not write to its input
+    for(int pos = 0; pos < benchBodyLength; pos += BENCH_SEGMENT_SIZE){
+        int length = benchBodyLength - pos < BENCH_SEGMENT_SIZE ? benchBodyLength - pos : BENCH_SEGMENT_SIZE;
+        json_feed(&benchScanner, benchBody + pos, length);
+    }
+}
+
+void bench_decode(){
+    UTF_DECODER decoder;
+
+    utf_decoder_init(&decoder);
+    benchDecodedLength = utf_decode_json(&decoder, benchEscaped, benchEscapedLength, benchDecoded, BENCH_FILE_SIZE);
+    benchDecoded[benchDecodedLength] = '\0';
+}
+
+void bench_wrap(){
+    io_str_newline(benchDecoded);
+}
+
+// Run a stage for the time or the number of iterations asked for and add up what it took
+void bench_run(int stage, void (*run)(), int inputLength){
+    uint64_t start = bench_now_ns();
+    uint64_t startCycles = bench_cycles();
+    long runs = 0;
+
+    do {
+        run();
+        runs++;
+    } while(benchIterations > 0 ? runs < benchIterations : bench_now_ns() - start < BENCH_MIN_NS);
+
+    benchResults[stage].cycles += bench_cycles() - startCycles;
+    benchResults[stage].ns += bench_now_ns() - start;
+    benchResults[stage].bytes += (uint64_t) inputLength * runs;
+}
+
+// Make the input of every stage from a reply file. Returns false if it has no reply text.
+bool bench_prepare(char * data, int length){
+
+    // The body of a recorded HTTP response starts after the empty line
+    benchBodyLength = length;
+    char * body = data;
+
+    if(strncmp(data, "HTTP/", 5) == 0){
+        char * end = strstr(data, "\r\n\r\n");
+        int separatorLength = 4;
+
+        if(end == NULL){
+            end = strstr(data, "\n\n");
+            separatorLength = 2;
+        }
+
+        if(end == NULL){
+            return false;
+        }
+
+        body = end + separatorLength;
+        benchBodyLength = length - (body - data);
+    }
+
+    memcpy(benchBody, body, benchBodyLength);
+
+    strcpy(benchResponse, BENCH_HTTP_HEADER);
+    benchResponseLength = strlen(BENCH_HTTP_HEADER);
+
+    for(int pos = 0; pos < benchBodyLength; pos += BENCH_CHUNK_SIZE){
+        int chunkLength = benchBodyLength - pos < BENCH_CHUNK_SIZE ? benchBodyLength - pos : BENCH_CHUNK_SIZE;
+
+        benchResponseLength += sprintf(benchResponse + benchResponseLength, "%x\r\n", chunkLength);
+        memcpy(benchResponse + benchResponseLength, benchBody + pos, chunkLength);
+        benchResponseLength += chunkLength;
+        benchResponseLength += sprintf(benchResponse + benchResponseLength, "\r\n");
+    }
+
+    benchResponseLength += sprintf(benchResponse + benchResponseLength, "0\r\n\r\n");
+
+    bench_json();
+
+    if(benchEscapedLength == 0){
+        return false;
+    }
+
+    bench_decode();
+    return true;
+}
+
+bool bench_file(char * path){
+    FILE * file = fopen(path, "rb");
+
+    if(file == NULL){
+        printf("%s: cannot open\n", path);
+        return false;
+    }
+
+    static char data[BENCH_FILE_SIZE + 1];
+    int length = fread(data, sizeof(char), BENCH_FILE_SIZE, file);
+    fclose(file);
+    data[length] = '\0';
+
+    if(!bench_prepare(data, length)){
+        printf("%-28s skipped, no reply text found\n", path);
+        return true;
+    }
+
+    printf("%-28s %6d bytes response, %6d body, %6d reply text\n", path, benchResponseLength, benchBodyLength, benchEscapedLength);
+
+    if(!bench_http_check()){
+        printf("%-28s HTTP framing did not give back the body\n", path);
+        return false;
+    }
+
+    bench_run(BENCH_STAGE_HTTP, bench_http, benchResponseLength);
+    bench_run(BENCH_STAGE_JSON, bench_json, benchBodyLength);
+    bench_run(BENCH_STAGE_DECODE, bench_decode, benchEscapedLength);
+    bench_run(BENCH_STAGE_WRAP, bench_wrap, benchDecodedLength);
+    return true;
+}
+
+void printUsage(){
+    printf("Usage: replybench [-iN] [-cpFILE] <reply files>\n");
+}
+
+int main(int argc, char * argv[]){
+    int firstFile = 1;
+    char * codePagePath = NULL;
+
+    for(; firstFile < argc && argv[firstFile][0] == '-'; firstFile++){
+        char * arg = argv[firstFile];
+
+        if(strncmp(arg, "-i", 2) == 0 && atol(arg + 2) > 0){
+            benchIterations = atol(arg + 2);
+        } else if(strncmp(arg, "-cp", 3) == 0 && arg[3] != '\0'){
+            codePagePath = arg + 3;
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if(firstFile >= argc){
+        printUsage();
+        return 1;
+    }
+
+    if(codePagePath != NULL){
+        if(!utf_load_codepage_file(codePagePath)){
+            printf("Cannot load code page file %s\n", codePagePath);
+            return 1;
+        }
+    } else {
+        utf_load_builtin_codepage(CODE_PAGE_437);
+    }
+
+    bool ok = true;
+
+    for(int i = firstFile; i < argc; i++){
+        ok = bench_file(argv[i]) && ok;
+    }
+
+    printf("\n%-20s %14s %14s\n", "Stage", "Bytes/s", BENCH_HAS_CYCLES ? "Cycles/byte" : "ns/byte");
+
+    for(int stage = 0; stage < BENCH_STAGE_COUNT; stage++){
+        BENCH_RESULT * result = &benchResults[stage];
+
+        if(result->bytes == 0 || result->ns == 0){
+            continue;
+        }
+
+        double bytesPerSecond = (double) result->bytes * 1000000000.0 / result->ns;
+        double perByte = (double) (BENCH_HAS_CYCLES ? result->cycles : result->ns) / result->bytes;
+
+        printf("%-20s %14.0f %14.2f\n", benchStageNames[stage], bytesPerSecond, perByte);
+    }
+
+    return ok ? 0 : 1;
+}
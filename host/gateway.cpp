@@ -0,0 +1,1070 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "gateway.h"
+#include "host.h"
+
+#define ETH_HEADER_LENGTH 14
+#define ETH_TYPE_IP 0x0800
+#define ETH_TYPE_ARP 0x0806
+
+#define ARP_LENGTH 28
+#define ARP_REQUEST 1
+#define ARP_REPLY 2
+
+#define IP_HEADER_LENGTH 20
+#define IP_PROTOCOL_ICMP 1
+#define IP_PROTOCOL_TCP 6
+#define IP_PROTOCOL_UDP 17
+#define IP_DONT_FRAGMENT 0x4000
+#define IP_TIME_TO_LIVE 64
+
+#define ICMP_ECHO_REPLY 0
+#define ICMP_ECHO_REQUEST 8
+
+#define UDP_HEADER_LENGTH 8
+
+#define TCP_HEADER_LENGTH 20
+#define TCP_OPTION_MSS_LENGTH 4
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+#define TCP_PSH 0x08
+#define TCP_ACK 0x10
+
+// Used until the stack says otherwise in its SYN
+#define TCP_DEFAULT_MSS 536
+
+#define SEQ_LT(a, b) ((int32_t) ((a) - (b)) < 0)
+#define SEQ_GT(a, b) ((int32_t) ((a) - (b)) > 0)
+
+#define DNS_PORT 53
+#define DNS_HEADER_LENGTH 12
+#define DNS_MESSAGE_SIZE 512
+#define DNS_NAME_SIZE 256
+#define DNS_TYPE_A 1
+#define DNS_CLASS_IN 1
+#define DNS_FLAG_REPLY 0x8000
+#define DNS_FLAG_RECURSION_DESIRED 0x0100
+#define DNS_FLAG_RECURSION_AVAILABLE 0x0080
+#define DNS_RCODE_NAME_ERROR 3
+#define DNS_ANSWER_TTL 60
+
+#define GATEWAY_FRAME_SIZE 1514
+
+// Frames waiting for the stack to take them
+#define GATEWAY_QUEUE_FRAMES 64
+
+#define GATEWAY_MAX_CONNECTIONS 8
+
+// Data read from a host socket and not yet acknowledged by the stack
+#define GATEWAY_SEND_BUFFER_SIZE 16384
+
+#define GATEWAY_WINDOW 8192
+#define GATEWAY_MSS 1460
+
+// Timeout before the first round trip is measured, and the bounds of it after
+#define GATEWAY_RTO_MS 1000
+#define GATEWAY_RTO_MIN_MS 200
+#define GATEWAY_RTO_MAX_MS 8000
+#define GATEWAY_DUP_ACKS 3
+
+#define GATEWAY_SERVICE_NONE 0
+#define GATEWAY_SERVICE_DISCARD 1
+#define GATEWAY_SERVICE_SOURCE 2
+
+typedef struct
+{
+    uint16_t length;
+    uint8_t data[GATEWAY_FRAME_SIZE];
+
+} GATEWAY_FRAME;
+
+// A TCP connection from the stack carried over a host socket
+typedef struct
+{
+    bool inUse;
+
+    // Host socket, or -1 for a built-in service
+    int fd;
+    uint8_t service;
+
+    // Byte count asked of the source service has been read
+    bool sourceRequested;
+    uint32_t sourceLength;
+    uint32_t sourceSent;
+
+    // Host socket is still connecting, the SYN is answered once it is done
+    bool connecting;
+
+    // Address and ports as the stack sees them
+    uint8_t remoteIp[4];
+    uint16_t remotePort;
+    uint16_t clientPort;
+
+    // Sequence numbers the gateway sends with. The SYN is at iss and data starts at sendBase.
+    uint32_t iss;
+    uint32_t sndUna;
+    uint32_t sndNext;
+    uint32_t sndMax;
+    uint32_t sendBase;
+    uint16_t sendLength;
+
+    bool synAcked;
+
+    // Host socket has no more data, a FIN follows the data
+    bool hostEof;
+
+    uint32_t rcvNext;
+    bool clientFin;
+
+    uint16_t clientWindow;
+    uint16_t mss;
+
+    bool rtoArmed;
+    uint32_t rtoAt;
+    uint32_t rtoMs;
+    uint8_t dupAcks;
+
+    // One segment at a time is timed, never one that was sent again
+    bool rttTiming;
+    uint32_t rttSeq;
+    uint32_t rttStart;
+    uint32_t srtt;
+    uint32_t rttVariance;
+
+    // Send a byte into a closed window to find out when it opens
+    bool probe;
+
+    // Last so that the state before it can be cleared on its own
+    uint8_t sendBuffer[GATEWAY_SEND_BUFFER_SIZE];
+
+} GATEWAY_TCP;
+
+const uint8_t gatewayMac[6] = {0x52, 0x55, 0x0A, 0x00, 0x02, 0x02};
+
+uint8_t gatewayIp[4];
+uint8_t nameserverIp[4];
+const uint8_t loopbackIp[4] = {127, 0, 0, 1};
+
+// Learnt from the frames the stack sends
+uint8_t clientMac[6];
+uint8_t clientIp[4];
+bool clientKnown = false;
+
+GATEWAY_FRAME * gatewayQueue = NULL;
+int gatewayQueueFirst;
+int gatewayQueueCount;
+
+GATEWAY_TCP * gatewayConnections = NULL;
+
+uint16_t gatewayIdent;
+
+GATEWAY_STATS gatewayStats;
+
+uint16_t get16(const uint8_t * p){
+    return (p[0] << 8) | p[1];
+}
+
+uint32_t get32(const uint8_t * p){
+    return ((uint32_t) get16(p) << 16) | get16(p + 2);
+}
+
+void put16(uint8_t * p, uint16_t value){
+    p[0] = value >> 8;
+    p[1] = value & 0xFF;
+}
+
+void put32(uint8_t * p, uint32_t value){
+    put16(p, value >> 16);
+    put16(p + 2, value & 0xFFFF);
+}
+
+uint32_t checksum_add(uint32_t sum, const uint8_t * data, int length){
+    for(int i = 0; i + 1 < length; i += 2){
+        sum += get16(data + i);
+    }
+
+    if(length & 1){
+        sum += data[length - 1] << 8;
+    }
+
+    return sum;
+}
+
+uint16_t checksum_fold(uint32_t sum){
+    while(sum >> 16){
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+
+    return ~sum & 0xFFFF;
+}
+
+// Checksum of a TCP or UDP packet with its pseudo header, to the stack
+uint16_t checksum_transport(const uint8_t * srcIp, uint8_t protocol, const uint8_t * packet, int length){
+    uint32_t sum = checksum_add(0, srcIp, 4);
+    sum = checksum_add(sum, clientIp, 4);
+    sum += protocol + length;
+    return checksum_fold(checksum_add(sum, packet, length));
+}
+
+GATEWAY_FRAME * gateway_queue_frame(){
+    if(gatewayQueueCount == GATEWAY_QUEUE_FRAMES){
+        gatewayStats.framesDropped++;
+        return NULL;
+    }
+
+    return &gatewayQueue[(gatewayQueueFirst + gatewayQueueCount++) % GATEWAY_QUEUE_FRAMES];
+}
+
+// Queue an IP packet for the stack. The transport checksum is already filled in.
+void gateway_send_ip(const uint8_t * srcIp, uint8_t protocol, const uint8_t * payload, int payloadLength){
+    GATEWAY_FRAME * frame = gateway_queue_frame();
+
+    if(frame == NULL){
+        return;
+    }
+
+    uint8_t * eth = frame->data;
+    memcpy(eth, clientMac, 6);
+    memcpy(eth + 6, gatewayMac, 6);
+    put16(eth + 12, ETH_TYPE_IP);
+
+    uint8_t * ip = eth + ETH_HEADER_LENGTH;
+    ip[0] = 0x45;
+    ip[1] = 0;
+    put16(ip + 2, IP_HEADER_LENGTH + payloadLength);
+    put16(ip + 4, gatewayIdent++);
+    put16(ip + 6, IP_DONT_FRAGMENT);
+    ip[8] = IP_TIME_TO_LIVE;
+    ip[9] = protocol;
+    put16(ip + 10, 0);
+    memcpy(ip + 12, srcIp, 4);
+    memcpy(ip + 16, clientIp, 4);
+    put16(ip + 10, checksum_fold(checksum_add(0, ip, IP_HEADER_LENGTH)));
+
+    memcpy(ip + IP_HEADER_LENGTH, payload, payloadLength);
+    frame->length = ETH_HEADER_LENGTH + IP_HEADER_LENGTH + payloadLength;
+}
+
+void gateway_send_udp(const uint8_t * srcIp, uint16_t srcPort, uint16_t dstPort, const uint8_t * data, int length){
+    uint8_t packet[UDP_HEADER_LENGTH + DNS_MESSAGE_SIZE];
+
+    put16(packet, srcPort);
+    put16(packet + 2, dstPort);
+    put16(packet + 4, UDP_HEADER_LENGTH + length);
+    put16(packet + 6, 0);
+    memcpy(packet + UDP_HEADER_LENGTH, data, length);
+    put16(packet + 6, checksum_transport(srcIp, IP_PROTOCOL_UDP, packet, UDP_HEADER_LENGTH + length));
+
+    gateway_send_ip(srcIp, IP_PROTOCOL_UDP, packet, UDP_HEADER_LENGTH + length);
+}
+
+void gateway_send_tcp(const uint8_t * srcIp, uint16_t srcPort, uint16_t dstPort, uint32_t seq, uint32_t ack, uint8_t flags, const uint8_t * data, int length){
+    uint8_t segment[TCP_HEADER_LENGTH + TCP_OPTION_MSS_LENGTH + GATEWAY_MSS];
+    int headerLength = TCP_HEADER_LENGTH;
+
+    put16(segment, srcPort);
+    put16(segment + 2, dstPort);
+    put32(segment + 4, seq);
+    put32(segment + 8, ack);
+    segment[13] = flags;
+    put16(segment + 14, GATEWAY_WINDOW);
+    put16(segment + 16, 0);
+    put16(segment + 18, 0);
+
+    if(flags & TCP_SYN){
+        segment[headerLength] = 2;
+        segment[headerLength + 1] = TCP_OPTION_MSS_LENGTH;
+        put16(segment + headerLength + 2, GATEWAY_MSS);
+        headerLength += TCP_OPTION_MSS_LENGTH;
+    }
+
+    segment[12] = (headerLength / 4) << 4;
+
+    if(length > 0){
+        memcpy(segment + headerLength, data, length);
+    }
+
+    put16(segment + 16, checksum_transport(srcIp, IP_PROTOCOL_TCP, segment, headerLength + length));
+
+    gateway_send_ip(srcIp, IP_PROTOCOL_TCP, segment, headerLength + length);
+}
+
+void gateway_tcp_send(GATEWAY_TCP * conn, uint8_t flags, uint32_t seq, const uint8_t * data, int length){
+    gateway_send_tcp(conn->remoteIp, conn->remotePort, conn->clientPort, seq, conn->rcvNext, flags, data, length);
+}
+
+GATEWAY_TCP * gateway_tcp_find(const uint8_t * remoteIp, uint16_t remotePort, uint16_t clientPort){
+    for(int i = 0; i < GATEWAY_MAX_CONNECTIONS; i++){
+        GATEWAY_TCP * conn = &gatewayConnections[i];
+
+        if(conn->inUse && conn->remotePort == remotePort && conn->clientPort == clientPort && memcmp(conn->remoteIp, remoteIp, 4) == 0){
+            return conn;
+        }
+    }
+
+    return NULL;
+}
+
+void gateway_tcp_free(GATEWAY_TCP * conn){
+    if(conn->fd >= 0){
+        close(conn->fd);
+    }
+
+    conn->inUse = false;
+}
+
+void gateway_tcp_reset(GATEWAY_TCP * conn){
+    gateway_tcp_send(conn, TCP_RST | TCP_ACK, conn->sndNext, NULL, 0);
+    gateway_tcp_free(conn);
+}
+
+// Data from the stack for a built-in service. Everything is taken.
+int gateway_service_input(GATEWAY_TCP * conn, const uint8_t * data, int length){
+    if(conn->service != GATEWAY_SERVICE_SOURCE){
+        return length;
+    }
+
+    for(int i = 0; i < length && !conn->sourceRequested; i++){
+        if(data[i] >= '0' && data[i] <= '9'){
+            conn->sourceLength = conn->sourceLength * 10 + (data[i] - '0');
+        } else if(data[i] == '\n'){
+            conn->sourceRequested = true;
+        }
+    }
+
+    return length;
+}
+
+// Fill the send buffer of the source service like data read from a host socket
+void gateway_source_fill(GATEWAY_TCP * conn){
+    if(!conn->sourceRequested){
+        return;
+    }
+
+    while(conn->sourceSent < conn->sourceLength && conn->sendLength < GATEWAY_SEND_BUFFER_SIZE){
+        conn->sendBuffer[conn->sendLength++] = GATEWAY_SOURCE_BYTE(conn->sourceSent);
+        conn->sourceSent++;
+        gatewayStats.bytesFromHost++;
+    }
+
+    if(conn->sourceSent == conn->sourceLength){
+        conn->hostEof = true;
+    }
+}
+
+// Send what the window allows: the SYN, data from the host socket, then the FIN
+void gateway_tcp_output(GATEWAY_TCP * conn){
+    if(conn->connecting){
+        return;
+    }
+
+    if(conn->service == GATEWAY_SERVICE_SOURCE){
+        gateway_source_fill(conn);
+    }
+
+    uint32_t now = host_clock_ms();
+
+    if(!conn->synAcked){
+        if(conn->sndNext == conn->iss){
+            gateway_tcp_send(conn, TCP_SYN | TCP_ACK, conn->iss, NULL, 0);
+            conn->sndNext = conn->iss + 1;
+        }
+    } else {
+        while(true){
+            uint32_t offset = conn->sndNext - conn->sendBase;
+
+            if(offset < conn->sendLength){
+                uint32_t window = conn->clientWindow > 0 ? conn->clientWindow : (conn->probe ? 1 : 0);
+                uint32_t windowEnd = conn->sndUna + window;
+
+                if(!SEQ_LT(conn->sndNext, windowEnd)){
+                    break;
+                }
+
+                uint32_t length = conn->sendLength - offset;
+
+                if(length > windowEnd - conn->sndNext){
+                    length = windowEnd - conn->sndNext;
+                }
+
+                if(length > conn->mss){
+                    length = conn->mss;
+                }
+
+                gateway_tcp_send(conn, TCP_ACK | TCP_PSH, conn->sndNext, conn->sendBuffer + offset, length);
+
+                if(!conn->rttTiming && conn->sndNext == conn->sndMax){
+                    conn->rttTiming = true;
+                    conn->rttSeq = conn->sndNext;
+                    conn->rttStart = now;
+                }
+
+                conn->sndNext += length;
+                conn->probe = false;
+            } else if(conn->hostEof && offset == conn->sendLength){
+                gateway_tcp_send(conn, TCP_FIN | TCP_ACK, conn->sndNext, NULL, 0);
+                conn->sndNext++;
+                break;
+            } else {
+                break;
+            }
+        }
+    }
+
+    if(SEQ_GT(conn->sndNext, conn->sndMax)){
+        conn->sndMax = conn->sndNext;
+    }
+
+    // Also runs while the window is closed with data waiting, to probe it
+    if(!conn->rtoArmed && (conn->sndUna != conn->sndNext || conn->sendLength > conn->sndNext - conn->sendBase)){
+        conn->rtoArmed = true;
+        conn->rtoAt = now + conn->rtoMs;
+    }
+}
+
+// Smoothed round trip time and its variance as in RFC 6298
+void gateway_tcp_rtt(GATEWAY_TCP * conn, uint32_t sample){
+    if(conn->srtt == 0){
+        conn->srtt = sample > 0 ? sample : 1;
+        conn->rttVariance = sample / 2;
+    } else {
+        uint32_t difference = sample > conn->srtt ? sample - conn->srtt : conn->srtt - sample;
+        conn->rttVariance = (3 * conn->rttVariance + difference) / 4;
+        conn->srtt = (7 * conn->srtt + sample) / 8;
+    }
+}
+
+uint32_t gateway_tcp_rto(GATEWAY_TCP * conn){
+    if(conn->srtt == 0){
+        return GATEWAY_RTO_MS;
+    }
+
+    uint32_t rto = conn->srtt + 4 * conn->rttVariance;
+
+    if(rto < GATEWAY_RTO_MIN_MS){
+        return GATEWAY_RTO_MIN_MS;
+    }
+
+    return rto < GATEWAY_RTO_MAX_MS ? rto : GATEWAY_RTO_MAX_MS;
+}
+
+void gateway_tcp_ack(GATEWAY_TCP * conn, uint32_t ack, uint16_t window, bool pureAck){
+    conn->clientWindow = window;
+
+    if(SEQ_GT(ack, conn->sndMax)){
+        return;
+    }
+
+    if(SEQ_GT(ack, conn->sndUna)){
+        conn->synAcked = true;
+
+        if(SEQ_GT(ack, conn->sendBase)){
+            uint32_t acked = ack - conn->sendBase;
+
+            // The rest acknowledges the FIN
+            if(acked > conn->sendLength){
+                acked = conn->sendLength;
+            }
+
+            memmove(conn->sendBuffer, conn->sendBuffer + acked, conn->sendLength - acked);
+            conn->sendLength -= acked;
+            conn->sendBase += acked;
+        }
+
+        if(conn->rttTiming && SEQ_GT(ack, conn->rttSeq)){
+            gateway_tcp_rtt(conn, host_clock_ms() - conn->rttStart);
+            conn->rttTiming = false;
+        }
+
+        conn->sndUna = ack;
+        conn->dupAcks = 0;
+        conn->rtoMs = gateway_tcp_rto(conn);
+        conn->rtoArmed = false;
+
+        // Acknowledged more than was sent again since going back
+        if(SEQ_GT(ack, conn->sndNext)){
+            conn->sndNext = ack;
+        }
+    } else if(pureAck && ack == conn->sndUna && conn->sndUna != conn->sndNext){
+        // Go back to the first segment missing straight away
+        if(++conn->dupAcks == GATEWAY_DUP_ACKS){
+            conn->sndNext = conn->sndUna;
+            conn->rttTiming = false;
+            gatewayStats.retransmits++;
+        }
+    }
+}
+
+// Data from the stack is passed on in order, anything else is acknowledged to ask for it again
+void gateway_tcp_data(GATEWAY_TCP * conn, uint32_t seq, const uint8_t * data, int length, bool fin){
+    if(length == 0 && !fin){
+        return;
+    }
+
+    if(seq == conn->rcvNext && !conn->clientFin){
+        int written = 0;
+
+        if(length > 0){
+            if(conn->service != GATEWAY_SERVICE_NONE){
+                written = gateway_service_input(conn, data, length);
+            } else {
+                written = send(conn->fd, data, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+            }
+
+            if(written < 0){
+                if(errno != EAGAIN && errno != EWOULDBLOCK){
+                    gateway_tcp_reset(conn);
+                    return;
+                }
+
+                written = 0;
+            }
+
+            conn->rcvNext += written;
+            gatewayStats.bytesToHost += written;
+        }
+
+        if(fin && written == length){
+            conn->rcvNext++;
+            conn->clientFin = true;
+
+            // A service closes its side as well, unless the source still has data to send
+            if(conn->service == GATEWAY_SERVICE_NONE){
+                shutdown(conn->fd, SHUT_WR);
+            } else if(!conn->sourceRequested){
+                conn->hostEof = true;
+            }
+        }
+    }
+
+    gateway_tcp_send(conn, TCP_ACK, conn->sndNext, NULL, 0);
+}
+
+// Both sides have sent a FIN and the stack has acknowledged ours
+bool gateway_tcp_done(GATEWAY_TCP * conn){
+    return conn->clientFin && conn->hostEof && conn->sendLength == 0 && conn->sndUna == conn->sendBase + 1;
+}
+
+uint16_t gateway_tcp_mss(const uint8_t * segment, int headerLength){
+    for(int i = TCP_HEADER_LENGTH; i + 1 < headerLength;){
+        uint8_t kind = segment[i];
+
+        if(kind == 0){
+            break;
+        } else if(kind == 1){
+            i++;
+            continue;
+        }
+
+        if(kind == 2 && segment[i + 1] == TCP_OPTION_MSS_LENGTH && i + TCP_OPTION_MSS_LENGTH <= headerLength){
+            return get16(segment + i + 2);
+        }
+
+        if(segment[i + 1] < 2){
+            break;
+        }
+
+        i += segment[i + 1];
+    }
+
+    return TCP_DEFAULT_MSS;
+}
+
+void gateway_tcp_open(const uint8_t * remoteIp, const uint8_t * segment, int headerLength){
+    uint16_t clientPort = get16(segment);
+    uint16_t remotePort = get16(segment + 2);
+    uint32_t seq = get32(segment + 4);
+
+    GATEWAY_TCP * conn = NULL;
+
+    for(int i = 0; i < GATEWAY_MAX_CONNECTIONS && conn == NULL; i++){
+        if(!gatewayConnections[i].inUse){
+            conn = &gatewayConnections[i];
+        }
+    }
+
+    if(conn == NULL){
+        gateway_send_tcp(remoteIp, remotePort, clientPort, 0, seq + 1, TCP_RST | TCP_ACK, NULL, 0);
+        return;
+    }
+
+    memset(conn, 0, offsetof(GATEWAY_TCP, sendBuffer));
+    conn->inUse = true;
+    memcpy(conn->remoteIp, remoteIp, 4);
+    conn->remotePort = remotePort;
+    conn->clientPort = clientPort;
+    conn->iss = (uint32_t) rand();
+    conn->sndUna = conn->sndNext = conn->sndMax = conn->iss;
+    conn->sendBase = conn->iss + 1;
+    conn->rcvNext = seq + 1;
+    conn->clientWindow = get16(segment + 14);
+    conn->mss = gateway_tcp_mss(segment, headerLength);
+    conn->rtoMs = GATEWAY_RTO_MS;
+
+    if(conn->mss > GATEWAY_MSS){
+        conn->mss = GATEWAY_MSS;
+    }
+
+    conn->fd = -1;
+    gatewayStats.connections++;
+
+    if(memcmp(remoteIp, gatewayIp, 4) == 0 && (remotePort == GATEWAY_DISCARD_PORT || remotePort == GATEWAY_SOURCE_PORT)){
+        conn->service = remotePort == GATEWAY_DISCARD_PORT ? GATEWAY_SERVICE_DISCARD : GATEWAY_SERVICE_SOURCE;
+        gateway_tcp_output(conn);
+        return;
+    }
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(remotePort);
+    memcpy(&address.sin_addr, memcmp(remoteIp, gatewayIp, 4) == 0 ? loopbackIp : remoteIp, 4);
+
+    conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+    if(conn->fd < 0 || (connect(conn->fd, (struct sockaddr *) &address, sizeof(address)) < 0 && errno != EINPROGRESS)){
+        gateway_tcp_reset(conn);
+        return;
+    }
+
+    int noDelay = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    conn->connecting = true;
+}
+
+void gateway_tcp_input(const uint8_t * remoteIp, const uint8_t * segment, int length){
+    if(length < TCP_HEADER_LENGTH){
+        return;
+    }
+
+    uint16_t clientPort = get16(segment);
+    uint16_t remotePort = get16(segment + 2);
+    uint32_t seq = get32(segment + 4);
+    uint32_t ack = get32(segment + 8);
+    int headerLength = (segment[12] >> 4) * 4;
+    uint8_t flags = segment[13];
+
+    if(headerLength < TCP_HEADER_LENGTH || headerLength > length){
+        return;
+    }
+
+    int dataLength = length - headerLength;
+    GATEWAY_TCP * conn = gateway_tcp_find(remoteIp, remotePort, clientPort);
+
+    if(flags & TCP_RST){
+        if(conn != NULL){
+            gateway_tcp_free(conn);
+        }
+        return;
+    }
+
+    if(conn == NULL){
+        if((flags & (TCP_SYN | TCP_ACK)) == TCP_SYN){
+            gateway_tcp_open(remoteIp, segment, headerLength);
+        } else if(flags & TCP_ACK){
+            gateway_send_tcp(remoteIp, remotePort, clientPort, ack, 0, TCP_RST, NULL, 0);
+        } else {
+            gateway_send_tcp(remoteIp, remotePort, clientPort, 0, seq + dataLength + (flags & TCP_FIN ? 1 : 0), TCP_RST | TCP_ACK, NULL, 0);
+        }
+        return;
+    }
+
+    // The SYN was sent again, so was the answer lost
+    if(flags & TCP_SYN){
+        if(!conn->connecting && !conn->synAcked){
+            conn->sndNext = conn->iss;
+            gateway_tcp_output(conn);
+        }
+        return;
+    }
+
+    if(flags & TCP_ACK){
+        gateway_tcp_ack(conn, ack, get16(segment + 14), dataLength == 0 && !(flags & TCP_FIN));
+    }
+
+    if(!conn->synAcked){
+        return;
+    }
+
+    gateway_tcp_data(conn, seq, segment + headerLength, dataLength, flags & TCP_FIN);
+
+    if(!conn->inUse){
+        return;
+    }
+
+    gateway_tcp_output(conn);
+
+    if(gateway_tcp_done(conn)){
+        gateway_tcp_free(conn);
+    }
+}
+
+// Address of a name as the stack should use it. The host itself is given as the gateway.
+bool gateway_resolve(const char * name, uint8_t * address){
+    struct addrinfo hints;
+    struct addrinfo * result;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if(getaddrinfo(name, NULL, &hints, &result) != 0){
+        return false;
+    }
+
+    memcpy(address, &((struct sockaddr_in *) result->ai_addr)->sin_addr, 4);
+    freeaddrinfo(result);
+
+    if(address[0] == loopbackIp[0]){
+        memcpy(address, gatewayIp, 4);
+    }
+
+    return true;
+}
+
+void gateway_dns(uint16_t clientPort, const uint8_t * query, int length){
+    if(length < DNS_HEADER_LENGTH || (get16(query + 2) & DNS_FLAG_REPLY) || get16(query + 4) < 1){
+        return;
+    }
+
+    char name[DNS_NAME_SIZE];
+    int nameLength = 0;
+    int pos = DNS_HEADER_LENGTH;
+
+    while(pos < length && query[pos] != 0){
+        int labelLength = query[pos++];
+
+        if(labelLength > 63 || pos + labelLength > length || nameLength + labelLength + 1 >= DNS_NAME_SIZE){
+            return;
+        }
+
+        if(nameLength > 0){
+            name[nameLength++] = '.';
+        }
+
+        memcpy(name + nameLength, query + pos, labelLength);
+        nameLength += labelLength;
+        pos += labelLength;
+    }
+
+    name[nameLength] = '\0';
+
+    // Zero length at the end of the name, then type and class
+    pos += 5;
+
+    if(pos > length){
+        return;
+    }
+
+    uint8_t reply[DNS_MESSAGE_SIZE];
+    int replyLength = pos;
+    uint16_t flags = DNS_FLAG_REPLY | DNS_FLAG_RECURSION_AVAILABLE | (get16(query + 2) & DNS_FLAG_RECURSION_DESIRED);
+    uint8_t address[4];
+
+    memcpy(reply, query, pos);
+    put16(reply + 4, 1);
+    put16(reply + 6, 0);
+    put16(reply + 8, 0);
+    put16(reply + 10, 0);
+
+    if(get16(query + pos - 4) == DNS_TYPE_A && get16(query + pos - 2) == DNS_CLASS_IN){
+        if(gateway_resolve(name, address)){
+            // Name given by a pointer to the question
+            put16(reply + replyLength, 0xC000 | DNS_HEADER_LENGTH);
+            put16(reply + replyLength + 2, DNS_TYPE_A);
+            put16(reply + replyLength + 4, DNS_CLASS_IN);
+            put32(reply + replyLength + 6, DNS_ANSWER_TTL);
+            put16(reply + replyLength + 10, 4);
+            memcpy(reply + replyLength + 12, address, 4);
+            replyLength += 16;
+            put16(reply + 6, 1);
+        } else {
+            flags |= DNS_RCODE_NAME_ERROR;
+        }
+    }
+
+    put16(reply + 2, flags);
+    gateway_send_udp(nameserverIp, DNS_PORT, clientPort, reply, replyLength);
+}
+
+void gateway_icmp(const uint8_t * dstIp, const uint8_t * packet, int length){
+    if(length < 8 || length > GATEWAY_FRAME_SIZE - ETH_HEADER_LENGTH - IP_HEADER_LENGTH || packet[0] != ICMP_ECHO_REQUEST){
+        return;
+    }
+
+    uint8_t reply[GATEWAY_FRAME_SIZE];
+    memcpy(reply, packet, length);
+    reply[0] = ICMP_ECHO_REPLY;
+    put16(reply + 2, 0);
+    put16(reply + 2, checksum_fold(checksum_add(0, reply, length)));
+
+    gateway_send_ip(dstIp, IP_PROTOCOL_ICMP, reply, length);
+}
+
+void gateway_ip(const uint8_t * ip, int length){
+    if(length < IP_HEADER_LENGTH || (ip[0] >> 4) != 4){
+        return;
+    }
+
+    int headerLength = (ip[0] & 0x0F) * 4;
+    int totalLength = get16(ip + 2);
+
+    // Fragments are not put back together
+    if(totalLength > length || headerLength < IP_HEADER_LENGTH || totalLength < headerLength || (get16(ip + 6) & ~IP_DONT_FRAGMENT) != 0){
+        return;
+    }
+
+    memcpy(clientIp, ip + 12, 4);
+
+    const uint8_t * dstIp = ip + 16;
+    const uint8_t * payload = ip + headerLength;
+    int payloadLength = totalLength - headerLength;
+
+    switch(ip[9]){
+        case IP_PROTOCOL_TCP:
+            gateway_tcp_input(dstIp, payload, payloadLength);
+            break;
+        case IP_PROTOCOL_UDP:
+            if(payloadLength >= UDP_HEADER_LENGTH && memcmp(dstIp, nameserverIp, 4) == 0 && get16(payload + 2) == DNS_PORT){
+                gateway_dns(get16(payload), payload + UDP_HEADER_LENGTH, payloadLength - UDP_HEADER_LENGTH);
+            }
+            break;
+        case IP_PROTOCOL_ICMP:
+            gateway_icmp(dstIp, payload, payloadLength);
+            break;
+    }
+}
+
+// Every address but the sender's own is at the gateway. Asking for its own address is how
+// the stack checks that nobody else is using it.
+void gateway_arp(const uint8_t * frame, int length){
+    const uint8_t * arp = frame + ETH_HEADER_LENGTH;
+
+    if(length < ETH_HEADER_LENGTH + ARP_LENGTH || get16(arp) != 1 || get16(arp + 2) != ETH_TYPE_IP || get16(arp + 6) != ARP_REQUEST){
+        return;
+    }
+
+    const uint8_t * senderMac = arp + 8;
+    const uint8_t * senderIp = arp + 14;
+    const uint8_t * targetIp = arp + 24;
+
+    if(memcmp(senderIp, targetIp, 4) == 0){
+        return;
+    }
+
+    GATEWAY_FRAME * reply = gateway_queue_frame();
+
+    if(reply == NULL){
+        return;
+    }
+
+    uint8_t * eth = reply->data;
+    memcpy(eth, senderMac, 6);
+    memcpy(eth + 6, gatewayMac, 6);
+    put16(eth + 12, ETH_TYPE_ARP);
+
+    uint8_t * answer = eth + ETH_HEADER_LENGTH;
+    memcpy(answer, arp, 6);
+    put16(answer + 6, ARP_REPLY);
+    memcpy(answer + 8, gatewayMac, 6);
+    memcpy(answer + 14, targetIp, 4);
+    memcpy(answer + 18, senderMac, 6);
+    memcpy(answer + 24, senderIp, 4);
+
+    reply->length = ETH_HEADER_LENGTH + ARP_LENGTH;
+}
+
+bool gateway_open(){
+    inet_pton(AF_INET, GATEWAY_ADDRESS, gatewayIp);
+    inet_pton(AF_INET, GATEWAY_NAMESERVER_ADDRESS, nameserverIp);
+
+    gatewayQueue = (GATEWAY_FRAME *) calloc(GATEWAY_QUEUE_FRAMES, sizeof(GATEWAY_FRAME));
+    gatewayConnections = (GATEWAY_TCP *) calloc(GATEWAY_MAX_CONNECTIONS, sizeof(GATEWAY_TCP));
+
+    if(gatewayQueue == NULL || gatewayConnections == NULL){
+        gateway_close();
+        return false;
+    }
+
+    gatewayQueueFirst = 0;
+    gatewayQueueCount = 0;
+    clientKnown = false;
+    memset(&gatewayStats, 0, sizeof(gatewayStats));
+
+    return true;
+}
+
+void gateway_close(){
+    if(gatewayConnections != NULL){
+        for(int i = 0; i < GATEWAY_MAX_CONNECTIONS; i++){
+            if(gatewayConnections[i].inUse){
+                gateway_tcp_free(&gatewayConnections[i]);
+            }
+        }
+    }
+
+    free(gatewayConnections);
+    free(gatewayQueue);
+    gatewayConnections = NULL;
+    gatewayQueue = NULL;
+}
+
+void gateway_input(const uint8_t * frame, uint16_t length){
+    if(gatewayQueue == NULL || length < ETH_HEADER_LENGTH){
+        return;
+    }
+
+    memcpy(clientMac, frame + 6, 6);
+    clientKnown = true;
+
+    switch(get16(frame + 12)){
+        case ETH_TYPE_IP:
+            gateway_ip(frame + ETH_HEADER_LENGTH, length - ETH_HEADER_LENGTH);
+            break;
+        case ETH_TYPE_ARP:
+            gateway_arp(frame, length);
+            break;
+    }
+}
+
+uint16_t gateway_output(uint8_t * frame, uint16_t size){
+    if(gatewayQueue == NULL || gatewayQueueCount == 0){
+        return 0;
+    }
+
+    GATEWAY_FRAME * first = &gatewayQueue[gatewayQueueFirst];
+    uint16_t length = first->length < size ? first->length : size;
+    memcpy(frame, first->data, length);
+
+    gatewayQueueFirst = (gatewayQueueFirst + 1) % GATEWAY_QUEUE_FRAMES;
+    gatewayQueueCount--;
+
+    return length;
+}
+
+// Host socket of a connection is ready to be read, or has finished connecting
+void gateway_tcp_host(GATEWAY_TCP * conn){
+    if(conn->connecting){
+        int error = 0;
+        socklen_t errorLength = sizeof(error);
+        getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &errorLength);
+
+        if(error != 0){
+            gateway_tcp_reset(conn);
+            return;
+        }
+
+        conn->connecting = false;
+        gateway_tcp_output(conn);
+        return;
+    }
+
+    int received = recv(conn->fd, conn->sendBuffer + conn->sendLength, GATEWAY_SEND_BUFFER_SIZE - conn->sendLength, MSG_DONTWAIT);
+
+    if(received > 0){
+        conn->sendLength += received;
+        gatewayStats.bytesFromHost += received;
+    } else if(received == 0){
+        conn->hostEof = true;
+    } else if(errno != EAGAIN && errno != EWOULDBLOCK){
+        gateway_tcp_reset(conn);
+        return;
+    }
+
+    gateway_tcp_output(conn);
+}
+
+void gateway_poll(int waitMs){
+    if(gatewayConnections == NULL){
+        return;
+    }
+
+    struct pollfd fds[GATEWAY_MAX_CONNECTIONS];
+    GATEWAY_TCP * polled[GATEWAY_MAX_CONNECTIONS];
+    int count = 0;
+    uint32_t now = host_clock_ms();
+
+    // Nothing to wait for if the stack already has frames to take
+    int timeout = gatewayQueueCount > 0 ? 0 : waitMs;
+
+    for(int i = 0; i < GATEWAY_MAX_CONNECTIONS; i++){
+        GATEWAY_TCP * conn = &gatewayConnections[i];
+
+        if(!conn->inUse){
+            continue;
+        }
+
+        if(conn->rtoArmed){
+            int32_t untilRto = (int32_t) (conn->rtoAt - now);
+
+            if(untilRto < timeout){
+                timeout = untilRto > 0 ? untilRto : 0;
+            }
+        }
+
+        short events = 0;
+
+        if(conn->fd < 0){
+            events = 0;
+        } else if(conn->connecting){
+            events = POLLOUT;
+        } else if(!conn->hostEof && conn->sendLength < GATEWAY_SEND_BUFFER_SIZE){
+            events = POLLIN;
+        }
+
+        if(events != 0){
+            fds[count].fd = conn->fd;
+            fds[count].events = events;
+            fds[count].revents = 0;
+            polled[count++] = conn;
+        }
+    }
+
+    if(poll(fds, count, timeout) > 0){
+        for(int i = 0; i < count; i++){
+            if(fds[i].revents != 0 && polled[i]->inUse){
+                gateway_tcp_host(polled[i]);
+            }
+        }
+    }
+
+    now = host_clock_ms();
+
+    for(int i = 0; i < GATEWAY_MAX_CONNECTIONS; i++){
+        GATEWAY_TCP * conn = &gatewayConnections[i];
+
+        if(!conn->inUse || !conn->rtoArmed || (int32_t) (now - conn->rtoAt) < 0){
+            continue;
+        }
+
+        // Go back to the oldest segment not acknowledged, or probe a closed window
+        if(conn->sndUna != conn->sndNext){
+            conn->sndNext = conn->sndUna;
+            conn->rttTiming = false;
+            gatewayStats.retransmits++;
+        } else {
+            conn->probe = true;
+        }
+
+        conn->rtoArmed = false;
+        conn->rtoMs = conn->rtoMs * 2 < GATEWAY_RTO_MAX_MS ? conn->rtoMs * 2 : GATEWAY_RTO_MAX_MS;
+        gateway_tcp_output(conn);
+    }
+}
+
+const GATEWAY_STATS * gateway_stats(){
+    return &gatewayStats;
+}
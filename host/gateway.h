@@ -0,0 +1,55 @@
+// User-space gateway at the far end of the wire, like the user-mode network of QEMU.
+// It answers ARP for every address but the stack's own, resolves names sent to the name
+// server address with the host resolver and ends TCP connections itself, carrying their
+// data over host sockets. Connections to the gateway address go to the host itself.
+//
+// The mTCP configuration file has to use these addresses, see mtcp.cfg.
+
+#include <stdint.h>
+
+#define GATEWAY_NETWORK_ADDRESS "10.0.2.0"
+#define GATEWAY_ADDRESS "10.0.2.2"
+#define GATEWAY_NAMESERVER_ADDRESS "10.0.2.3"
+
+// Services at the gateway address that run inside the gateway instead of on the host, so
+// tests do not depend on how fast the host answers. Discard reads and drops everything.
+// Source reads a byte count as a decimal line, sends that many bytes of
+// GATEWAY_SOURCE_BYTE() and closes.
+#define GATEWAY_DISCARD_PORT 9
+#define GATEWAY_SOURCE_PORT 19
+
+#define GATEWAY_SOURCE_BYTE(offset) ((uint8_t) (' ' + (offset) % 95))
+
+typedef struct
+{
+    // TCP connections accepted from the stack
+    uint32_t connections;
+
+    // Segments sent again after a timeout or duplicate acknowledgements
+    uint32_t retransmits;
+
+    // Bytes carried between the stack and host sockets
+    uint32_t bytesToHost;
+    uint32_t bytesFromHost;
+
+    // Frames for the stack dropped because the output queue was full
+    uint32_t framesDropped;
+
+} GATEWAY_STATS;
+
+bool gateway_open();
+
+// Close all host sockets
+void gateway_close();
+
+// Frame sent by the stack
+void gateway_input(const uint8_t * frame, uint16_t length);
+
+// Next frame for the stack. Returns its length or 0 if there is none.
+uint16_t gateway_output(uint8_t * frame, uint16_t size);
+
+// Move data between connections and their host sockets and send again what was not
+// acknowledged in time. Waits up to waitMs for a host socket if no frame is waiting.
+void gateway_poll(int waitMs);
+
+const GATEWAY_STATS * gateway_stats();
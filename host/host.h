@@ -0,0 +1,19 @@
+// Services of the Linux host build shared between its parts. The host build replaces the
+// packet driver, timer interrupt, keyboard, screen, speech and EMS of the DOS build so
+// doschgpt and mTCP run unchanged as a Linux program, see README.md.
+
+#include <stdint.h>
+
+// Milliseconds since the program started, or the virtual time once it is in use
+uint32_t host_clock_ms();
+
+// Same clock in microseconds, for the timer chip count within a tick
+uint64_t host_clock_us();
+
+// Stop following the host clock. Time starts at startMs and only moves on with
+// host_clock_advance(), when the stack waits for the wire, so runs can be repeated exactly.
+void host_clock_virtual(uint32_t startMs);
+
+void host_clock_advance(uint32_t ms);
+
+bool host_clock_is_virtual();
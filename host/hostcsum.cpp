@@ -0,0 +1,74 @@
+/*
+
+   Host build replacement for IPASM.ASM
+
+   IP checksums in C for the Linux host build of mTCP.  The results are the
+   same as the assembler versions: the complemented one's complement sum of
+   the data read as little endian words, ready to be stored in a header.
+
+*/
+
+
+#include "types.h"
+#include "ip.h"
+
+
+// Add len bytes to a running sum that is folded back to 16 bits at the end.
+// An odd final byte is padded with a zero, as if it were in the low byte.
+
+static uint32_t addWords( uint32_t sum, const uint8_t *data, uint16_t len ) {
+
+  while ( len > 1 ) {
+    sum += (uint16_t)(data[0] | (data[1] << 8));
+    data += 2;
+    len -= 2;
+  }
+
+  if ( len ) sum += data[0];
+
+  return sum;
+}
+
+
+static uint16_t fold( uint32_t sum ) {
+
+  while ( sum >> 16 ) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+
+  return (uint16_t)(~sum & 0xffff);
+}
+
+
+static uint32_t addPseudoHeader( const IpAddr_t src, const IpAddr_t target, uint8_t protocol, uint16_t len ) {
+
+  uint32_t sum = addWords( 0, src, 4 );
+  sum = addWords( sum, target, 4 );
+
+  // Zero byte and protocol, then the length, both in network byte order
+  sum += htons( protocol );
+  sum += htons( len );
+
+  return sum;
+}
+
+
+extern "C" uint16_t ipchksum( uint16_t *data, uint16_t len ) {
+  return fold( addWords( 0, (const uint8_t *)data, len ) );
+}
+
+
+extern "C" uint16_t ip_p_chksum( const IpAddr_t src, const IpAddr_t target, uint16_t *data, uint8_t protocol, uint16_t len ) {
+  uint32_t sum = addPseudoHeader( src, target, protocol, len );
+  return fold( addWords( sum, (const uint8_t *)data, len ) );
+}
+
+
+// The header is always an even number of bytes so the data that follows it
+// starts on a word boundary of the sum.
+
+extern "C" uint16_t ip_p_chksum2( const IpAddr_t src, const IpAddr_t target, uint16_t *data, uint8_t protocol, uint16_t len, uint16_t *data2, uint16_t len2 ) {
+  uint32_t sum = addPseudoHeader( src, target, protocol, len + len2 );
+  sum = addWords( sum, (const uint8_t *)data, len );
+  return fold( addWords( sum, (const uint8_t *)data2, len2 ) );
+}
@@ -0,0 +1,327 @@
+// DOS, BIOS and Open Watcom library calls made by the DOS sources, done with Linux
+// system calls instead. Declared by the headers in include/ and mTCP's INLINES.H.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <termios.h>
+#include <poll.h>
+#include <time.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include "dos.h"
+#include "bios.h"
+#include "process.h"
+#include "conio.h"
+#include "host.h"
+
+// Memory reported free by getFreeDOSMemory(), a 640KB machine with nothing else loaded
+#define HOST_CONVENTIONAL_MEMORY 655360L
+
+#define HOST_DOS_VERSION 0x1606
+
+#define HOST_INT_CTRL_BREAK 0x1B
+
+#define KEY_ESC 27
+#define KEY_DELETE 127
+#define KEY_BACKSPACE 8
+
+// Returned for keys that have no character, like the BIOS gives for arrow keys
+#define KEY_EXTENDED 0xE000
+
+#define KEY_BUFFER_SIZE 32
+
+#define PIT_CHANNEL_0 0x40
+#define PIT_COMMAND 0x43
+
+// Channel and access bits of a command to copy the count of channel 0
+#define PIT_LATCH_MASK 0xF0
+#define PIT_LATCH_CHANNEL_0 0x00
+
+// Same tick as TIMER_GET_CURRENT( ) on the host, see hosttmr.cpp
+#define PIT_TICK_US 55000
+#define PIT_COUNTS_PER_TICK 65536
+
+uint8_t hostLowMemory[HOST_LOW_MEMORY_SIZE];
+
+HostVector hostVectors[256];
+
+bool keyboardStarted = false;
+bool keyboardTerminal = false;
+bool keyboardEnded = false;
+struct termios keyboardSaved;
+
+unsigned char keyBuffer[KEY_BUFFER_SIZE];
+int keyBufferLength = 0;
+int keyBufferPos = 0;
+
+bool clockVirtual = false;
+uint32_t clockVirtualMs;
+
+// Count of timer channel 0 as last latched, read a byte at a time
+uint16_t pitLatchedCount = 0;
+bool pitReadHighByte = false;
+
+uint64_t host_clock_us(){
+    if(clockVirtual){
+        return (uint64_t) clockVirtualMs * 1000;
+    }
+
+    static struct timespec start;
+    static bool started = false;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if(!started){
+        start = now;
+        started = true;
+    }
+
+    return (uint64_t) (now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000;
+}
+
+uint32_t host_clock_ms(){
+    return (uint32_t) (host_clock_us() / 1000);
+}
+
+void host_clock_virtual(uint32_t startMs){
+    clockVirtual = true;
+    clockVirtualMs = startMs;
+}
+
+void host_clock_advance(uint32_t ms){
+    clockVirtualMs += ms;
+}
+
+bool host_clock_is_virtual(){
+    return clockVirtual;
+}
+
+int int86(int intno, union REGS * in, union REGS * out){
+    *out = *in;
+    out->x.cflag = 1;
+    return out->x.ax;
+}
+
+int int86x(int intno, union REGS * in, union REGS * out, struct SREGS * segs){
+    return int86(intno, in, out);
+}
+
+void segread(struct SREGS * segs){
+    memset(segs, 0, sizeof(struct SREGS));
+}
+
+void _disable(){
+}
+
+void _enable(){
+}
+
+// Channel 0 counts down from 65536 to 0 in every tick. The mode written to it is not
+// followed, the count always goes down once per input clock as in the rate generator mode.
+unsigned outp(unsigned port, unsigned value){
+    if(port == PIT_COMMAND){
+        if((value & PIT_LATCH_MASK) == PIT_LATCH_CHANNEL_0){
+            uint32_t usIntoTick = (uint32_t) (host_clock_us() % PIT_TICK_US);
+            pitLatchedCount = (uint16_t) (PIT_COUNTS_PER_TICK - (uint64_t) usIntoTick * PIT_COUNTS_PER_TICK / PIT_TICK_US);
+        }
+
+        pitReadHighByte = false;
+    }
+
+    return value;
+}
+
+unsigned inp(unsigned port){
+    if(port != PIT_CHANNEL_0){
+        return 0xFF;
+    }
+
+    unsigned value = pitReadHighByte ? pitLatchedCount >> 8 : pitLatchedCount & 0xFF;
+    pitReadHighByte = !pitReadHighByte;
+
+    return value;
+}
+
+void keyboard_restore(){
+    if(keyboardTerminal){
+        tcsetattr(STDIN_FILENO, TCSANOW, &keyboardSaved);
+    }
+}
+
+// SIGINT is what Ctrl-C and Ctrl-Break become on a terminal
+void host_break(int signal){
+    if(hostVectors[HOST_INT_CTRL_BREAK] != NULL){
+        hostVectors[HOST_INT_CTRL_BREAK]();
+        return;
+    }
+
+    keyboard_restore();
+    ::signal(SIGINT, SIG_DFL);
+    raise(SIGINT);
+}
+
+HostVector _dos_getvect(unsigned intno){
+    return hostVectors[intno & 0xFF];
+}
+
+void _dos_setvect(unsigned intno, HostVector handler){
+    hostVectors[intno & 0xFF] = handler;
+
+    if(intno == HOST_INT_CTRL_BREAK){
+        signal(SIGINT, host_break);
+    }
+}
+
+// The DOS programs asked for, like the speech driver loader, do not exist here
+int spawnlp(int mode, const char * path, const char * arg0, ...){
+    return -1;
+}
+
+void _dos_gettime(struct dostime_t * dosTime){
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    struct tm * local = localtime(&now.tv_sec);
+
+    dosTime->hour = local->tm_hour;
+    dosTime->minute = local->tm_min;
+    dosTime->second = local->tm_sec;
+    dosTime->hsecond = now.tv_nsec / 10000000L;
+}
+
+void _dos_getdate(struct dosdate_t * dosDate){
+    time_t now = time(NULL);
+    struct tm * local = localtime(&now);
+
+    dosDate->day = local->tm_mday;
+    dosDate->month = local->tm_mon + 1;
+    dosDate->year = local->tm_year + 1900;
+    dosDate->dayofweek = local->tm_wday;
+}
+
+// Keys are read without waiting for Enter or echoing them, like the BIOS keyboard buffer
+void keyboard_start(){
+    keyboardStarted = true;
+    keyboardTerminal = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &keyboardSaved) == 0;
+
+    if(keyboardTerminal){
+        struct termios raw = keyboardSaved;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+        atexit(keyboard_restore);
+    }
+
+    if(hostVectors[HOST_INT_CTRL_BREAK] == NULL){
+        signal(SIGINT, host_break);
+    }
+}
+
+// Fill the key buffer with whatever has been typed. Returns false if there is nothing.
+bool keyboard_fill(bool wait){
+    if(keyBufferPos < keyBufferLength){
+        return true;
+    }
+
+    if(keyboardEnded){
+        return false;
+    }
+
+    struct pollfd input;
+    input.fd = STDIN_FILENO;
+    input.events = POLLIN;
+
+    if(poll(&input, 1, wait ? -1 : 0) <= 0){
+        return false;
+    }
+
+    int length = read(STDIN_FILENO, keyBuffer, KEY_BUFFER_SIZE);
+
+    // Input given through a pipe has ended, no more keys will come
+    if(length <= 0){
+        keyboardEnded = true;
+        return false;
+    }
+
+    keyBufferLength = length;
+    keyBufferPos = 0;
+    return true;
+}
+
+// Character of the next key. A terminal escape sequence for a key without a character
+// is skipped here, otherwise the ESC starting it would be taken as the ESC key.
+unsigned short keyboard_next(bool take){
+    int pos = keyBufferPos;
+    unsigned char c = keyBuffer[pos++];
+    unsigned short key = c;
+
+    if(c == '\n'){
+        key = '\r';
+    } else if(c == KEY_DELETE){
+        key = KEY_BACKSPACE;
+    } else if(c == KEY_ESC && pos < keyBufferLength && (keyBuffer[pos] == '[' || keyBuffer[pos] == 'O')){
+        pos++;
+
+        // Parameters then a final byte from @ to ~
+        while(pos < keyBufferLength && (keyBuffer[pos] < '@' || keyBuffer[pos] > '~')){
+            pos++;
+        }
+
+        pos++;
+        key = KEY_EXTENDED;
+    } else if(c == 0){
+        key = KEY_EXTENDED;
+    }
+
+    if(take){
+        keyBufferPos = pos;
+    }
+
+    return key;
+}
+
+unsigned short _bios_keybrd(unsigned service){
+    if(!keyboardStarted){
+        keyboard_start();
+    }
+
+    if(service == _KEYBRD_READY){
+        return keyboard_fill(false) ? keyboard_next(false) : 0;
+    }
+
+    return keyboard_fill(true) ? keyboard_next(true) : 0;
+}
+
+// Functions from mTCP INLINES.H and UTILS.H, done with inline assembly on DOS
+
+uint16_t htons(uint16_t value){
+    return (uint16_t) ((value << 8) | (value >> 8));
+}
+
+uint32_t htonl(uint32_t value){
+    return ((uint32_t) htons(value & 0xFFFF) << 16) | htons(value >> 16);
+}
+
+uint16_t dosVersion(){
+    return HOST_DOS_VERSION;
+}
+
+// What the heap has handed out is counted against 640KB so memory use can still be compared
+uint16_t getFreeDOSMemory(){
+    long used = (long) mallinfo2().uordblks;
+    long freeBytes = HOST_CONVENTIONAL_MEMORY - used;
+
+    return freeBytes > 0 ? (uint16_t) (freeBytes / 16) : 0;
+}
+
+void dosIdleCall(){
+}
+
+// Not supported, so mTCP never calls it after the first time
+uint8_t releaseTimeslice(){
+    return 0x80;
+}
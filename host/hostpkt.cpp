@@ -0,0 +1,308 @@
+/*
+
+   Host build replacement for PACKET.CPP
+
+   The buffer management is the same as the DOS version.  Instead of a
+   packet driver calling the receiver function from an interrupt, frames
+   are taken off the simulated wire (see wire.h) by Packet_poll, which
+   SLEEP( ) calls while the stack waits.  A frame that arrives when there
+   is no free buffer is dropped and counted, like the real receiver does.
+
+*/
+
+
+#include <dos.h>
+#include <malloc.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "packet.h"
+#include "trace.h"
+#include "utils.h"
+#include "wire.h"
+
+#ifdef IP_FRAGMENTS_ON
+#include "ip.h"
+#endif
+
+
+// Ring buffer of received packets and the free stack, see PACKET.CPP.
+
+static uint8_t *Buffer[ PACKET_RB_SIZE ];
+static uint16_t Buffer_len[ PACKET_RB_SIZE ];
+
+uint8_t   Buffer_first;
+uint8_t   Buffer_next;
+
+static uint8_t  *Buffer_fs[ PACKET_BUFFERS ];
+static uint8_t   Buffer_fs_index;
+
+static void     *BufferMemPtr;
+
+uint8_t   Buffer_lowFreeCount;
+
+
+int8_t Buffer_init( void ) {
+
+  uint8_t *tmp = (uint8_t *)(malloc( PACKET_BUFFERS * PACKET_BUFFER_LEN ));
+  if ( tmp == NULL ) {
+    return -1;
+  }
+
+  BufferMemPtr = tmp;
+
+  for ( uint8_t i=0; i < PACKET_BUFFERS; i++ ) {
+    Buffer_fs[i] = tmp + (i*PACKET_BUFFER_LEN);
+  }
+
+  Buffer_fs_index = 0;
+
+  Buffer_lowFreeCount = PACKET_BUFFERS;
+
+  Buffer_first = 0;
+  Buffer_next = 0;
+
+  return 0;
+}
+
+
+void Buffer_startReceiving( void ) { Buffer_fs_index = PACKET_BUFFERS; }
+
+
+void Buffer_free( const uint8_t *buffer ) {
+
+  #ifdef IP_FRAGMENTS_ON
+    if ( Ip::isIpBigPacket( buffer ) ) {
+      Ip::returnBigPacket( (uint8_t *)buffer );
+      return;
+    }
+  #endif
+
+  Buffer_fs[ Buffer_fs_index ] = (uint8_t *)buffer;
+  Buffer_fs_index++;
+}
+
+
+void Buffer_stopReceiving( void ) { Buffer_fs_index = 0; }
+
+
+void Buffer_stop( void ) {
+  if ( BufferMemPtr ) free( BufferMemPtr );
+  BufferMemPtr = NULL;
+}
+
+
+
+
+//--------------------------------------------------------------------------
+//
+// Packet driver data
+
+uint32_t Packets_dropped = 0;
+uint32_t Packets_received = 0;
+uint32_t Packets_sent = 0;
+uint32_t Packets_send_errs = 0;
+uint32_t Packets_send_retries = 0;
+
+const char * PKT_DRVR_EYE_CATCHER = "PKT DRVR";
+
+static uint16_t Packet_handle;
+static uint8_t  Packet_int = 0x0;
+
+
+
+//--------------------------------------------------------------------------
+//
+// EtherType registration data and code
+
+void (*Packet_EtherTypeHandler[PACKET_HANDLERS])(uint8_t *packet, uint16_t len);
+
+EtherType Packet_EtherTypeVal[PACKET_HANDLERS];
+
+uint8_t  Packet_EtherTypeHandlers = 0;
+
+void (*Packet_typeUnhandled)(uint8_t *packet, uint16_t len);
+
+
+int8_t Packet_registerEtherType( EtherType val, void (*f)(uint8_t *packet, uint16_t) ) {
+  if (Packet_EtherTypeHandlers == PACKET_HANDLERS ) return -1;
+  Packet_EtherTypeVal[ Packet_EtherTypeHandlers ] = htons( val );
+  Packet_EtherTypeHandler[ Packet_EtherTypeHandlers ] = f;
+  Packet_EtherTypeHandlers++;
+  return 0;
+}
+
+void Packet_registerDefault( void (*f)(uint8_t *packet, uint16_t) ) {
+  Packet_typeUnhandled = f;
+}
+
+
+
+
+//--------------------------------------------------------------------------
+//
+// Simulated packet driver
+
+
+// Packet_poll
+//
+// Does the job of the receiver function.  Every frame waiting on the wire
+// goes into a free buffer at the head of the ring.  The wire is only
+// allowed to wait for the host when there is nothing for the stack to do.
+
+void Packet_poll( void ) {
+
+  wire_poll( (Buffer_first == Buffer_next) ? 1 : 0 );
+
+  while ( 1 ) {
+
+    if ( Buffer_fs_index == 0 ) {
+
+      // No buffer to receive into; take the frame and drop it.
+      uint8_t scratch[ WIRE_FRAME_SIZE ];
+      if ( wire_receive( scratch, sizeof( scratch ) ) == 0 ) break;
+      Packets_dropped++;
+      continue;
+    }
+
+    uint8_t *packet = Buffer_fs[ Buffer_fs_index - 1 ];
+    uint16_t len = wire_receive( packet, PACKET_BUFFER_LEN );
+
+    if ( len == 0 ) break;
+
+    #ifdef TORTURE_TEST_PACKET_LOSS
+    if ( (rand() % TORTURE_TEST_PACKET_LOSS) == 0 ) {
+      Packets_dropped++;
+      continue;
+    }
+    #endif
+
+    Buffer_fs_index--;
+    Packets_received++;
+    Buffer[ Buffer_next ] = packet;
+    Buffer_len[ Buffer_next ] = len;
+
+    Buffer_next++;
+    if ( Buffer_next == PACKET_RB_SIZE ) Buffer_next = 0;
+
+    if (Buffer_lowFreeCount > Buffer_fs_index ) {
+      Buffer_lowFreeCount = Buffer_fs_index;
+    }
+  }
+}
+
+
+// Packet_init
+//
+// There is no packet driver to look for; the software interrupt number is
+// only remembered.  Connecting the wire is the equivalent of access_type.
+
+int8_t Packet_init( uint8_t packetInt ) {
+
+  if ( !wire_open( ) ) {
+    TRACE_WARN(( "Packet: cannot open the host wire\n" ));
+    return -1;
+  }
+
+  Packet_int = packetInt;
+  Packet_handle = 1;
+
+  return 0;
+}
+
+
+int8_t Packet_release_type( void ) {
+  wire_close( );
+  TRACE(( "Packet: Handle released\n" ));
+  return 0;
+}
+
+
+void Packet_get_addr( uint8_t *target ) { wire_address( target ); }
+
+
+void Packet_send_pkt( void *buffer, uint16_t bufferLen ) {
+
+  Packets_sent++;
+
+  #ifdef TORTURE_TEST_PACKET_LOSS
+    if ( (rand() % TORTURE_TEST_PACKET_LOSS) == 0 ) {
+      return;
+    }
+  #endif
+
+  #ifndef NOTRACE
+  if ( TRACE_ON_DUMP ) {
+    uint16_t dumpLen = ( bufferLen > PKT_DUMP_BYTES ? PKT_DUMP_BYTES : bufferLen );
+    TRACE(( "Packet: Sending %u bytes, dumping %u\n", bufferLen, dumpLen ));
+    Utils::dumpBytes( Trace_Stream, (unsigned char *)buffer, dumpLen );
+  }
+  #endif
+
+  // Pad runt frames like the DOS version does, but with zeros so that the
+  // other end sees the same thing every run.
+
+  if ( bufferLen < 60 ) {
+    uint8_t runt[60];
+    memset( runt, 0, sizeof( runt ) );
+    memcpy( runt, buffer, bufferLen );
+    wire_send( runt, sizeof( runt ) );
+    return;
+  }
+
+  if ( bufferLen > WIRE_FRAME_SIZE ) {
+    TRACE_WARN(( "Packet: send error\n" ));
+    Packets_send_errs++;
+    return;
+  }
+
+  wire_send( (uint8_t *)buffer, bufferLen );
+}
+
+
+void Packet_process_internal( void ) {
+
+  uint8_t *packet = Buffer[ Buffer_first ];
+  uint16_t packet_len = Buffer_len[ Buffer_first ];
+  Buffer_first++;
+  if ( Buffer_first == PACKET_RB_SIZE ) Buffer_first = 0;
+
+
+  #ifndef NOTRACE
+  if ( TRACE_ON_DUMP ) {
+    uint16_t dumpLen = ( packet_len > PKT_DUMP_BYTES ? PKT_DUMP_BYTES : packet_len );
+    TRACE(( "Packet: Received %u bytes, dumping %u\n", packet_len, dumpLen ));
+    Utils::dumpBytes( Trace_Stream, packet, dumpLen );
+  }
+  #endif
+
+
+  EtherType protocol = ((uint16_t *)packet)[6];
+
+  for ( uint8_t i=0; i < Packet_EtherTypeHandlers; i++ ) {
+    if ( Packet_EtherTypeVal[i] == protocol ) {
+      Packet_EtherTypeHandler[i]( packet, packet_len );
+      return;
+    }
+  }
+
+  if ( Packet_typeUnhandled ) {
+    Packet_typeUnhandled( packet, packet_len );
+  } else {
+    Buffer_free( packet );
+  }
+}
+
+
+
+void Packet_dumpStats( FILE *stream ) {
+  fprintf( stream, "Pkt: Sent %lu Rcvd %lu Dropped %lu SndErrs %lu LowFreeBufs %u SndRetries %u\n",
+          (unsigned long)Packets_sent, (unsigned long)Packets_received, (unsigned long)Packets_dropped,
+          (unsigned long)Packets_send_errs, Buffer_lowFreeCount, (unsigned)Packets_send_retries );
+};
+
+
+uint8_t  Packet_getSoftwareInt( void ) { return Packet_int; }
+
+uint16_t Packet_getHandle( void ) { return Packet_handle; }
@@ -0,0 +1,20 @@
+// Host build replacement for screen.cpp. There is no video buffer to write into, all
+// text goes to stdout and the terminal does the wrapping and scrolling.
+
+#include <stdio.h>
+
+#include "screen.h"
+
+#define SCREEN_COLUMNS_DEFAULT 80
+
+void screen_init(){
+}
+
+int screen_columns(){
+    return SCREEN_COLUMNS_DEFAULT;
+}
+
+void screen_write(const char * str, int length){
+    fwrite(str, sizeof(char), length, stdout);
+    fflush(stdout);
+}
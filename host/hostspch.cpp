@@ -0,0 +1,40 @@
+// Host build replacement for speech.cpp. The First Byte engine is never resident, so
+// sound.cpp reports text-to-speech as not available.
+
+#include "speech.h"
+
+short DetectSpeech(void){
+    return 0;
+}
+
+short SetGlobals(short gen, short ton, short vol, short pit, short spd){
+    return 0;
+}
+
+short Parser(char * engstr, char * phonstr, unsigned short count){
+    return -1;
+}
+
+short Say(char * engstr){
+    return 0;
+}
+
+short SetEcho(short parm){
+    return 0;
+}
+
+short ResetSpeech(void){
+    return 0;
+}
+
+short SpeakM(char * phonstr, short ton, short vol, short pit, short spd){
+    return 0;
+}
+
+short SpeakF(char * phonstr, short ton, short vol, short pit, short spd){
+    return 0;
+}
+
+short SpeechVersion(void){
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*
+
+   Host build replacement for TIMER.CPP
+
+   There is no timer interrupt to hook on the host.  The tick count is
+   worked out from the host clock whenever TIMER_GET_CURRENT( ) asks for it
+   and the countdown timers are brought up to date at the same time.  The
+   count is also kept in the BIOS data area at 0040:006C like the BIOS does.
+
+*/
+
+
+#include <dos.h>
+
+#include "timer.h"
+#include "host.h"
+
+
+#define BIOS_TICK_COUNT_ADDR (0x46C)
+
+
+volatile clockTicks_t Timer_CurrentTicks = 0;
+
+static uint8_t timer_hooked = 0;
+
+static uint16_t *countdownTimers[10];
+static uint16_t  activeTimers = 0;
+
+
+clockTicks_t Timer_hostTicks( void ) {
+
+  clockTicks_t now = host_clock_ms( ) / TIMER_TICK_LEN;
+
+  if ( !timer_hooked || now == Timer_CurrentTicks ) return now;
+
+  clockTicks_t elapsed = now - Timer_CurrentTicks;
+
+  for ( int i=0; i < activeTimers; i++ ) {
+    if ( *countdownTimers[i] > elapsed ) {
+      *countdownTimers[i] -= elapsed;
+    }
+    else {
+      *countdownTimers[i] = 0;
+    }
+  }
+
+  Timer_CurrentTicks = now;
+  *((uint32_t *)(hostLowMemory + BIOS_TICK_COUNT_ADDR)) = now;
+
+  return now;
+}
+
+
+void Timer_start( void ) {
+  Timer_CurrentTicks = host_clock_ms( ) / TIMER_TICK_LEN;
+  timer_hooked = 1;
+}
+
+
+void Timer_stop( void ) {
+  timer_hooked = 0;
+}
+
+
+void Timer_manageTimer( uint16_t *p ) {
+  if (activeTimers < 10) {
+    countdownTimers[activeTimers] = p;
+    activeTimers++;
+  }
+}
+
+void Timer_stopManagingTimer( uint16_t *p ) {
+  for ( int i=0; i < activeTimers; i++ ) {
+    if ( countdownTimers[i] == p ) {
+      countdownTimers[i] = countdownTimers[activeTimers-1];
+      activeTimers--;
+      break;
+    }
+  }
+}
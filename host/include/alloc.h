@@ -0,0 +1,3 @@
+// Borland <alloc.h> for the host build, the allocation functions are in <stdlib.h>.
+
+#include <stdlib.h>
@@ -0,0 +1,13 @@
+// Open Watcom <bios.h> for the host build, implemented in ../hostdos.cpp
+
+#ifndef HOST_BIOS_H
+#define HOST_BIOS_H
+
+#define _KEYBRD_READ 0
+#define _KEYBRD_READY 1
+
+// Keys come from stdin, unbuffered and without echo when it is a terminal.
+// Enter is given as '\r' and Backspace as 8 like the BIOS does.
+unsigned short _bios_keybrd(unsigned service);
+
+#endif
@@ -0,0 +1,12 @@
+// Open Watcom <conio.h> for the host build, implemented in ../hostdos.cpp. DNS.CPP includes it
+// without using anything in it.
+
+#ifndef HOST_CONIO_H
+#define HOST_CONIO_H
+
+// Only channel 0 of the timer chip at ports 40h and 43h is there, counting through each
+// 55 ms tick of the host clock. Reading any other port gives FFh and writes are ignored.
+unsigned inp(unsigned port);
+unsigned outp(unsigned port, unsigned value);
+
+#endif
@@ -0,0 +1,66 @@
+// Open Watcom <dos.h> for the host build. Only what the sources built on the host use,
+// implemented in ../hostdos.cpp.
+
+#ifndef HOST_DOS_H
+#define HOST_DOS_H
+
+#include <stdint.h>
+#include <string.h>
+
+union REGS
+{
+    struct { uint16_t ax, bx, cx, dx, si, di, cflag; } x;
+    struct { uint8_t al, ah, bl, bh, cl, ch, dl, dh; } h;
+};
+
+struct SREGS
+{
+    uint16_t es, cs, ss, ds;
+};
+
+struct dostime_t
+{
+    uint8_t hour, minute, second, hsecond;
+};
+
+struct dosdate_t
+{
+    uint8_t day, month;
+    uint16_t year;
+    uint8_t dayofweek;
+};
+
+// Nothing answers software interrupts, the registers come back unchanged with carry set
+int int86(int intno, union REGS * in, union REGS * out);
+int int86x(int intno, union REGS * in, union REGS * out, struct SREGS * segs);
+void segread(struct SREGS * segs);
+
+// Interrupt handlers. Ctrl-Break (1Bh) is raised by SIGINT, nothing else is ever called.
+typedef void (*HostVector)();
+HostVector _dos_getvect(unsigned intno);
+void _dos_setvect(unsigned intno, HostVector handler);
+
+// Nothing interrupts the host build, so there are no interrupts to mask
+void _disable();
+void _enable();
+
+void _dos_gettime(struct dostime_t * time);
+void _dos_getdate(struct dosdate_t * date);
+
+// The address space is flat, a pointer is all offset. Segment:offset addresses given
+// by number only reach the interrupt vector table and BIOS data area kept in
+// hostLowMemory, e.g. the tick count at 0040:006C.
+#define HOST_LOW_MEMORY_SIZE 0x500
+
+extern uint8_t hostLowMemory[HOST_LOW_MEMORY_SIZE];
+
+#define MK_FP(seg, off) ((void *) (hostLowMemory + (((uint32_t) (seg)) << 4) + (off)))
+#define FP_SEG(p) (0)
+#define FP_OFF(p) ((uintptr_t) (p))
+
+#define _fmemcmp memcmp
+#define _fmemcpy memcpy
+#define _fmemmove memmove
+#define _fmemset memset
+
+#endif
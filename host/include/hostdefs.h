@@ -0,0 +1,31 @@
+// Included ahead of every DOS source in the host build, see ../CMakeLists.txt.
+//
+// The C library headers the DOS sources use are read here first so their structures
+// keep the layout the host library was built with. Everything after is packed to 2 bytes
+// like -zp2 in the DOS MAKEFILE, the mTCP protocol headers are laid over packets and
+// only match the wire without padding.
+
+#ifndef HOSTDEFS_H
+#define HOSTDEFS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <strings.h>
+#include <sys/types.h>
+
+// Open Watcom names of library functions
+#define stricmp strcasecmp
+#define strnicmp strncasecmp
+#define flushall() fflush(NULL)
+
+#pragma pack(2)
+
+#endif
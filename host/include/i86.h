@@ -0,0 +1,2 @@
+// Open Watcom <i86.h>, the same declarations as <dos.h> on the host
+#include <dos.h>
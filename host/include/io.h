@@ -0,0 +1,2 @@
+// Open Watcom <io.h>, isatty() and friends are in <unistd.h> on the host
+#include <unistd.h>
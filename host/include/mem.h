@@ -0,0 +1,3 @@
+// Borland <mem.h> for the host build, the memory functions are in <string.h>.
+
+#include <string.h>
@@ -0,0 +1,11 @@
+// Open Watcom <process.h> for the host build, implemented in ../hostdos.cpp.
+
+#ifndef HOST_PROCESS_H
+#define HOST_PROCESS_H
+
+#define P_WAIT 0
+
+// DOS programs cannot be run on the host, always fails
+int spawnlp(int mode, const char * path, const char * arg0, ...);
+
+#endif
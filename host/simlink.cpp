@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simlink.h"
+#include "host.h"
+
+// Preamble, frame check sequence and gap between frames also take time on the wire
+#define SIMLINK_FRAME_OVERHEAD 24
+
+#define SIMLINK_QUEUE_FRAMES_MAX 128
+#define SIMLINK_QUEUE_FRAMES_DEFAULT 64
+#define SIMLINK_REORDER_DELAY_DEFAULT 10
+
+#define SIMLINK_KEY_SIZE 16
+
+typedef struct
+{
+    bool used;
+
+    // Microseconds on the host clock when the frame is at the far end
+    uint64_t arrivalUs;
+
+    // Frames arriving at the same time are delivered in the order they were sent
+    uint32_t order;
+
+    uint16_t length;
+    uint8_t data[SIMLINK_FRAME_SIZE];
+
+} SIMLINK_FRAME;
+
+typedef struct
+{
+    SIMLINK_FRAME frames[SIMLINK_QUEUE_FRAMES_MAX];
+    int count;
+
+    // When the last frame queued is done being sent
+    uint64_t freeAtUs;
+
+    SIMLINK_STATS stats;
+
+} SIMLINK_DIRECTION;
+
+SIMLINK_CONFIG linkConfig;
+SIMLINK_DIRECTION * linkDirections = NULL;
+
+uint32_t linkRandom;
+uint32_t linkOrder;
+
+// xorshift32, the same numbers on every host unlike rand()
+uint32_t simlink_random(){
+    linkRandom ^= linkRandom << 13;
+    linkRandom ^= linkRandom >> 17;
+    linkRandom ^= linkRandom << 5;
+    return linkRandom;
+}
+
+bool simlink_chance(double percent){
+    return percent > 0 && (simlink_random() % 100000) < (uint32_t) (percent * 1000);
+}
+
+uint64_t simlink_now_us(){
+    return (uint64_t) host_clock_ms() * 1000;
+}
+
+void simlink_defaults(SIMLINK_CONFIG * config){
+    memset(config, 0, sizeof(SIMLINK_CONFIG));
+    config->seed = 1;
+    config->reorderDelayMs = SIMLINK_REORDER_DELAY_DEFAULT;
+    config->queueFrames = SIMLINK_QUEUE_FRAMES_DEFAULT;
+}
+
+bool simlink_parse(const char * description, SIMLINK_CONFIG * config){
+    simlink_defaults(config);
+
+    const char * pos = description;
+
+    while(*pos != '\0'){
+        char key[SIMLINK_KEY_SIZE];
+        int keyLength = 0;
+
+        while(*pos != '=' && *pos != '\0' && *pos != ','){
+            if(keyLength < SIMLINK_KEY_SIZE - 1){
+                key[keyLength++] = *pos;
+            }
+            pos++;
+        }
+
+        key[keyLength] = '\0';
+
+        if(*pos != '='){
+            return false;
+        }
+
+        char * end;
+        double value = strtod(++pos, &end);
+
+        if(end == pos || value < 0){
+            return false;
+        }
+
+        pos = *end == ',' ? end + 1 : end;
+
+        if(strcmp(key, "seed") == 0){
+            config->seed = (uint32_t) value;
+        } else if(strcmp(key, "latency") == 0){
+            config->latencyMs = (uint16_t) value;
+        } else if(strcmp(key, "rate") == 0){
+            config->rate = (uint32_t) value;
+        } else if(strcmp(key, "loss") == 0){
+            config->lossPercent = value;
+        } else if(strcmp(key, "dup") == 0){
+            config->duplicatePercent = value;
+        } else if(strcmp(key, "reorder") == 0){
+            config->reorderPercent = value;
+        } else if(strcmp(key, "delay") == 0){
+            config->reorderDelayMs = (uint16_t) value;
+        } else if(strcmp(key, "queue") == 0){
+            config->queueFrames = (uint16_t) value;
+        } else {
+            return false;
+        }
+    }
+
+    if(config->queueFrames < 1 || config->queueFrames > SIMLINK_QUEUE_FRAMES_MAX){
+        return false;
+    }
+
+    return true;
+}
+
+bool simlink_open(const SIMLINK_CONFIG * config){
+    linkDirections = (SIMLINK_DIRECTION *) calloc(SIMLINK_DIRECTIONS, sizeof(SIMLINK_DIRECTION));
+
+    if(linkDirections == NULL){
+        return false;
+    }
+
+    linkConfig = *config;
+
+    // Zero would only ever give zero
+    linkRandom = config->seed != 0 ? config->seed : 1;
+    linkOrder = 0;
+
+    return true;
+}
+
+void simlink_close(){
+    free(linkDirections);
+    linkDirections = NULL;
+}
+
+bool simlink_enabled(){
+    return linkDirections != NULL;
+}
+
+// Add a copy of the frame arriving at the given time. Returns false if the queue is full.
+bool simlink_queue(SIMLINK_DIRECTION * link, const uint8_t * frame, uint16_t length, uint64_t arrivalUs){
+    if(link->count >= linkConfig.queueFrames){
+        link->stats.framesOverflowed++;
+        return false;
+    }
+
+    for(int i = 0; i < SIMLINK_QUEUE_FRAMES_MAX; i++){
+        SIMLINK_FRAME * slot = &link->frames[i];
+
+        if(!slot->used){
+            slot->used = true;
+            slot->arrivalUs = arrivalUs;
+            slot->order = linkOrder++;
+            slot->length = length;
+            memcpy(slot->data, frame, length);
+            link->count++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void simlink_send(int direction, const uint8_t * frame, uint16_t length){
+    if(linkDirections == NULL || length > SIMLINK_FRAME_SIZE){
+        return;
+    }
+
+    SIMLINK_DIRECTION * link = &linkDirections[direction];
+    link->stats.framesSent++;
+
+    // A full queue drops the frame before it takes any time on the wire
+    if(link->count >= linkConfig.queueFrames){
+        link->stats.framesOverflowed++;
+        return;
+    }
+
+    uint64_t now = simlink_now_us();
+    uint64_t sendUs = linkConfig.rate > 0 ? (uint64_t) (length + SIMLINK_FRAME_OVERHEAD) * 8 * 1000000 / linkConfig.rate : 0;
+    uint64_t start = link->freeAtUs > now ? link->freeAtUs : now;
+
+    link->freeAtUs = start + sendUs;
+
+    // A lost frame still took its time on the wire
+    if(simlink_chance(linkConfig.lossPercent)){
+        link->stats.framesLost++;
+        return;
+    }
+
+    uint64_t arrivalUs = link->freeAtUs + (uint64_t) linkConfig.latencyMs * 1000;
+
+    if(simlink_chance(linkConfig.reorderPercent)){
+        arrivalUs += (uint64_t) linkConfig.reorderDelayMs * 1000;
+        link->stats.framesReordered++;
+    }
+
+    if(!simlink_queue(link, frame, length, arrivalUs)){
+        return;
+    }
+
+    // The copy follows straight after the frame
+    if(simlink_chance(linkConfig.duplicatePercent) && simlink_queue(link, frame, length, arrivalUs + sendUs)){
+        link->stats.framesDuplicated++;
+    }
+}
+
+// Frame that arrives first, NULL if there is none on the link
+SIMLINK_FRAME * simlink_first(SIMLINK_DIRECTION * link){
+    SIMLINK_FRAME * first = NULL;
+
+    for(int i = 0; i < SIMLINK_QUEUE_FRAMES_MAX && link->count > 0; i++){
+        SIMLINK_FRAME * slot = &link->frames[i];
+
+        if(slot->used && (first == NULL || slot->arrivalUs < first->arrivalUs || (slot->arrivalUs == first->arrivalUs && (int32_t) (slot->order - first->order) < 0))){
+            first = slot;
+        }
+    }
+
+    return first;
+}
+
+uint16_t simlink_receive(int direction, uint8_t * frame, uint16_t size){
+    if(linkDirections == NULL){
+        return 0;
+    }
+
+    SIMLINK_DIRECTION * link = &linkDirections[direction];
+    SIMLINK_FRAME * first = simlink_first(link);
+
+    if(first == NULL || first->arrivalUs > simlink_now_us()){
+        return 0;
+    }
+
+    uint16_t length = first->length < size ? first->length : size;
+    memcpy(frame, first->data, length);
+
+    first->used = false;
+    link->count--;
+    link->stats.framesDelivered++;
+    link->stats.bytesDelivered += length;
+
+    return length;
+}
+
+int32_t simlink_next_arrival(){
+    if(linkDirections == NULL){
+        return -1;
+    }
+
+    uint64_t now = simlink_now_us();
+    int32_t next = -1;
+
+    for(int direction = 0; direction < SIMLINK_DIRECTIONS; direction++){
+        SIMLINK_FRAME * first = simlink_first(&linkDirections[direction]);
+
+        if(first == NULL){
+            continue;
+        }
+
+        // Rounded up so that waiting this long is enough
+        int32_t untilArrival = first->arrivalUs > now ? (int32_t) ((first->arrivalUs - now + 999) / 1000) : 0;
+
+        if(next < 0 || untilArrival < next){
+            next = untilArrival;
+        }
+    }
+
+    return next;
+}
+
+const SIMLINK_STATS * simlink_stats(int direction){
+    return linkDirections != NULL ? &linkDirections[direction].stats : NULL;
+}
@@ -0,0 +1,78 @@
+// Simulated link between the host packet driver and the gateway. Frames are delayed by the
+// latency and the time to send them at the link rate, and can be lost, duplicated or held
+// back so that later frames overtake them. Random choices come from a seeded generator of
+// its own, so the same seed and traffic give the same frames every run.
+//
+// Set HOSTLINK to a description like "seed=7,latency=2,rate=10000000,loss=1.5" to use it,
+// see simlink_parse().
+
+#include <stdint.h>
+
+#define SIMLINK_TO_GATEWAY 0
+#define SIMLINK_TO_STACK 1
+#define SIMLINK_DIRECTIONS 2
+
+#define SIMLINK_FRAME_SIZE 1514
+
+typedef struct
+{
+    uint32_t seed;
+
+    // One way delay in ms
+    uint16_t latencyMs;
+
+    // Bits per second each way, 0 for no limit
+    uint32_t rate;
+
+    // Chances in percent for each frame
+    double lossPercent;
+    double duplicatePercent;
+    double reorderPercent;
+
+    // Extra delay of a frame that is held back
+    uint16_t reorderDelayMs;
+
+    // Frames waiting to be sent each way before more are dropped
+    uint16_t queueFrames;
+
+} SIMLINK_CONFIG;
+
+typedef struct
+{
+    uint32_t framesSent;
+    uint32_t framesDelivered;
+    uint32_t framesLost;
+    uint32_t framesDuplicated;
+    uint32_t framesReordered;
+
+    // Dropped because the queue was full
+    uint32_t framesOverflowed;
+
+    uint32_t bytesDelivered;
+
+} SIMLINK_STATS;
+
+// Defaults for a description that leaves something out: no delay, loss or rate limit
+void simlink_defaults(SIMLINK_CONFIG * config);
+
+// Read comma separated key=value pairs over the defaults. Keys are seed, latency (ms),
+// rate (bits per second), loss, dup and reorder (percent), delay (ms a held back frame
+// waits) and queue (frames). Returns false for anything else.
+bool simlink_parse(const char * description, SIMLINK_CONFIG * config);
+
+bool simlink_open(const SIMLINK_CONFIG * config);
+
+void simlink_close();
+
+bool simlink_enabled();
+
+// Put a frame on the link in one direction
+void simlink_send(int direction, const uint8_t * frame, uint16_t length);
+
+// Next frame that has arrived by now. Returns its length or 0 if there is none.
+uint16_t simlink_receive(int direction, uint8_t * frame, uint16_t size);
+
+// Milliseconds until the next frame arrives either way, 0 if one has, -1 if none is on the link
+int32_t simlink_next_arrival();
+
+const SIMLINK_STATS * simlink_stats(int direction);
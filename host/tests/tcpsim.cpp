@@ -0,0 +1,236 @@
+// TCP throughput of the mTCP stack over a simulated link, for regression tests.
+//
+// tcpsim <recv|send> <bytes> [link description] [time limit ms]
+//
+// recv reads the bytes from the source service of the gateway and send writes them to the
+// discard service, see gateway.h. The link description is the same as HOSTLINK, see
+// simlink.h. The clock is virtual so the same arguments always give the same results,
+// however fast the host is. Returns 0 if all bytes arrived intact within the time limit.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "utils.h"
+#include "packet.h"
+#include "arp.h"
+#include "tcp.h"
+#include "tcpsockm.h"
+#include "timer.h"
+
+#include "host.h"
+#include "gateway.h"
+#include "simlink.h"
+
+#define TCPSIM_LINK_ENV "HOSTLINK"
+
+// Where the virtual clock starts, after the stack is up
+#define TCPSIM_START_MS 10000
+
+#define TCPSIM_TIME_LIMIT_DEFAULT 600000
+
+#define TCPSIM_RECV_BUFFER_SIZE 8192
+#define TCPSIM_CHUNK_SIZE 1024
+#define TCPSIM_LOCAL_PORT 2048
+
+#define TCPSIM_STATE_CONNECTING 0
+#define TCPSIM_STATE_TRANSFER 1
+#define TCPSIM_STATE_CLOSING 2
+#define TCPSIM_STATE_DONE 3
+
+bool tcpsimStop = false;
+
+void __interrupt __far tcpsim_ctrl_break(){
+    tcpsimStop = true;
+}
+
+void __interrupt __far tcpsim_ctrl_c(){
+    tcpsimStop = true;
+}
+
+void tcpsim_drive_packets(){
+    PACKET_PROCESS_SINGLE;
+    Arp::driveArp();
+    Tcp::drivePackets();
+}
+
+void tcpsim_print_link(const char * name, int direction){
+    const SIMLINK_STATS * stats = simlink_stats(direction);
+
+    if(stats == NULL){
+        return;
+    }
+
+    printf("Link %s: sent %lu, delivered %lu, lost %lu, duplicated %lu, reordered %lu, overflowed %lu\n", name,
+        (unsigned long) stats->framesSent, (unsigned long) stats->framesDelivered, (unsigned long) stats->framesLost,
+        (unsigned long) stats->framesDuplicated, (unsigned long) stats->framesReordered, (unsigned long) stats->framesOverflowed);
+}
+
+int main(int argc, char * argv[]){
+    if(argc < 3 || argc > 5 || (strcmp(argv[1], "recv") != 0 && strcmp(argv[1], "send") != 0)){
+        fprintf(stderr, "Usage: tcpsim <recv|send> <bytes> [link description] [time limit ms]\n");
+        return 1;
+    }
+
+    bool receiving = strcmp(argv[1], "recv") == 0;
+    uint32_t total = strtoul(argv[2], NULL, 10);
+    const char * description = argc > 3 ? argv[3] : "";
+    uint32_t timeLimit = argc > 4 ? strtoul(argv[4], NULL, 10) : TCPSIM_TIME_LIMIT_DEFAULT;
+
+    SIMLINK_CONFIG config;
+
+    if(!simlink_parse(description, &config)){
+        fprintf(stderr, "Cannot read link description: %s\n", description);
+        return 1;
+    }
+
+    setenv(TCPSIM_LINK_ENV, description, 1);
+
+    if(Utils::parseEnv() != 0){
+        fprintf(stderr, "Cannot read the mTCP configuration, is MTCPCFG set?\n");
+        return 1;
+    }
+
+    if(Utils::initStack(1, TCP_SOCKET_RING_SIZE, tcpsim_ctrl_break, tcpsim_ctrl_c)){
+        fprintf(stderr, "Cannot start the TCP/IP stack\n");
+        return 1;
+    }
+
+    // The stack has finished probing with the host clock, only the link decides time from here
+    host_clock_virtual(TCPSIM_START_MS);
+    srand(config.seed);
+
+    IpAddr_t server;
+    sscanf(GATEWAY_ADDRESS, "%hhu.%hhu.%hhu.%hhu", &server[0], &server[1], &server[2], &server[3]);
+
+    TcpSocket * socket = TcpSocketMgr::getSocket();
+    socket->setRecvBuffer(TCPSIM_RECV_BUFFER_SIZE);
+
+    uint16_t port = receiving ? GATEWAY_SOURCE_PORT : GATEWAY_DISCARD_PORT;
+
+    if(socket->connectNonBlocking(TCPSIM_LOCAL_PORT, server, port) != 0){
+        fprintf(stderr, "Cannot connect to %s port %u\n", GATEWAY_ADDRESS, port);
+        Utils::endStack();
+        return 1;
+    }
+
+    uint8_t buffer[TCPSIM_CHUNK_SIZE];
+    uint32_t transferred = 0;
+    uint32_t corruptAt = 0;
+    bool corrupt = false;
+    int state = TCPSIM_STATE_CONNECTING;
+
+    uint32_t start = host_clock_ms();
+
+    while(state != TCPSIM_STATE_DONE && !tcpsimStop && host_clock_ms() - start < timeLimit){
+        tcpsim_drive_packets();
+
+        if(state == TCPSIM_STATE_CONNECTING){
+            if(socket->isConnectComplete()){
+                if(receiving){
+                    int length = sprintf((char *) buffer, "%lu\n", (unsigned long) total);
+                    socket->send(buffer, length);
+                }
+
+                state = TCPSIM_STATE_TRANSFER;
+            } else if(socket->isClosed()){
+                break;
+            }
+        } else if(state == TCPSIM_STATE_TRANSFER){
+            if(receiving){
+                int16_t length;
+
+                while((length = socket->recv(buffer, sizeof(buffer))) > 0){
+                    for(int16_t i = 0; i < length; i++){
+                        if(!corrupt && buffer[i] != GATEWAY_SOURCE_BYTE(transferred + i)){
+                            corrupt = true;
+                            corruptAt = transferred + i;
+                        }
+                    }
+
+                    transferred += length;
+                }
+
+                if(length < 0 || (socket->isRemoteClosed() && !socket->recvDataWaiting())){
+                    socket->closeNonblocking();
+                    state = TCPSIM_STATE_CLOSING;
+                }
+            } else {
+                while(transferred < total){
+                    uint16_t chunk = total - transferred < sizeof(buffer) ? (uint16_t) (total - transferred) : sizeof(buffer);
+
+                    for(uint16_t i = 0; i < chunk; i++){
+                        buffer[i] = GATEWAY_SOURCE_BYTE(transferred + i);
+                    }
+
+                    int16_t length = socket->send(buffer, chunk);
+
+                    if(length <= 0){
+                        break;
+                    }
+
+                    transferred += length;
+                }
+
+                // Closing sends the FIN after the data so the transfer ends when it is acknowledged
+                if(transferred == total){
+                    socket->closeNonblocking();
+                    state = TCPSIM_STATE_CLOSING;
+                }
+            }
+        } else if(state == TCPSIM_STATE_CLOSING && socket->isCloseDone()){
+            state = TCPSIM_STATE_DONE;
+        }
+    }
+
+    // Anything but 0 means the close timed out and the socket was destroyed
+    uint8_t closeReason = socket->getCloseReason();
+
+    if(state == TCPSIM_STATE_DONE){
+        TcpSocketMgr::freeSocket(socket);
+    }
+
+    uint32_t elapsed = host_clock_ms() - start;
+    const GATEWAY_STATS * gateway = gateway_stats();
+
+    // The discard service counts what really got to the far end
+    uint32_t arrived = receiving ? transferred : gateway->bytesToHost;
+
+    printf("%s %lu bytes, link \"%s\"\n", argv[1], (unsigned long) total, description);
+    printf("Time: %lu ms, %lu bytes/s\n", (unsigned long) elapsed,
+        elapsed > 0 ? (unsigned long) ((uint64_t) arrived * 1000 / elapsed) : 0UL);
+    printf("Tcp: sent %lu, received %lu, retransmitted %lu, seq/ack errors %lu, dropped no space %lu\n",
+        (unsigned long) Tcp::Packets_Sent, (unsigned long) Tcp::Packets_Received, (unsigned long) Tcp::Packets_Retransmitted,
+        (unsigned long) Tcp::Packets_SeqOrAckError, (unsigned long) Tcp::Packets_DroppedNoSpace);
+    printf("Packets: sent %lu, received %lu, dropped %lu\n",
+        (unsigned long) Packets_sent, (unsigned long) Packets_received, (unsigned long) Packets_dropped);
+    printf("Gateway: retransmitted %lu, dropped %lu\n", (unsigned long) gateway->retransmits, (unsigned long) gateway->framesDropped);
+    tcpsim_print_link("to gateway", SIMLINK_TO_GATEWAY);
+    tcpsim_print_link("to stack", SIMLINK_TO_STACK);
+
+    Utils::endStack();
+
+    if(state != TCPSIM_STATE_DONE){
+        printf("FAILED: %s after %lu of %lu bytes\n", tcpsimStop ? "stopped" : "not finished",
+            (unsigned long) arrived, (unsigned long) total);
+        return 1;
+    }
+
+    if(closeReason != 0){
+        printf("FAILED: close did not finish, reason %u\n", closeReason);
+        return 1;
+    }
+
+    if(corrupt){
+        printf("FAILED: wrong data at byte %lu\n", (unsigned long) corruptAt);
+        return 1;
+    }
+
+    if(arrived != total){
+        printf("FAILED: %lu of %lu bytes arrived\n", (unsigned long) arrived, (unsigned long) total);
+        return 1;
+    }
+
+    return 0;
+}
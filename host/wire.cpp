@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+
+#include "wire.h"
+#include "gateway.h"
+#include "simlink.h"
+#include "host.h"
+
+#define WIRE_TAP_ENV "HOSTTAP"
+#define WIRE_TAP_DEVICE "/dev/net/tun"
+#define WIRE_LINK_ENV "HOSTLINK"
+
+// Same as the first network card of QEMU
+const uint8_t wireAddress[6] = {0x52, 0x54, 0x00, 0x12, 0x34, 0x56};
+
+// TAP device in use instead of the gateway, -1 if none
+int wireTap = -1;
+
+bool wire_open_tap(const char * name){
+    wireTap = open(WIRE_TAP_DEVICE, O_RDWR | O_NONBLOCK);
+
+    if(wireTap < 0){
+        fprintf(stderr, "Cannot open %s: %s\n", WIRE_TAP_DEVICE, strerror(errno));
+        return false;
+    }
+
+    struct ifreq request;
+    memset(&request, 0, sizeof(request));
+    request.ifr_flags = IFF_TAP | IFF_NO_PI;
+    strncpy(request.ifr_name, name, IFNAMSIZ - 1);
+
+    if(ioctl(wireTap, TUNSETIFF, &request) < 0){
+        fprintf(stderr, "Cannot attach to TAP device %s: %s\n", name, strerror(errno));
+        close(wireTap);
+        wireTap = -1;
+        return false;
+    }
+
+    return true;
+}
+
+// The gateway is reached through a simulated link if one is described
+bool wire_open_link(const char * description){
+    SIMLINK_CONFIG config;
+
+    if(!simlink_parse(description, &config)){
+        fprintf(stderr, "Cannot read %s link description: %s\n", WIRE_LINK_ENV, description);
+        return false;
+    }
+
+    return simlink_open(&config);
+}
+
+bool wire_open(){
+    const char * tapName = getenv(WIRE_TAP_ENV);
+
+    if(tapName != NULL && tapName[0] != '\0'){
+        return wire_open_tap(tapName);
+    }
+
+    const char * link = getenv(WIRE_LINK_ENV);
+
+    if(link != NULL && link[0] != '\0' && !wire_open_link(link)){
+        return false;
+    }
+
+    return gateway_open();
+}
+
+void wire_close(){
+    if(wireTap >= 0){
+        close(wireTap);
+        wireTap = -1;
+    } else {
+        gateway_close();
+        simlink_close();
+    }
+}
+
+void wire_address(uint8_t * mac){
+    memcpy(mac, wireAddress, sizeof(wireAddress));
+}
+
+void wire_send(const uint8_t * frame, uint16_t length){
+    if(wireTap >= 0){
+        // A full TAP queue drops the frame like a busy card would
+        if(write(wireTap, frame, length) < 0 && errno != EAGAIN){
+            perror("TAP write");
+        }
+        return;
+    }
+
+    if(simlink_enabled()){
+        simlink_send(SIMLINK_TO_GATEWAY, frame, length);
+        return;
+    }
+
+    gateway_input(frame, length);
+}
+
+uint16_t wire_receive(uint8_t * frame, uint16_t size){
+    if(wireTap >= 0){
+        int length = read(wireTap, frame, size);
+        return length > 0 ? length : 0;
+    }
+
+    if(simlink_enabled()){
+        return simlink_receive(SIMLINK_TO_STACK, frame, size);
+    }
+
+    return gateway_output(frame, size);
+}
+
+// Let the gateway run, then move frames between it and the link that have arrived by now
+void wire_run_gateway(int waitMs){
+    if(!simlink_enabled()){
+        gateway_poll(waitMs);
+        return;
+    }
+
+    uint8_t frame[WIRE_FRAME_SIZE];
+    uint16_t length;
+
+    while((length = simlink_receive(SIMLINK_TO_GATEWAY, frame, sizeof(frame))) > 0){
+        gateway_input(frame, length);
+    }
+
+    // Only wait until the next frame arrives
+    int32_t untilArrival = simlink_next_arrival();
+
+    if(untilArrival >= 0 && untilArrival < waitMs){
+        waitMs = untilArrival;
+    }
+
+    gateway_poll(waitMs);
+
+    while((length = simlink_receive(SIMLINK_TO_GATEWAY, frame, sizeof(frame))) > 0){
+        gateway_input(frame, length);
+    }
+
+    while((length = gateway_output(frame, sizeof(frame))) > 0){
+        simlink_send(SIMLINK_TO_STACK, frame, length);
+    }
+}
+
+void wire_poll(int waitMs){
+    if(wireTap >= 0){
+        struct pollfd tap;
+        tap.fd = wireTap;
+        tap.events = POLLIN;
+        poll(&tap, 1, waitMs);
+        return;
+    }
+
+    // Waiting is what moves a virtual clock on
+    if(host_clock_is_virtual()){
+        host_clock_advance(waitMs);
+        wire_run_gateway(0);
+        return;
+    }
+
+    wire_run_gateway(waitMs);
+}
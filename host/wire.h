@@ -0,0 +1,26 @@
+// Ethernet wire between the host packet driver (hostpkt.cpp) and whatever is at the other
+// end: the built-in gateway, or a Linux TAP device named by the HOSTTAP environment
+// variable. Frames are passed whole, without the padding of runt frames. The gateway can
+// be put behind a simulated link described by the HOSTLINK environment variable, see simlink.h.
+
+#include <stdint.h>
+
+// Largest frame passed either way
+#define WIRE_FRAME_SIZE 1514
+
+// Connect the wire. Returns false if the TAP device cannot be opened.
+bool wire_open();
+
+void wire_close();
+
+// MAC address of the stack's end of the wire
+void wire_address(uint8_t * mac);
+
+// Put a frame from the stack on the wire
+void wire_send(const uint8_t * frame, uint16_t length);
+
+// Take the next frame for the stack off the wire. Returns its length or 0 if there is none.
+uint16_t wire_receive(uint8_t * frame, uint16_t size);
+
+// Let the other end run. Waits up to waitMs for something to arrive if no frame is waiting.
+void wire_poll(int waitMs);